@@ -0,0 +1,180 @@
+// Per-call cost of the hot database paths: db_create_move() and db_get_user() with the cached
+// prepared statements, against the same queries prepared and finalized on every call, then
+// db_get_user() again with the user cache the server puts in front of it, and the space finished
+// matches take with their moves as rows or packed.
+//
+//   gcc -O2 -I../src db_bench.c ../src/database.c ../src/user_cache.c ../src/leaderboard.c ../src/cJSON.c -o db_bench -lsqlite3 -lpthread -lm -lz
+//   ./db_bench [iterations] [database file]   (default: 200000, in memory)
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "database.h"
+#include "user_cache.h"
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The queries as they were run before the statement cache
+static int uncachedCreateMove(Database *database, int match_id, int player_id, int x, int y, const char *result, int turn_order)
+{
+    sqlite3_stmt *stmt;
+    const char *sql = "INSERT INTO moves (match_id, player_id, x, y, result, turn_order) VALUES (?, ?, ?, ?, ?, ?);";
+    if (sqlite3_prepare_v2(database->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        return 0;
+    sqlite3_bind_int(stmt, 1, match_id);
+    sqlite3_bind_int(stmt, 2, player_id);
+    sqlite3_bind_int(stmt, 3, x);
+    sqlite3_bind_int(stmt, 4, y);
+    sqlite3_bind_text(stmt, 5, result, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 6, turn_order);
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE ? (int)sqlite3_last_insert_rowid(database->db) : 0;
+}
+
+static User uncachedGetUser(Database *database, const char *username)
+{
+    User user = {0};
+    sqlite3_stmt *stmt;
+    const char *sql = "SELECT id, username, password_hash, elo, wins, losses FROM users WHERE username = ?;";
+    if (sqlite3_prepare_v2(database->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        return user;
+    sqlite3_bind_text(stmt, 1, username, -1, SQLITE_TRANSIENT);
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        user.id = sqlite3_column_int(stmt, 0);
+        snprintf(user.username, sizeof(user.username), "%s", sqlite3_column_text(stmt, 1));
+        snprintf(user.password_hash, sizeof(user.password_hash), "%s", sqlite3_column_text(stmt, 2));
+        user.elo = sqlite3_column_int(stmt, 3);
+        user.wins = sqlite3_column_int(stmt, 4);
+        user.losses = sqlite3_column_int(stmt, 5);
+    }
+    sqlite3_finalize(stmt);
+    return user;
+}
+
+// Bytes in use after storing matches finished games of moves_per_match shots each
+static long storedBytes(DbMoveStorage storage, int matches, int moves_per_match)
+{
+    Database db;
+    long pages = 0, free_pages = 0, page_size = 0;
+    if (db_init(&db, ":memory:") != 0 || db_create_tables(&db) != 0)
+        return 0;
+
+    db_set_move_storage(storage);
+    db_begin(&db);
+    int p1 = db_create_user(&db, "bench_p1", "hash");
+    int p2 = db_create_user(&db, "bench_p2", "hash");
+    for (int i = 0; i < matches; i++)
+    {
+        int match_id = db_create_match(&db, p1, p2);
+        for (int turn = 0; turn < moves_per_match; turn++)
+            db_create_move(&db, match_id, turn % 2 ? p2 : p1, (turn / 2) % 10, (turn / 20) % 10, turn % 3 ? "MISS" : "HIT", turn + 1);
+        db_finalize_match(&db, match_id, "P1_WIN", p1, 1000, p2, 1000);
+    }
+    db_commit(&db);
+
+    sqlite3_stmt *stmt;
+    const char *pragmas[] = {"PRAGMA page_count;", "PRAGMA freelist_count;", "PRAGMA page_size;"};
+    long *values[] = {&pages, &free_pages, &page_size};
+    for (int i = 0; i < 3; i++)
+    {
+        if (sqlite3_prepare_v2(db.db, pragmas[i], -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+            *values[i] = sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    db_close(&db);
+    return (pages - free_pages) * page_size;
+}
+
+// before: the previous way, after: the cached one
+static void report(const char *name, int iterations, double before, double after)
+{
+    printf("%-16s before %8.2f us/call   after %8.2f us/call   saving %6.2f us/call (%.1fx)\n", name,
+           before * 1e6 / iterations, after * 1e6 / iterations, (before - after) * 1e6 / iterations, before / after);
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+    const char *filename = argc > 2 ? argv[2] : ":memory:";
+    Database db;
+    char name[64];
+
+    if (iterations < 1 || db_init(&db, filename) != 0 || db_create_tables(&db) != 0)
+        return 1;
+
+    //* Users to look up, and a match for the moves
+    db_begin(&db);
+    int first_id = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        snprintf(name, sizeof(name), "bench_user_%d", i);
+        int id = db_create_user(&db, name, "hash");
+        if (i == 0)
+            first_id = id;
+    }
+    int match_id = db_create_match(&db, first_id, first_id + 1);
+    db_commit(&db);
+
+    //* One transaction per run so the disk does not hide the statement cost
+    double start = nowSeconds();
+    db_begin(&db);
+    for (int i = 0; i < iterations; i++)
+        uncachedCreateMove(&db, match_id, first_id, i % 10, (i / 10) % 10, "MISS", i + 1);
+    db_commit(&db);
+    double uncached = nowSeconds() - start;
+
+    start = nowSeconds();
+    db_begin(&db);
+    for (int i = 0; i < iterations; i++)
+        db_create_move(&db, match_id, first_id, i % 10, (i / 10) % 10, "MISS", i + 1);
+    db_commit(&db);
+    report("db_create_move", iterations, uncached, nowSeconds() - start);
+
+    long found = 0;
+    start = nowSeconds();
+    for (int i = 0; i < iterations; i++)
+    {
+        snprintf(name, sizeof(name), "bench_user_%d", i % 1000);
+        found += uncachedGetUser(&db, name).id > 0;
+    }
+    uncached = nowSeconds() - start;
+
+    start = nowSeconds();
+    for (int i = 0; i < iterations; i++)
+    {
+        snprintf(name, sizeof(name), "bench_user_%d", i % 1000);
+        found += db_get_user(&db, name).id > 0;
+    }
+    double statement = nowSeconds() - start;
+    report("db_get_user", iterations, uncached, statement);
+
+    //* Every user fits: the first round fills the cache, the rest are hits
+    user_cache_init(DEFAULT_USER_CACHE_SIZE);
+    start = nowSeconds();
+    for (int i = 0; i < iterations; i++)
+    {
+        snprintf(name, sizeof(name), "bench_user_%d", i % 1000);
+        found += db_get_user(&db, name).id > 0;
+    }
+    report("db_get_user+LRU", iterations, statement, nowSeconds() - start);
+    user_cache_free();
+
+    //* Finished matches: one row per shot against one packed blob per match
+    long rows = storedBytes(DB_MOVES_ROWS, 2000, 100);
+    long packed = storedBytes(DB_MOVES_PACKED, 2000, 100);
+    printf("%-16s rows   %8ld KiB          packed %8ld KiB          (%.1fx smaller)\n", "2000x100 moves",
+           rows / 1024, packed / 1024, packed ? (double)rows / packed : 0.0);
+
+    if (found != 3L * iterations)
+        printf("[WARNING] %ld of %d lookups found their user\n", found, 3 * iterations);
+
+    db_close(&db);
+    return 0;
+}
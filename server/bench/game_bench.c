@@ -0,0 +1,227 @@
+// Per-move cost of a classic board: attack_cell() followed by all_ships_sunk() on the bitboard
+// BoardState against the char grid it replaced (which looked for the ship hit by walking every
+// ship's cells, and for the end of the game by scanning every cell), and attack_packed() followed
+// by packed_remaining(), the two calls MOVE_REQ makes on the packed board the classic kernels own.
+//
+//   gcc -O2 -I../src game_bench.c ../src/game.c -o game_bench
+//   ./game_bench [games]   (default: 200000)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "game.h"
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define ROWS 10 //* Classic board and fleet
+#define COLS 10
+#define SHIPS 5
+
+// The board as it was before the bitboard, not inlined so every side pays the call into game.c
+typedef struct
+{
+    char board[ROWS][COLS]; //* " " -> blank, "o" -> miss, "x" -> hit, "s" -> ship
+    Ship ships[SHIPS];
+} GridBoard;
+
+static void gridPlaceShip(GridBoard *state, int index, ShipType type, int row, int col, Orientation orient)
+{
+    Ship *s = &state->ships[index];
+    s->ship_type = type;
+    s->row = row;
+    s->col = col;
+    s->orient = orient;
+    s->size = get_ship_size(type);
+    s->hits = 0;
+    s->sunk = 0;
+    for (int i = 0; i < s->size; i++)
+        state->board[row + (orient == VERTICAL ? i : 0)][col + (orient == HORIZONTAL ? i : 0)] = 's';
+}
+
+__attribute__((noinline)) static AttackResult gridAttackCell(GridBoard *state, int row, int col)
+{
+    if (row < 0 || row >= ROWS || col < 0 || col >= COLS)
+        return ATTACK_INVALID;
+
+    char cell = state->board[row][col];
+    if (cell == 'x' || cell == 'o')
+        return ATTACK_INVALID;
+    if (cell != 's')
+    {
+        state->board[row][col] = 'o';
+        return ATTACK_MISS;
+    }
+
+    state->board[row][col] = 'x';
+    for (int i = 0; i < SHIPS; i++)
+    {
+        Ship *s = &state->ships[i];
+        if (s->size == 0 || s->sunk)
+            continue;
+        for (int j = 0; j < s->size; j++)
+        {
+            if (s->row + (s->orient == VERTICAL ? j : 0) == row && s->col + (s->orient == HORIZONTAL ? j : 0) == col)
+            {
+                if (++s->hits >= s->size)
+                {
+                    s->sunk = 1;
+                    return ATTACK_SUNK;
+                }
+                return ATTACK_HIT;
+            }
+        }
+    }
+    return ATTACK_HIT;
+}
+
+__attribute__((noinline)) static int gridAllShipsSunk(GridBoard *state)
+{
+    for (int i = 0; i < SHIPS; i++)
+    {
+        if (state->ships[i].size > 0 && !state->ships[i].sunk)
+            return 0;
+    }
+    for (int r = 0; r < ROWS; r++)
+    {
+        for (int c = 0; c < COLS; c++)
+        {
+            if (state->board[r][c] == 's')
+                return 0;
+        }
+    }
+    return 1;
+}
+
+//* The standard fleet, one ship per row (every other game: per column) so every placement is valid
+static const ShipType fleet[SHIPS] = {CARRIER, BATTLESHIP, CRUISER, SUBMARINE, DESTROYER};
+static const int fleet_lines[SHIPS] = {0, 2, 4, 6, 8};
+
+// A game fires at every cell in a shuffled order until the fleet is sunk
+static void shuffledCells(int *cells, unsigned int *seed)
+{
+    for (int i = 0; i < ROWS * COLS; i++)
+        cells[i] = i;
+    for (int i = ROWS * COLS - 1; i > 0; i--)
+    {
+        *seed = *seed * 1103515245u + 12345u;
+        int j = (int)((*seed >> 8) % (unsigned int)(i + 1));
+        int t = cells[i];
+        cells[i] = cells[j];
+        cells[j] = t;
+    }
+}
+
+#define BATCH 4096 //* Boards set up (untimed) before each timed round of games
+
+int main(int argc, char *argv[])
+{
+    int games = argc > 1 ? atoi(argv[1]) : 200000;
+    if (games < 1)
+        return 1;
+
+    //* Same shot orders for both boards
+    enum { ORDERS = 64 };
+    static int orders[ORDERS][ROWS * COLS];
+    unsigned int seed = 12345;
+    for (int i = 0; i < ORDERS; i++)
+        shuffledCells(orders[i], &seed);
+
+    int packed_size = game_rules[VARIANT_CLASSIC].packed_size;
+    GridBoard *grids = malloc(sizeof(GridBoard) * BATCH);
+    BoardState *boards = malloc(sizeof(BoardState) * BATCH);
+    unsigned char *packed = malloc((size_t)packed_size * BATCH);
+    if (!grids || !boards || !packed)
+        return 1;
+
+    long grid_moves = 0, grid_sunk = 0, moves = 0, sunk = 0, packed_moves = 0, packed_sunk = 0;
+    double grid = 0, bitboard = 0, kernel = 0;
+    for (int first = 0; first < games; first += BATCH)
+    {
+        int count = games - first < BATCH ? games - first : BATCH;
+        for (int b = 0; b < count; b++)
+        {
+            int g = first + b;
+            memset(grids[b].board, ' ', sizeof(grids[b].board));
+            memset(grids[b].ships, 0, sizeof(grids[b].ships));
+            init_board_state(&boards[b]);
+            Orientation orient = g & 1 ? VERTICAL : HORIZONTAL;
+            for (int i = 0; i < SHIPS; i++)
+            {
+                int row = orient == HORIZONTAL ? fleet_lines[i] : g % 5;
+                int col = orient == HORIZONTAL ? g % 5 : fleet_lines[i];
+                gridPlaceShip(&grids[b], i, fleet[i], row, col, orient);
+                place_ship(&boards[b], fleet[i], row, col, orient);
+            }
+            FleetLayout layout;
+            pack_fleet(&boards[b], &layout);
+            init_packed_board(packed + (size_t)b * packed_size, &layout);
+        }
+
+        double start = nowSeconds();
+        for (int b = 0; b < count; b++)
+        {
+            const int *cells = orders[(first + b) % ORDERS];
+            for (int i = 0; i < ROWS * COLS; i++)
+            {
+                grid_moves++;
+                AttackResult result = gridAttackCell(&grids[b], cells[i] / COLS, cells[i] % COLS);
+                grid_sunk += result == ATTACK_SUNK;
+                if (gridAllShipsSunk(&grids[b]))
+                    break;
+            }
+        }
+        grid += nowSeconds() - start;
+
+        start = nowSeconds();
+        for (int b = 0; b < count; b++)
+        {
+            const int *cells = orders[(first + b) % ORDERS];
+            for (int i = 0; i < ROWS * COLS; i++)
+            {
+                moves++;
+                AttackResult result = attack_cell(&boards[b], cells[i] / COLS, cells[i] % COLS);
+                sunk += result == ATTACK_SUNK;
+                if (all_ships_sunk(&boards[b]))
+                    break;
+            }
+        }
+        bitboard += nowSeconds() - start;
+
+        start = nowSeconds();
+        for (int b = 0; b < count; b++)
+        {
+            const int *cells = orders[(first + b) % ORDERS];
+            void *board = packed + (size_t)b * packed_size;
+            for (int i = 0; i < ROWS * COLS; i++)
+            {
+                packed_moves++;
+                AttackResult result = attack_packed(VARIANT_CLASSIC, board, cells[i] / COLS, cells[i] % COLS);
+                packed_sunk += result == ATTACK_SUNK;
+                if (packed_remaining(board) == 0)
+                    break;
+            }
+        }
+        kernel += nowSeconds() - start;
+    }
+
+    printf("%-16s grid %8.2f ns/move   bitboard %8.2f ns/move   (%.1fx)   %ld moves in %d games\n", "attack+sunk",
+           grid * 1e9 / grid_moves, bitboard * 1e9 / moves, (grid / grid_moves) / (bitboard / moves), moves, games);
+    printf("%-16s grid %8.2f ns/move   packed   %8.2f ns/move   (%.1fx)   classic kernels\n", "attack+sunk",
+           grid * 1e9 / grid_moves, kernel * 1e9 / packed_moves, (grid / grid_moves) / (kernel / packed_moves));
+
+    if (moves != grid_moves || sunk != grid_sunk || sunk != (long)games * SHIPS ||
+        packed_moves != moves || packed_sunk != sunk)
+        printf("[WARNING] the boards disagree: %ld/%ld/%ld moves, %ld/%ld/%ld ships sunk\n",
+               grid_moves, moves, packed_moves, grid_sunk, sunk, packed_sunk);
+
+    free(grids);
+    free(boards);
+    free(packed);
+    return 0;
+}
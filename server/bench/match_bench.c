@@ -0,0 +1,88 @@
+// Memory a shard spends per live match: the MatchSession record, then the heap a MatchPool really
+// uses once it holds that many matches (session blocks, match_id index, free list), against the
+// record as it was when a session kept copies of both Players and both full boards. Classic
+// matches, the session size of every variant is listed after.
+//
+//   gcc -O2 -I../src match_bench.c ../src/match_pool.c ../src/intmap.c ../src/game.c -o match_bench
+//   ./match_bench [matches]   (default: 1000000)
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+
+#include "server.h"
+#include "match_pool.h"
+
+// The classic board as a session copied it, before variants sized BoardState for the largest
+typedef struct
+{
+    uint64_t occupied[2], hit[2], miss[2];
+    unsigned char ship_at[100];
+    int remaining;
+    Ship ships[5];
+} CopiedBoard;
+
+// The session as it was before the compact record
+typedef struct
+{
+    int match_id;
+    unsigned int slot;
+    unsigned int generation;
+    Player player_1;
+    Player player_2;
+    CopiedBoard board_p1;
+    CopiedBoard board_p2;
+    int current_turn;
+    int move_count;
+    int attached_mask;
+    int gone_mask;
+    int started;
+} CopiedMatchSession;
+
+static size_t heapInUse(void)
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+int main(int argc, char *argv[])
+{
+    int matches = argc > 1 ? atoi(argv[1]) : 1000000;
+    size_t session_size = sizeof(MatchSession) + 2 * game_rules[VARIANT_CLASSIC].packed_size;
+    MatchPool pool;
+    if (matches < 1 || !matchPoolInit(&pool, VARIANT_CLASSIC, session_size))
+        return 1;
+
+    //* Fill a pool the way a shard does, one match at a time
+    FleetLayout fleet = {VARIANT_CLASSIC, 0, {0, 20, 40, 60, 80}};
+    size_t before = heapInUse();
+    for (int i = 1; i <= matches; i++)
+    {
+        MatchSession *match = matchPoolAlloc(&pool, i);
+        if (!match)
+        {
+            printf("[ERROR] Out of memory after %d matches\n", i - 1);
+            return 1;
+        }
+        match->seats[0] = (MatchSeat){2 * i, 100 + i, 1000};
+        match->seats[1] = (MatchSeat){2 * i + 1, 101 + i, 1000};
+        init_packed_board(match->boards, &fleet);
+        init_packed_board((unsigned char *)match->boards + game_rules[VARIANT_CLASSIC].packed_size, &fleet);
+    }
+    size_t used = heapInUse() - before;
+
+    printf("%-16s copied %6zu B          compact %6zu B\n", "MatchSession", sizeof(CopiedMatchSession), session_size);
+    printf("%-16s copied %6zu B          compact %6zu B\n", "queued board", sizeof(CopiedBoard), sizeof(FleetLayout));
+    printf("%-16s %d live matches use %.1f MiB: %.1f B/match (session + index + free list)\n", "pool heap",
+           pool.count, used / 1048576.0, (double)used / matches);
+    printf("%-16s copied %8.2f M/GiB   compact %8.2f M/GiB\n", "matches per GiB",
+           1073741824.0 / (sizeof(CopiedMatchSession) + (double)used / matches - session_size) / 1e6,
+           1073741824.0 / ((double)used / matches) / 1e6);
+    for (int v = 0; v < GAME_VARIANT_COUNT; v++)
+    {
+        printf("%-16s %-8s %2dx%-2d %d ships   %3zu B/session\n", v == 0 ? "variants" : "", game_rules[v].name,
+               game_rules[v].rows, game_rules[v].cols, game_rules[v].ship_count, sizeof(MatchSession) + 2 * game_rules[v].packed_size);
+    }
+
+    matchPoolFree(&pool);
+    return 0;
+}
@@ -0,0 +1,360 @@
+// Headless self-play: games played straight on game.c and ai.c, no sockets. Each game deals two random
+// fleets and lets one shooter (an ai.c level) fire at each until it is sunk, alternating turns, the seat
+// that fires first winning a tie. Every variant is played with every shooter across all cores, and
+// the bench reports games/s, moves/s and the distribution of shots needed to sink a fleet.
+//
+// Game g only depends on the seed and g, never on the thread that plays it, so the fingerprint of a
+// run (a hash of every game's shot counts) is the same for any -t. Pass the fingerprint of a run
+// before a rules or kernel change to -f after it: the bench exits 1 if any outcome changed.
+// -c also replays every shot on a BoardState, and exits 1 if it ever disagrees with the packed board.
+// A shooter that aims (parity, density) must never need every cell of the board: the bench exits 1 if
+// one does, which is how a bot that retires the wrong ship and loses track of the fleet shows up.
+// A shooter that runs out of cells before the fleet is sunk fails the run too. A game with a fleet that
+// was not sunk is left out of the statistics and the fingerprint.
+//
+//   gcc -O2 -I../src sim_bench.c ../src/ai.c ../src/game.c -o sim_bench -lpthread
+//   ./sim_bench [-g games] [-t threads] [-s seed] [-v variant] [-p random|parity|density] [-c] [-f fingerprint]
+//   (defaults: 100000 games per variant and shooter, one thread per online CPU, seed 1)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "game.h"
+#include "ai.h"
+
+#define CHUNK 256      //* Games a thread takes at a time
+#define MAX_THREADS 256
+#define MAX_SHOTS (MAX_BOARD_ROW * MAX_BOARD_COL)
+#define MAX_PACKED 256 //* Bytes, more than the packed board of any variant (checked in main)
+
+// A shooter is an ai.c level, one line here adds it to the bench
+typedef struct
+{
+    const char *name;
+    AiLevel level;
+    int aims; //* Never needs every cell to sink a fleet
+} Shooter;
+
+static const Shooter shooters[] = {
+    {"random", AI_EASY, 0},    //* Random cells, random neighbours of a hit
+    {"parity", AI_MEDIUM, 1},  //* Lattice hunt, line target
+    {"density", AI_HARD, 1},   //* Probability density
+};
+#define SHOOTER_COUNT (int)(sizeof(shooters) / sizeof(shooters[0]))
+
+typedef struct
+{
+    GameVariant variant;
+    const Shooter *shooter;
+    long games;
+    uint32_t seed;
+    int check;
+    long next_game; //* Shared, taken CHUNK at a time (atomic)
+} Run;
+
+typedef struct
+{
+    pthread_t thread;
+    Run *run;
+    long games;
+    long first_wins; //* Games the seat that fired first won
+    long mismatches; //* -c: shots the packed board and the BoardState disagree on
+    long failures;   //* Fleets the shooter could not sink (no cell left to fire at, or no start)
+    long full_boards; //* Fleets an aiming shooter only sank with its shot at the last cell
+    uint64_t fingerprint;
+    long shots[MAX_SHOTS + 1]; //* Fleets sunk in exactly i shots
+} Worker;
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// xorshift seed of one side of game g, never 0
+static uint32_t gameSeed(uint32_t seed, long g, int side)
+{
+    uint32_t s = (uint32_t)mix64(((uint64_t)seed << 32) ^ ((uint64_t)g << 1 | side));
+    return s ? s : 1;
+}
+
+// Shots one side needs to sink the fleet it fires at, -1 (counted in the worker) if the boards disagree or the shooter gets stuck
+static int playSide(const Run *run, uint32_t seed, Worker *worker)
+{
+    GameVariant variant = run->variant;
+    FleetLayout fleet;
+    uint64_t board[MAX_PACKED / 8];
+    BoardState reference;
+    AiPlayer ai;
+    if (!ai_random_fleet(variant, &seed, &fleet) || !ai_init(&ai, variant, run->shooter->level, seed))
+    {
+        worker->failures++;
+        return -1;
+    }
+
+    init_packed_board(board, &fleet);
+    if (run->check && !unpack_fleet(&fleet, &reference))
+    {
+        worker->failures++;
+        return -1;
+    }
+
+    int shots = 0, row, col;
+    while (packed_remaining(board) > 0)
+    {
+        if (!ai_next_shot(&ai, &row, &col))
+        {
+            worker->failures++;
+            return -1;
+        }
+        AttackResult result = attack_packed(variant, board, row, col);
+        if (run->check && attack_cell(&reference, row, col) != result)
+        {
+            worker->mismatches++;
+            return -1;
+        }
+        ai_record_shot(&ai, row, col, result);
+        shots++;
+    }
+    if (run->check && !all_ships_sunk(&reference))
+    {
+        worker->mismatches++;
+        return -1;
+    }
+    return shots;
+}
+
+static void *workerThread(void *arg)
+{
+    Worker *worker = arg;
+    Run *run = worker->run;
+    int cells = game_rules[run->variant].rows * game_rules[run->variant].cols;
+
+    while (1)
+    {
+        long first = __atomic_fetch_add(&run->next_game, CHUNK, __ATOMIC_RELAXED);
+        if (first >= run->games)
+            break;
+        long last = first + CHUNK < run->games ? first + CHUNK : run->games;
+
+        for (long g = first; g < last; g++)
+        {
+            int shots[2];
+            for (int side = 0; side < 2; side++)
+                shots[side] = playSide(run, gameSeed(run->seed, g, side), worker);
+            if (shots[0] < 0 || shots[1] < 0)
+                continue; //* Counted as a mismatch or a failure, the run exits 1
+
+            for (int side = 0; side < 2; side++)
+            {
+                if (run->shooter->aims && shots[side] == cells)
+                    worker->full_boards++;
+                worker->shots[shots[side]]++;
+            }
+
+            //* Seat g % 2 fires first: it wins when it needs no more shots than the other seat
+            int first_seat = (int)(g & 1);
+            int first_wins = shots[first_seat] <= shots[1 - first_seat];
+            worker->games++;
+            worker->first_wins += first_wins;
+            //* Order independent, so threads may finish their games in any order
+            worker->fingerprint += mix64((uint64_t)g << 20 | (uint64_t)shots[0] << 10 | (uint64_t)shots[1]);
+        }
+    }
+    return NULL;
+}
+
+// Smallest shot count with at least fraction of the fleets sunk by then
+static int percentile(const long *shots, long fleets, double fraction)
+{
+    long seen = 0;
+    for (int i = 0; i <= MAX_SHOTS; i++)
+    {
+        seen += shots[i];
+        if (seen >= fraction * fleets)
+            return i;
+    }
+    return MAX_SHOTS;
+}
+
+static int findShooter(const char *name)
+{
+    for (int i = 0; i < SHOOTER_COUNT; i++)
+    {
+        if (strcmp(shooters[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int main(int argc, char *argv[])
+{
+    long games = 100000;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t seed = 1;
+    int only_variant = -1, only_shooter = -1, check = 0, expect = 0;
+    uint64_t expected = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "g:t:s:v:p:cf:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'g':
+            games = atol(optarg);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 's':
+            seed = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'v':
+            only_variant = find_variant(optarg);
+            if (only_variant < 0)
+            {
+                fprintf(stderr, "Unknown variant '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'p':
+            only_shooter = findShooter(optarg);
+            if (only_shooter < 0)
+            {
+                fprintf(stderr, "Unknown shooter '%s', expected random|parity|density\n", optarg);
+                return 1;
+            }
+            break;
+        case 'c':
+            check = 1;
+            break;
+        case 'f':
+            expected = strtoull(optarg, NULL, 16);
+            expect = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-g games] [-t threads] [-s seed] [-v variant] [-p random|parity|density] [-c] [-f fingerprint]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (games < 1)
+        return 1;
+    if (threads < 1)
+        threads = 1;
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+    for (int v = 0; v < GAME_VARIANT_COUNT; v++)
+    {
+        if (game_rules[v].packed_size > MAX_PACKED)
+            return 1;
+    }
+
+    Worker *workers = calloc(threads, sizeof(Worker));
+    if (!workers)
+        return 1;
+
+    printf("%ld games per variant and shooter, %d threads, seed %u%s\n", games, threads, seed, check ? ", checked against BoardState" : "");
+    printf("%-8s %-8s %10s %12s %7s %5s %5s %5s %5s %5s %8s  %s\n", "variant", "shooter", "games/s", "moves/s",
+           "mean", "min", "p10", "p50", "p90", "max", "1st win", "fingerprint");
+
+    uint64_t total = 0;
+    long mismatches = 0, failures = 0, full_boards = 0;
+    for (int v = 0; v < GAME_VARIANT_COUNT; v++)
+    {
+        if (only_variant >= 0 && v != only_variant)
+            continue;
+        for (int p = 0; p < SHOOTER_COUNT; p++)
+        {
+            if (only_shooter >= 0 && p != only_shooter)
+                continue;
+
+            Run run = {(GameVariant)v, &shooters[p], games, seed + (uint32_t)(v * SHOOTER_COUNT + p), check, 0};
+            memset(workers, 0, sizeof(Worker) * threads);
+            double start = nowSeconds();
+            for (int t = 0; t < threads; t++)
+            {
+                workers[t].run = &run;
+                if (pthread_create(&workers[t].thread, NULL, workerThread, &workers[t]) != 0)
+                    return 1;
+            }
+
+            //* Merge into the first worker
+            Worker *sum = &workers[0];
+            pthread_join(sum->thread, NULL);
+            for (int t = 1; t < threads; t++)
+            {
+                pthread_join(workers[t].thread, NULL);
+                sum->games += workers[t].games;
+                sum->first_wins += workers[t].first_wins;
+                sum->mismatches += workers[t].mismatches;
+                sum->failures += workers[t].failures;
+                sum->full_boards += workers[t].full_boards;
+                sum->fingerprint += workers[t].fingerprint;
+                for (int i = 0; i <= MAX_SHOTS; i++)
+                    sum->shots[i] += workers[t].shots[i];
+            }
+            double elapsed = nowSeconds() - start;
+
+            long fleets = 2 * sum->games, fired = 0; //* Games with a failed side are not counted
+            int min = -1, max = 0;
+            for (int i = 0; i <= MAX_SHOTS; i++)
+            {
+                fired += (long)i * sum->shots[i];
+                if (sum->shots[i] && min < 0)
+                    min = i;
+                if (sum->shots[i])
+                    max = i;
+            }
+            //* Both fleets of a game are played until sunk, moves/s counts every shot fired
+            printf("%-8s %-8s %10.0f %12.0f %7.2f %5d %5d %5d %5d %5d %7.1f%%  %016" PRIx64 "\n", game_rules[v].name, shooters[p].name,
+                   sum->games / elapsed, fired / elapsed, (double)fired / fleets, min, percentile(sum->shots, fleets, 0.1),
+                   percentile(sum->shots, fleets, 0.5), percentile(sum->shots, fleets, 0.9), max,
+                   100.0 * sum->first_wins / sum->games, sum->fingerprint);
+
+            total += mix64(sum->fingerprint + (uint64_t)(v * SHOOTER_COUNT + p));
+            mismatches += sum->mismatches;
+            failures += sum->failures;
+            full_boards += sum->full_boards;
+        }
+    }
+    free(workers);
+
+    printf("fingerprint %016" PRIx64 "\n", total);
+    if (mismatches > 0)
+    {
+        printf("[ERROR] %ld fleets where the packed board and BoardState disagree\n", mismatches);
+        return 1;
+    }
+    if (failures > 0)
+    {
+        printf("[ERROR] %ld fleets the shooter could not sink\n", failures);
+        return 1;
+    }
+    if (full_boards > 0)
+    {
+        printf("[ERROR] %ld fleets where parity or density fired at every cell\n", full_boards);
+        return 1;
+    }
+    if (expect && total != expected)
+    {
+        printf("[ERROR] outcomes changed: expected fingerprint %016" PRIx64 "\n", expected);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,590 @@
+#include "ai.h"
+#include <string.h>
+
+_Static_assert(MAX_BOARD_ROW * AI_STRIDE <= 64 * AI_WORDS, "an AiMask holds every cell");
+_Static_assert(MAX_SHIP_NUM <= 8, "afloat has a bit per ship");
+
+//* Bit-sliced cell counters: plane p holds bit p of every cell's count. The most placements that
+//* can cover one cell is 2 orientations * size per ship, doubled in target mode, below 2^AI_PLANES
+#define AI_PLANES 8
+
+static const char *const level_names[AI_LEVEL_COUNT] = {"easy", "medium", "hard"};
+
+// =====================
+// Whole-board masks
+// =====================
+//* Small and forced inline so every loop below runs over AI_WORDS constant words
+#define AI_KERNEL static inline __attribute__((always_inline))
+
+AI_KERNEL int ai_cell(int row, int col)
+{
+    return row * AI_STRIDE + col;
+}
+
+AI_KERNEL int mask_test(const AiMask *m, int cell)
+{
+    return (int)(m->word[cell >> 6] >> (cell & 63) & 1);
+}
+
+AI_KERNEL void mask_set(AiMask *m, int cell)
+{
+    m->word[cell >> 6] |= (uint64_t)1 << (cell & 63);
+}
+
+AI_KERNEL void mask_clear(AiMask *m, int cell)
+{
+    m->word[cell >> 6] &= ~((uint64_t)1 << (cell & 63));
+}
+
+AI_KERNEL AiMask mask_and(AiMask a, AiMask b)
+{
+    for (int i = 0; i < AI_WORDS; i++)
+        a.word[i] &= b.word[i];
+    return a;
+}
+
+AI_KERNEL AiMask mask_or(AiMask a, AiMask b)
+{
+    for (int i = 0; i < AI_WORDS; i++)
+        a.word[i] |= b.word[i];
+    return a;
+}
+
+AI_KERNEL AiMask mask_andnot(AiMask a, AiMask b)
+{
+    for (int i = 0; i < AI_WORDS; i++)
+        a.word[i] &= ~b.word[i];
+    return a;
+}
+
+AI_KERNEL int mask_any(AiMask m)
+{
+    uint64_t any = 0;
+    for (int i = 0; i < AI_WORDS; i++)
+        any |= m.word[i];
+    return any != 0;
+}
+
+//* Cell c moves to c + k: one column right (k = 1) or one row down (k = AI_STRIDE)
+AI_KERNEL AiMask mask_up(AiMask m, int k)
+{
+    AiMask out;
+    int words = k >> 6, bits = k & 63;
+    for (int i = AI_WORDS - 1; i >= 0; i--)
+    {
+        int src = i - words;
+        uint64_t v = src >= 0 ? m.word[src] << bits : 0;
+        if (bits && src >= 1)
+            v |= m.word[src - 1] >> (64 - bits);
+        out.word[i] = v;
+    }
+    return out;
+}
+
+//* Cell c moves to c - k
+AI_KERNEL AiMask mask_down(AiMask m, int k)
+{
+    AiMask out;
+    int words = k >> 6, bits = k & 63;
+    for (int i = 0; i < AI_WORDS; i++)
+    {
+        int src = i + words;
+        uint64_t v = src < AI_WORDS ? m.word[src] >> bits : 0;
+        if (bits && src + 1 < AI_WORDS)
+            v |= m.word[src + 1] << (64 - bits);
+        out.word[i] = v;
+    }
+    return out;
+}
+
+//* The four neighbours of every cell of m (the spare column soaks up the ones off the row ends)
+AI_KERNEL AiMask mask_neighbours(AiMask m)
+{
+    return mask_or(mask_or(mask_up(m, 1), mask_down(m, 1)), mask_or(mask_up(m, AI_STRIDE), mask_down(m, AI_STRIDE)));
+}
+
+//* Add 1 to the counter of every cell in m, carry by carry
+AI_KERNEL void counters_add(AiMask *planes, AiMask m)
+{
+    for (int p = 0; p < AI_PLANES && mask_any(m); p++)
+    {
+        AiMask carry = mask_and(planes[p], m);
+        for (int i = 0; i < AI_WORDS; i++)
+            planes[p].word[i] ^= m.word[i];
+        m = carry;
+    }
+}
+
+//* The cells of candidates whose counter is highest, highest plane first
+AI_KERNEL AiMask counters_max(const AiMask *planes, AiMask candidates)
+{
+    for (int p = AI_PLANES - 1; p >= 0; p--)
+    {
+        AiMask top = mask_and(candidates, planes[p]);
+        if (mask_any(top))
+            candidates = top;
+    }
+    return candidates;
+}
+
+// =====================
+// Random numbers
+// =====================
+uint32_t ai_random(uint32_t *seed)
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *seed = x;
+}
+
+static int random_below(uint32_t *seed, int n)
+{
+    return (int)(((uint64_t)ai_random(seed) * (uint32_t)n) >> 32);
+}
+
+//* A cell of m picked at random, -1 if m is empty
+static int random_cell(uint32_t *seed, AiMask m)
+{
+    int count = 0;
+    for (int i = 0; i < AI_WORDS; i++)
+        count += __builtin_popcountll(m.word[i]);
+    if (count == 0)
+        return -1;
+
+    int pick = random_below(seed, count);
+    for (int i = 0; i < AI_WORDS; i++)
+    {
+        uint64_t w = m.word[i];
+        int n = __builtin_popcountll(w);
+        if (pick >= n)
+        {
+            pick -= n;
+            continue;
+        }
+        while (pick--)
+            w &= w - 1;
+        return i * 64 + __builtin_ctzll(w);
+    }
+    return -1;
+}
+
+// =====================
+// Levels
+// =====================
+const char *ai_level_name(AiLevel level)
+{
+    return (unsigned)level < AI_LEVEL_COUNT ? level_names[level] : NULL;
+}
+
+int ai_find_level(const char *name)
+{
+    if (!name)
+        return -1;
+    for (int i = 0; i < AI_LEVEL_COUNT; i++)
+    {
+        if (strcmp(level_names[i], name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int ai_init(AiPlayer *ai, GameVariant variant, AiLevel level, uint32_t seed)
+{
+    if (!ai || (unsigned)variant >= GAME_VARIANT_COUNT || (unsigned)level >= AI_LEVEL_COUNT)
+        return 0;
+
+    const GameRules *rules = &game_rules[variant];
+    memset(ai, 0, sizeof(*ai));
+    ai->variant = (unsigned char)variant;
+    ai->level = (unsigned char)level;
+    ai->afloat = (unsigned char)((1u << rules->ship_count) - 1);
+    ai->seed = seed ? seed : 2463534242u; // xorshift never leaves 0
+    for (int row = 0; row < rules->rows; row++)
+    {
+        for (int col = 0; col < rules->cols; col++)
+            mask_set(&ai->board, ai_cell(row, col));
+    }
+    return 1;
+}
+
+//* Run of open hits through cell along step (1 == row, AI_STRIDE == column): its first cell and length
+static int hit_run(const AiPlayer *ai, int cell, int step, int *first)
+{
+    int last = cell;
+    *first = cell;
+    while (*first - step >= 0 && mask_test(&ai->open_hits, *first - step))
+        *first -= step;
+    while (last + step < MAX_BOARD_ROW * AI_STRIDE && mask_test(&ai->open_hits, last + step))
+        last += step;
+    return (last - *first) / step + 1;
+}
+
+//* Open hits that surely belong to a ship afloat: those off every run of hits through a sunk cell.
+//* The others may be the sunk ship's, so they are left to the hunt instead of drawing target shots
+static AiMask live_hits(const AiPlayer *ai)
+{
+    AiMask live = ai->open_hits;
+    for (int w = 0; w < AI_WORDS; w++)
+    {
+        for (uint64_t bits = ai->sunk.word[w]; bits; bits &= bits - 1)
+        {
+            int cell = w * 64 + __builtin_ctzll(bits);
+            static const int steps[2] = {1, AI_STRIDE};
+            for (int d = 0; d < 2; d++)
+            {
+                int first;
+                int length = hit_run(ai, cell, steps[d], &first);
+                for (int k = 0; k < length; k++)
+                    mask_clear(&live, first + k * steps[d]);
+            }
+        }
+    }
+    return live;
+}
+
+// todo: ===== HARD: probability density =====
+//* Every way each ship still afloat can lie on cells that are not blocked adds 1 to the cells it
+//* covers. With target set only the placements through those hits count, twice if they take in two
+//* hits or more, so the bot finishes the ship it found along the line of its hits
+static void count_placements(const AiPlayer *ai, AiMask *planes, const AiMask *target)
+{
+    const GameRules *rules = &game_rules[ai->variant];
+    AiMask free = mask_andnot(ai->board, ai->blocked);
+    memset(planes, 0, AI_PLANES * sizeof(*planes));
+
+    for (int i = 0; i < rules->ship_count; i++)
+    {
+        if (!(ai->afloat >> i & 1))
+            continue;
+
+        int size = get_ship_size(rules->fleet[i]);
+        for (int vertical = 0; vertical < 2; vertical++)
+        {
+            int step = vertical ? AI_STRIDE : 1;
+            //* starts: bow cells of every placement in this orientation; once / twice: it takes in 1 / 2+ open hits
+            AiMask starts = free, once = {{0}}, twice = {{0}};
+            for (int k = 0; k < size; k++)
+            {
+                starts = mask_and(starts, mask_down(free, k * step));
+                if (target)
+                {
+                    AiMask hits = mask_down(*target, k * step);
+                    twice = mask_or(twice, mask_and(once, hits));
+                    once = mask_or(once, hits);
+                }
+            }
+            if (target)
+            {
+                twice = mask_and(starts, twice);
+                starts = mask_and(starts, once);
+            }
+            for (int k = 0; k < size; k++)
+            {
+                counters_add(planes, mask_up(starts, k * step));
+                if (target)
+                    counters_add(planes, mask_up(twice, k * step));
+            }
+        }
+    }
+}
+
+static int density_shot(AiPlayer *ai, AiMask open)
+{
+    AiMask planes[AI_PLANES];
+    AiMask live = live_hits(ai);
+    int target = mask_any(live);
+    count_placements(ai, planes, target ? &live : NULL);
+    if (target)
+    {
+        AiMask covered = {{0}};
+        for (int p = 0; p < AI_PLANES; p++)
+            covered = mask_or(covered, planes[p]);
+        //! No placement fits the live hits (not expected, ships are only retired for sure): hunt instead
+        if (!mask_any(mask_and(open, covered)))
+            count_placements(ai, planes, NULL);
+    }
+    return random_cell(&ai->seed, counters_max(planes, open));
+}
+
+// todo: ===== MEDIUM: parity hunt, line target =====
+//* Hunts one cell in every run of the smallest ship afloat (a checkerboard while the destroyer is
+//* afloat) and next to hits a sunk ship may not own, then fires next to live hits, first where two
+//* hits in a row point
+static int parity_shot(AiPlayer *ai, AiMask open)
+{
+    AiMask hits = live_hits(ai);
+    if (mask_any(hits))
+    {
+        AiMask across = mask_and(hits, mask_or(mask_up(hits, 1), mask_down(hits, 1)));
+        AiMask along = mask_and(hits, mask_or(mask_up(hits, AI_STRIDE), mask_down(hits, AI_STRIDE)));
+        AiMask inline_cells = mask_or(mask_or(mask_up(across, 1), mask_down(across, 1)),
+                                      mask_or(mask_up(along, AI_STRIDE), mask_down(along, AI_STRIDE)));
+        int cell = random_cell(&ai->seed, mask_and(open, inline_cells));
+        if (cell < 0)
+            cell = random_cell(&ai->seed, mask_and(open, mask_neighbours(hits)));
+        if (cell >= 0)
+            return cell;
+    }
+
+    const GameRules *rules = &game_rules[ai->variant];
+    int smallest = MAX_BOARD_COL;
+    for (int i = 0; i < rules->ship_count; i++)
+    {
+        int size = get_ship_size(rules->fleet[i]);
+        if ((ai->afloat >> i & 1) && size < smallest)
+            smallest = size;
+    }
+
+    AiMask lattice = {{0}};
+    for (int row = 0; row < rules->rows; row++)
+    {
+        for (int col = (smallest - row % smallest) % smallest; col < rules->cols; col += smallest)
+            mask_set(&lattice, ai_cell(row, col));
+    }
+    //* A ship crossing a sunk one's line may be hit off the lattice
+    lattice = mask_or(lattice, mask_neighbours(mask_andnot(ai->open_hits, hits)));
+    int cell = random_cell(&ai->seed, mask_and(open, lattice));
+    return cell >= 0 ? cell : random_cell(&ai->seed, open);
+}
+
+// todo: ===== EASY: random =====
+static int random_shot(AiPlayer *ai, AiMask open)
+{
+    int cell = -1;
+    AiMask hits = live_hits(ai);
+    if (mask_any(hits))
+        cell = random_cell(&ai->seed, mask_and(open, mask_neighbours(hits)));
+    return cell >= 0 ? cell : random_cell(&ai->seed, open);
+}
+
+int ai_next_shot(AiPlayer *ai, int *row, int *col)
+{
+    if (!ai || !row || !col)
+        return 0;
+
+    AiMask open = mask_andnot(ai->board, ai->shots);
+    int cell;
+    switch ((AiLevel)ai->level)
+    {
+    case AI_HARD:
+        cell = density_shot(ai, open);
+        break;
+    case AI_MEDIUM:
+        cell = parity_shot(ai, open);
+        break;
+    default:
+        cell = random_shot(ai, open);
+        break;
+    }
+    if (cell < 0)
+        return 0;
+
+    *row = cell / AI_STRIDE;
+    *col = cell % AI_STRIDE;
+    return 1;
+}
+
+// =====================
+// Shot results
+// =====================
+//* On the board and not fired at yet: a ship may still go through it
+static int cell_unknown(const AiPlayer *ai, int cell)
+{
+    return cell >= 0 && cell < MAX_BOARD_ROW * AI_STRIDE && mask_test(&ai->board, cell) && !mask_test(&ai->shots, cell);
+}
+
+static int cell_open_hit(const AiPlayer *ai, int cell)
+{
+    return cell >= 0 && cell < MAX_BOARD_ROW * AI_STRIDE && mask_test(&ai->open_hits, cell);
+}
+
+//* A run of open hits through a sunk cell and what each of its cells may be
+typedef struct
+{
+    int first, step, length;
+    int target;                  //* Index of the sunk cell being resolved, always in a ship of the run
+    int head_open, tail_open;    //* The cell before / after the run is unknown: a ship may run on through it
+    unsigned char sunk[MAX_BOARD_ROW > MAX_BOARD_COL ? MAX_BOARD_ROW : MAX_BOARD_COL];
+    unsigned char cross[MAX_BOARD_ROW > MAX_BOARD_COL ? MAX_BOARD_ROW : MAX_BOARD_COL]; //* May be a ship crossing the run
+} HitRun;
+
+//* What a sunk cell tells: the ships it retires and their cells. ways == 2: the readings disagree
+typedef struct
+{
+    int ways;
+    unsigned afloat;
+    AiMask cells;
+} SunkReading;
+
+/** Every way to read run cells pos..: each is a ship afloat that takes exactly one sunk cell, a hit on a
+ * ship crossing the run, or a hit on a ship running on through an open end (trailing: up to the end)
+ */
+static void read_run(const AiPlayer *ai, const HitRun *run, int pos, unsigned afloat, int placed, int trailing, AiMask cells, SunkReading *reading)
+{
+    if (reading->ways > 1)
+        return;
+    if (pos == run->length)
+    {
+        if (reading->ways == 0)
+        {
+            reading->ways = 1;
+            reading->afloat = afloat;
+            reading->cells = cells;
+        }
+        else if (reading->afloat != afloat || memcmp(&reading->cells, &cells, sizeof(cells)) != 0)
+            reading->ways = 2;
+        return;
+    }
+
+    if (pos != run->target)
+    {
+        if (run->cross[pos] || (!placed && run->head_open && !run->sunk[pos]))
+            read_run(ai, run, pos + 1, afloat, placed, trailing, cells, reading);
+        else if (run->tail_open && !run->sunk[pos])
+            read_run(ai, run, pos + 1, afloat, placed, 1, cells, reading);
+    }
+    if (trailing)
+        return;
+
+    const GameRules *rules = &game_rules[ai->variant];
+    int sizes_tried = 0;
+    for (int i = 0; i < rules->ship_count; i++)
+    {
+        int size = get_ship_size(rules->fleet[i]);
+        if (!(afloat >> i & 1) || (sizes_tried >> size & 1) || pos + size > run->length)
+            continue;
+        sizes_tried |= 1 << size; //* Ships of one size are interchangeable
+
+        int sunk_cells = 0;
+        AiMask ship = cells;
+        for (int j = pos; j < pos + size; j++)
+        {
+            sunk_cells += run->sunk[j];
+            mask_set(&ship, run->first + j * run->step);
+        }
+        if (sunk_cells == 1)
+            read_run(ai, run, pos + size, afloat & ~(1u << i), 1, 0, ship, reading);
+    }
+}
+
+//* Add the readings of the run of hits through a sunk cell along step
+static void read_sunk(const AiPlayer *ai, int cell, int step, SunkReading *reading)
+{
+    HitRun run;
+    int side = step == 1 ? AI_STRIDE : 1;
+    run.step = step;
+    run.length = hit_run(ai, cell, step, &run.first);
+    run.target = (cell - run.first) / step;
+    run.head_open = cell_unknown(ai, run.first - step);
+    run.tail_open = cell_unknown(ai, run.first + run.length * step);
+    for (int j = 0; j < run.length; j++)
+    {
+        int c = run.first + j * step;
+        int side_hit = cell_open_hit(ai, c - side) || cell_open_hit(ai, c + side);
+        run.sunk[j] = (unsigned char)mask_test(&ai->sunk, c);
+        //* A crossing ship that sank has all its cells hit, one still afloat may go through an unknown cell
+        run.cross[j] = (unsigned char)(side_hit || (!run.sunk[j] && (cell_unknown(ai, c - side) || cell_unknown(ai, c + side))));
+    }
+
+    AiMask none = {{0}};
+    read_run(ai, &run, 0, ai->afloat, 0, 0, none, reading);
+}
+
+//* Retire every sunk ship the hits pin down for sure. Until then its hits stay open and it stays afloat:
+//* counting a sunk ship costs a few shots, retiring the wrong one hides a ship until the board runs out
+static void resolve_sunk(AiPlayer *ai)
+{
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (int w = 0; w < AI_WORDS; w++)
+        {
+            for (uint64_t bits = ai->sunk.word[w]; bits; bits &= bits - 1)
+            {
+                int cell = w * 64 + __builtin_ctzll(bits);
+                SunkReading reading = {0};
+                if (!mask_test(&ai->sunk, cell))
+                    continue;
+                read_sunk(ai, cell, 1, &reading);
+                read_sunk(ai, cell, AI_STRIDE, &reading);
+                if (reading.ways != 1)
+                    continue;
+
+                //* The last ship sinking ends the game, afloat never drops to 0 while a ship is left on the board
+                if (reading.afloat)
+                    ai->afloat = (unsigned char)reading.afloat;
+                ai->open_hits = mask_andnot(ai->open_hits, reading.cells);
+                ai->sunk = mask_andnot(ai->sunk, reading.cells);
+                ai->blocked = mask_or(ai->blocked, reading.cells);
+                changed = 1;
+            }
+        }
+    }
+}
+
+void ai_record_shot(AiPlayer *ai, int row, int col, AttackResult result)
+{
+    const GameRules *rules;
+    if (!ai || (rules = &game_rules[ai->variant], row < 0 || col < 0 || row >= rules->rows || col >= rules->cols))
+        return;
+
+    int cell = ai_cell(row, col);
+    mask_set(&ai->shots, cell);
+    switch (result)
+    {
+    case ATTACK_MISS:
+        mask_set(&ai->blocked, cell);
+        break;
+    case ATTACK_HIT:
+        mask_set(&ai->open_hits, cell);
+        break;
+    case ATTACK_SUNK:
+        mask_set(&ai->open_hits, cell);
+        mask_set(&ai->sunk, cell);
+        break;
+    default:
+        return;
+    }
+    if (mask_any(ai->sunk))
+        resolve_sunk(ai); //* A miss may close the end of a run
+}
+
+// =====================
+// Random fleet
+// =====================
+int ai_random_fleet(GameVariant variant, uint32_t *seed, FleetLayout *fleet)
+{
+    if ((unsigned)variant >= GAME_VARIANT_COUNT || !seed || !fleet)
+        return 0;
+
+    const GameRules *rules = &game_rules[variant];
+    BoardState state;
+    for (int attempt = 0; attempt < 100; attempt++)
+    {
+        if (!init_variant_board(&state, variant))
+            return 0;
+
+        int placed = 0;
+        for (int i = 0; i < rules->ship_count; i++)
+        {
+            // todo: A few hundred tries per ship, then start over from an empty board
+            for (int tries = 0; tries < 256; tries++)
+            {
+                Orientation orient = (ai_random(seed) & 1) ? VERTICAL : HORIZONTAL;
+                if (place_ship(&state, rules->fleet[i], random_below(seed, rules->rows), random_below(seed, rules->cols), orient))
+                {
+                    placed++;
+                    break;
+                }
+            }
+            if (placed != i + 1)
+                break;
+        }
+        if (placed == rules->ship_count)
+            return pack_fleet(&state, fleet);
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+#ifndef AI_H
+#define AI_H
+
+#include <stdint.h>
+
+#include "game.h"
+
+//* Computer opponent. It only knows what a player knows, its own shots and their results, and
+//* picks the next shot at one of three levels. Every decision is made on whole-board bitmasks:
+//* the hard level scores each cell by how many placements of the ships still afloat cover it,
+//* adding up all placements of a ship in one orientation at once in bit-sliced counters.
+
+#define AI_STRIDE (MAX_BOARD_COL + 1) //* Bits per row in an AiMask, the spare column keeps ships from wrapping
+#define AI_WORDS ((MAX_BOARD_ROW * AI_STRIDE + 63) / 64)
+
+typedef enum
+{
+    AI_EASY,   //* Random shots, then random neighbours of a hit
+    AI_MEDIUM, //* Checkerboard shots, then along the line of the hits
+    AI_HARD,   //* Probability density: hunt the most likely cell, target the placements through the hits
+    AI_LEVEL_COUNT
+} AiLevel;
+
+//* One bit per cell, cell = row * AI_STRIDE + col
+typedef struct
+{
+    uint64_t word[AI_WORDS];
+} AiMask;
+
+//* A bot's view of the board it attacks, 168 bytes
+typedef struct
+{
+    unsigned char variant; //* GameVariant
+    unsigned char level;   //* AiLevel
+    unsigned char afloat;  //* Bit i: ship i of the variant's fleet is not known to be sunk
+    uint32_t seed;
+    AiMask board;     //* Cells of the variant's board
+    AiMask shots;     //* Cells fired at
+    AiMask open_hits; //* Hits not yet put down to a sunk ship
+    AiMask blocked;   //* Misses and the cells of sunk ships: no ship afloat covers them
+    AiMask sunk;      //* Cells reported sunk whose ship is not pinned down yet (still open hits)
+} AiPlayer;
+
+const char *ai_level_name(AiLevel level);
+
+/** Level called name ("easy", "medium", "hard"), -1 if there is none */
+int ai_find_level(const char *name);
+
+/** Start a bot that has not fired yet
+ * @return 1 == success, 0 == unknown variant or level
+ */
+int ai_init(AiPlayer *ai, GameVariant variant, AiLevel level, uint32_t seed);
+
+/** Cell to fire at next, never one fired at before
+ * @return 1 == success, 0 == every cell has been fired at
+ */
+int ai_next_shot(AiPlayer *ai, int *row, int *col);
+
+/** Learn the result of a shot (ATTACK_INVALID only marks the cell as fired at) */
+void ai_record_shot(AiPlayer *ai, int row, int col, AttackResult result);
+
+/** Place the fleet of a variant at random
+ * @return 1 == success, 0 == failed
+ */
+int ai_random_fleet(GameVariant variant, uint32_t *seed, FleetLayout *fleet);
+
+/** Next value of a xorshift generator (seed must not be 0) */
+uint32_t ai_random(uint32_t *seed);
+
+#endif
@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "server.h"
+#include "connection.h"
+
+// todo: ================= HELPER FUNCTIONS ===================
+static int growFdIndex(ConnTable *table, int socket_fd)
+{
+    int capacity = table->fd_capacity ? table->fd_capacity : 1024;
+    while (capacity <= socket_fd)
+        capacity *= 2;
+
+    Player **by_fd = realloc(table->by_fd, sizeof(Player *) * capacity);
+    if (!by_fd)
+        return 0;
+    memset(by_fd + table->fd_capacity, 0, sizeof(Player *) * (capacity - table->fd_capacity));
+    table->by_fd = by_fd;
+    table->fd_capacity = capacity;
+    return 1;
+}
+
+static int growPool(ConnTable *table)
+{
+    Player *block = calloc(PLAYER_BLOCK_SIZE, sizeof(Player));
+    Player **blocks = realloc(table->blocks, sizeof(Player *) * (table->block_count + 1));
+    if (!block || !blocks)
+    {
+        free(block);
+        if (blocks)
+            table->blocks = blocks;
+        return 0;
+    }
+    table->blocks = blocks;
+
+    //* The free list must be able to hold every pooled Player at once
+    if ((table->block_count + 1) * PLAYER_BLOCK_SIZE > table->free_capacity)
+    {
+        int capacity = (table->block_count + 1) * PLAYER_BLOCK_SIZE;
+        Player **free_list = realloc(table->free_list, sizeof(Player *) * capacity);
+        if (!free_list)
+        {
+            free(block);
+            return 0;
+        }
+        table->free_list = free_list;
+        table->free_capacity = capacity;
+    }
+
+    table->blocks[table->block_count++] = block;
+    for (int i = PLAYER_BLOCK_SIZE - 1; i >= 0; i--)
+        table->free_list[table->free_count++] = &block[i];
+    return 1;
+}
+
+// todo: ================= CONNECTION TABLE ===================
+int connTableInit(ConnTable *table)
+{
+    memset(table, 0, sizeof(ConnTable));
+    return growFdIndex(table, 0) && intMapInit(&table->by_user);
+}
+
+void connTableFree(ConnTable *table)
+{
+    for (int i = 0; i < table->block_count; i++)
+        free(table->blocks[i]);
+    free(table->blocks);
+    free(table->free_list);
+    free(table->by_fd);
+    intMapFree(&table->by_user);
+    memset(table, 0, sizeof(ConnTable));
+}
+
+Player *connTableAdd(ConnTable *table, int socket_fd)
+{
+    if (socket_fd < 0)
+        return NULL;
+    if (socket_fd >= table->fd_capacity && !growFdIndex(table, socket_fd))
+        return NULL;
+    if (table->free_count == 0 && !growPool(table))
+        return NULL;
+
+    Player *player = table->free_list[--table->free_count];
+    player->socket_fd = socket_fd;
+    table->by_fd[socket_fd] = player;
+    table->count++;
+    return player;
+}
+
+void connTableRemove(ConnTable *table, Player *player)
+{
+    connTableUnindexUser(table, player);
+    if (player->socket_fd >= 0 && player->socket_fd < table->fd_capacity && table->by_fd[player->socket_fd] == player)
+    {
+        table->by_fd[player->socket_fd] = NULL;
+        table->count--;
+    }
+
+    memset(player, 0, sizeof(Player));
+    table->free_list[table->free_count++] = player; //* free_capacity covers every pooled Player
+}
+
+Player *connTableGetByFd(ConnTable *table, int socket_fd)
+{
+    if (socket_fd < 0 || socket_fd >= table->fd_capacity)
+        return NULL;
+    return table->by_fd[socket_fd];
+}
+
+Player *connTableGetByUserId(ConnTable *table, int user_id)
+{
+    return intMapGet(&table->by_user, user_id);
+}
+
+void connTableIndexUser(ConnTable *table, Player *player)
+{
+    if (player->user_id != 0)
+        intMapPut(&table->by_user, player->user_id, player);
+}
+
+void connTableUnindexUser(ConnTable *table, Player *player)
+{
+    //* Another connection of the same user may own the entry by now
+    if (player->user_id != 0 && intMapGet(&table->by_user, player->user_id) == player)
+        intMapRemove(&table->by_user, player->user_id);
+}
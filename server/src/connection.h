@@ -0,0 +1,57 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <stddef.h>
+
+#include "intmap.h"
+
+typedef struct Player Player; //* server.h
+
+//* Connection table of one shard, only touched by the shard's thread.
+//* Players come from a pool and are never freed while the server runs, so a Player pointer
+//* held by the reactor backend stays valid after its connection is gone (conn_id tells them apart).
+
+#define PLAYER_BLOCK_SIZE 256 //* Players allocated at once when the pool runs dry
+
+typedef struct
+{
+    //* Pool
+    Player **blocks;
+    int block_count;
+    Player **free_list;
+    int free_count;
+    int free_capacity;
+    //* socket_fd -> Player, grows to the highest fd seen
+    Player **by_fd;
+    int fd_capacity;
+    int count;
+    IntMap by_user; //* user_id -> logged in Player
+} ConnTable;
+
+/** Prepare an empty table
+ * @return 1 == success, 0 == failed
+ */
+int connTableInit(ConnTable *table);
+
+/** Release every Player of the table (their connections must already be closed) */
+void connTableFree(ConnTable *table);
+
+/** Take a zeroed Player from the pool and register it under socket_fd
+ * @return the player, NULL if out of memory
+ */
+Player *connTableAdd(ConnTable *table, int socket_fd);
+
+/** Unregister a player and give it back to the pool (the Player is zeroed) */
+void connTableRemove(ConnTable *table, Player *player);
+
+Player *connTableGetByFd(ConnTable *table, int socket_fd);
+
+Player *connTableGetByUserId(ConnTable *table, int user_id);
+
+/** Index player under its user_id (call after login, replaces an older connection of the same user) */
+void connTableIndexUser(ConnTable *table, Player *player);
+
+/** Drop player from the user_id index (call before its user_id changes) */
+void connTableUnindexUser(ConnTable *table, Player *player);
+
+#endif
@@ -1,7 +1,81 @@
 #include "database.h"
+#include "user_cache.h"
+#include "leaderboard.h"
+#include "game.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <zlib.h>
+
+// === Statement cache ===
+static const char *statement_sql[DB_STMT_COUNT] = {
+    [DB_STMT_USER_CREATE] = "INSERT INTO users (username, password_hash) VALUES (?, ?);",
+    [DB_STMT_USER_GET] = "SELECT id, username, password_hash, elo, wins, losses FROM users WHERE username = ?;",
+    [DB_STMT_USER_UPDATE_ELO] = "UPDATE users SET elo = ? WHERE username = ?;",
+    [DB_STMT_USER_DELETE] = "DELETE FROM users WHERE username = ?;",
+    [DB_STMT_USER_GET_ALL] = "SELECT id, username, password_hash, elo, wins, losses FROM users;",
+    [DB_STMT_USER_GET_NAME] = "SELECT username FROM users WHERE id = ?;",
+    [DB_STMT_MATCH_CREATE] = "INSERT INTO matches (player1_id, player2_id, result) VALUES (?, ?, 'IN_PROGRESS');",
+    [DB_STMT_MATCH_INSERT] = "INSERT INTO matches (id, player1_id, player2_id, result) VALUES (?, ?, ?, 'IN_PROGRESS');",
+    [DB_STMT_MATCH_LAST_ID] = "SELECT MAX(COALESCE((SELECT MAX(id) FROM matches), 0), "
+                              "COALESCE((SELECT seq FROM sqlite_sequence WHERE name = 'matches'), 0));",
+    [DB_STMT_MATCH_GET] = "SELECT id, player1_id, player2_id, result FROM matches WHERE id = ?;",
+    [DB_STMT_MATCH_UPDATE_RESULT] =
+        "UPDATE matches SET result = ?1, ended_at = CASE WHEN ?1 = 'IN_PROGRESS' THEN NULL ELSE CAST(strftime('%s', 'now') AS INTEGER) END "
+        "WHERE id = ?2;",
+    [DB_STMT_MATCH_DELETE] = "DELETE FROM matches WHERE id = ?;",
+    [DB_STMT_MATCHES_BY_USER] = "SELECT id, player1_id, player2_id, result FROM matches WHERE player1_id = ?1 OR player2_id = ?1;",
+    //* Newest first, below the cursor: each side walks its own index backwards and stops after
+    //* ?3 rows, so a page costs the same however long the history is
+    [DB_STMT_MATCH_PAGE] =
+        "SELECT id, player1_id, player2_id, result FROM ("
+        "SELECT * FROM (SELECT id, player1_id, player2_id, result FROM matches WHERE player1_id = ?1 AND id < ?2 ORDER BY id DESC LIMIT ?3) "
+        "UNION ALL "
+        "SELECT * FROM (SELECT id, player1_id, player2_id, result FROM matches WHERE player2_id = ?1 AND id < ?2 ORDER BY id DESC LIMIT ?3)"
+        ") ORDER BY id DESC LIMIT ?3;",
+    [DB_STMT_MOVE_CREATE] = "INSERT INTO moves (match_id, player_id, x, y, result, turn_order) VALUES (?, ?, ?, ?, ?, ?);",
+    [DB_STMT_MOVES_GET] = "SELECT id, match_id, player_id, x, y, result, turn_order FROM moves WHERE match_id = ? ORDER BY turn_order ASC;",
+    [DB_STMT_MOVES_DELETE_BY_MATCH] = "DELETE FROM moves WHERE match_id = ?;",
+    //* A savepoint nests inside the writer's group commit and acts as its own transaction outside one
+    [DB_STMT_FINALIZE_BEGIN] = "SAVEPOINT finalize_match;",
+    [DB_STMT_FINALIZE_COMMIT] = "RELEASE finalize_match;",
+    [DB_STMT_FINALIZE_ROLLBACK] = "ROLLBACK TO finalize_match;",
+    [DB_STMT_USER_RECORD_WIN] = "UPDATE users SET elo = ?, wins = wins + 1 WHERE id = ?;",
+    [DB_STMT_USER_RECORD_LOSS] = "UPDATE users SET elo = ?, losses = losses + 1 WHERE id = ?;",
+    [DB_STMT_MATCH_PACK_MOVES] = "UPDATE matches SET moves_packed = ? WHERE id = ?;",
+    [DB_STMT_MATCH_GET_PACKED_MOVES] = "SELECT player1_id, player2_id, moves_packed FROM matches WHERE id = ? AND moves_packed IS NOT NULL;",
+    [DB_STMT_ARCHIVE_BEGIN] = "SAVEPOINT archive_matches;",
+    [DB_STMT_ARCHIVE_COMMIT] = "RELEASE archive_matches;",
+    [DB_STMT_ARCHIVE_ROLLBACK] = "ROLLBACK TO archive_matches;",
+    [DB_STMT_ARCHIVE_CANDIDATES] = "SELECT id FROM matches WHERE archived = 0 AND ended_at < ? ORDER BY ended_at LIMIT ?;",
+    [DB_STMT_ARCHIVE_INSERT] = "INSERT OR REPLACE INTO moves_archive (match_id, move_count, moves) VALUES (?, ?, ?);",
+    [DB_STMT_ARCHIVE_MARK] = "UPDATE matches SET archived = 1, moves_packed = NULL WHERE id = ?;",
+    [DB_STMT_ARCHIVE_GET] = "SELECT move_count, moves FROM moves_archive WHERE match_id = ?;",
+};
+
+static const char *move_results[] = {"MISS", "HIT", "SUNK"}; //* Result codes of packed moves
+static DbMoveStorage move_storage = DB_MOVES_PACKED;
+
+
+// Cached statement for id, prepared on first use if db_init could not (tables not created yet)
+// Callers bind every parameter and sqlite3_reset() it when done, so no read stays open
+static sqlite3_stmt *db_stmt(Database *database, DbStatement id)
+{
+    if (!database->stmts[id] &&
+        sqlite3_prepare_v2(database->db, statement_sql[id], -1, &database->stmts[id], NULL) != SQLITE_OK)
+    {
+        database->stmts[id] = NULL;
+        return NULL;
+    }
+    return database->stmts[id];
+}
+
+static void prepare_statements(Database *database)
+{
+    for (int i = 0; i < DB_STMT_COUNT; i++)
+        db_stmt(database, i);
+}
 
 // === Internal helper ===
 static int exec_sql(Database *database, const char *sql)
@@ -19,19 +93,123 @@ static int exec_sql(Database *database, const char *sql)
 // === Initialization ===
 int db_init(Database *database, const char *filename)
 {
+    memset(database->stmts, 0, sizeof(database->stmts));
     if (sqlite3_open(filename, &database->db) != SQLITE_OK)
     {
         fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(database->db));
         return 1;
     }
+    sqlite3_busy_timeout(database->db, 5000); //* Every reactor thread has its own connection, wait on each other's writes
+    prepare_statements(database);
     return 0;
 }
 
 void db_close(Database *database)
 {
+    for (int i = 0; i < DB_STMT_COUNT; i++)
+    {
+        sqlite3_finalize(database->stmts[i]);
+        database->stmts[i] = NULL;
+    }
     sqlite3_close(database->db);
 }
 
+int db_configure(Database *database, DbSynchronous synchronous)
+{
+    static const char *levels[] = {"OFF", "NORMAL", "FULL"};
+    char sql[64];
+
+    //* WAL: readers (logins on the reactors) never wait for the writer thread, and a commit appends
+    //* to the log instead of rewriting pages through a rollback journal
+    snprintf(sql, sizeof(sql), "PRAGMA journal_mode=WAL; PRAGMA synchronous=%s;", levels[synchronous]);
+    return exec_sql(database, sql) == SQLITE_OK ? 0 : 1;
+}
+
+void db_set_busy_timeout(Database *database, int ms)
+{
+    sqlite3_busy_timeout(database->db, ms);
+}
+
+void db_set_move_storage(DbMoveStorage storage)
+{
+    move_storage = storage;
+}
+
+// === Transactions ===
+int db_begin(Database *database)
+{
+    //* Take the write lock up front, a deferred transaction could fail to upgrade halfway through a batch
+    return exec_sql(database, "BEGIN IMMEDIATE;") == SQLITE_OK ? 0 : 1;
+}
+
+int db_commit(Database *database)
+{
+    return exec_sql(database, "COMMIT;") == SQLITE_OK ? 0 : 1;
+}
+
+int db_rollback(Database *database)
+{
+    return exec_sql(database, "ROLLBACK;") == SQLITE_OK ? 0 : 1;
+}
+
+static int column_exists(Database *database, const char *table, const char *column)
+{
+    sqlite3_stmt *stmt;
+    char sql[128];
+    int found = 0;
+
+    snprintf(sql, sizeof(sql), "PRAGMA table_info(%s);", table);
+    if (sqlite3_prepare_v2(database->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        return 0;
+    while (!found && sqlite3_step(stmt) == SQLITE_ROW)
+        found = strcmp((const char *)sqlite3_column_text(stmt, 1), column) == 0;
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+// Players are users.id, the tables are rebuilt by migrate_player_ids() when they still hold usernames
+#define MATCHES_COLUMNS                                                        \
+    "(id INTEGER PRIMARY KEY AUTOINCREMENT, "                                  \
+    "player1_id INTEGER REFERENCES users(id), "                                \
+    "player2_id INTEGER REFERENCES users(id), "                                \
+    "result TEXT CHECK(result IN ('P1_WIN','P2_WIN','DRAW','IN_PROGRESS')), " \
+    "moves_packed BLOB, "                                                      \
+    "ended_at INTEGER, "                                                       \
+    "archived INTEGER DEFAULT 0)"
+
+#define MOVES_COLUMNS                                     \
+    "(id INTEGER PRIMARY KEY AUTOINCREMENT, "             \
+    "match_id INTEGER REFERENCES matches(id), "           \
+    "player_id INTEGER REFERENCES users(id), "            \
+    "x INTEGER, "                                         \
+    "y INTEGER, "                                         \
+    "result TEXT CHECK(result IN ('HIT','MISS','SUNK')), " \
+    "turn_order INTEGER)"
+
+// Copy matches and moves into tables keyed by users.id, in one transaction (SQLite cannot change a
+// column's type in place). Players whose user was deleted become NULL.
+static int migrate_player_ids(Database *database)
+{
+    printf("Migrating matches and moves to user ids...\n");
+    int rc = exec_sql(database,
+                      "BEGIN IMMEDIATE;"
+                      "CREATE TABLE matches_by_id " MATCHES_COLUMNS ";"
+                      "INSERT INTO matches_by_id (id, player1_id, player2_id, result, moves_packed, ended_at, archived) "
+                      "SELECT m.id, (SELECT id FROM users WHERE username = m.player1), "
+                      "(SELECT id FROM users WHERE username = m.player2), m.result, m.moves_packed, m.ended_at, m.archived FROM matches m;"
+                      "CREATE TABLE moves_by_id " MOVES_COLUMNS ";"
+                      "INSERT INTO moves_by_id (id, match_id, player_id, x, y, result, turn_order) "
+                      "SELECT v.id, v.match_id, (SELECT id FROM users WHERE username = v.player), v.x, v.y, v.result, v.turn_order FROM moves v;"
+                      "DROP TABLE moves;"
+                      "DROP TABLE matches;"
+                      "ALTER TABLE matches_by_id RENAME TO matches;"
+                      "ALTER TABLE moves_by_id RENAME TO moves;"
+                      "COMMIT;");
+    if (rc != SQLITE_OK)
+        exec_sql(database, "ROLLBACK;");
+    return rc;
+}
+
 // === Create tables ===
 int db_create_tables(Database *database)
 {
@@ -45,43 +223,147 @@ int db_create_tables(Database *database)
         "losses INTEGER DEFAULT 0"
         ");"
 
-        "CREATE TABLE IF NOT EXISTS matches ("
-        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
-        "player1 TEXT, "
-        "player2 TEXT, "
-        "result TEXT CHECK(result IN ('P1_WIN','P2_WIN','DRAW','IN_PROGRESS'))"
-        ");"
+        "CREATE TABLE IF NOT EXISTS matches " MATCHES_COLUMNS ";"
+        "CREATE TABLE IF NOT EXISTS moves " MOVES_COLUMNS ";"
 
-        "CREATE TABLE IF NOT EXISTS moves ("
-        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
-        "match_id INTEGER, "
-        "player TEXT, "
-        "x INTEGER, "
-        "y INTEGER, "
-        "result TEXT CHECK(result IN ('HIT','MISS','SUNK')), "
-        "FOREIGN KEY(match_id) REFERENCES matches(id)"
+        //* Cold storage for the moves of old matches, see db_archive_matches()
+        "CREATE TABLE IF NOT EXISTS moves_archive ("
+        "match_id INTEGER PRIMARY KEY REFERENCES matches(id), "
+        "move_count INTEGER, "
+        "moves BLOB"
         ");";
 
-    return exec_sql(database, sql);
+    int rc = exec_sql(database, sql);
+
+    //* Files created before turn_order existed (their moves keep a NULL turn_order)
+    if (rc == SQLITE_OK && !column_exists(database, "moves", "turn_order"))
+        rc = exec_sql(database, "ALTER TABLE moves ADD COLUMN turn_order INTEGER;");
+
+    //* Files created before finished matches could keep their moves packed
+    if (rc == SQLITE_OK && !column_exists(database, "matches", "moves_packed"))
+        rc = exec_sql(database, "ALTER TABLE matches ADD COLUMN moves_packed BLOB;");
+
+    //* Files created before retention: matches that already ended count as the oldest
+    if (rc == SQLITE_OK && !column_exists(database, "matches", "ended_at"))
+        rc = exec_sql(database,
+                      "ALTER TABLE matches ADD COLUMN ended_at INTEGER;"
+                      "ALTER TABLE matches ADD COLUMN archived INTEGER DEFAULT 0;"
+                      "UPDATE matches SET ended_at = 0 WHERE result != 'IN_PROGRESS';");
+
+    //* Files whose matches and moves name players by username
+    if (rc == SQLITE_OK && column_exists(database, "matches", "player1"))
+        rc = migrate_player_ids(database);
+
+    //* Match history by player, moves of a match in turn order
+    if (rc == SQLITE_OK)
+        rc = exec_sql(database,
+                      "CREATE INDEX IF NOT EXISTS idx_matches_player1 ON matches(player1_id);"
+                      "CREATE INDEX IF NOT EXISTS idx_matches_player2 ON matches(player2_id);"
+                      "CREATE INDEX IF NOT EXISTS idx_moves_match_turn ON moves(match_id, turn_order);"
+                      "CREATE INDEX IF NOT EXISTS idx_matches_unarchived ON matches(ended_at) WHERE archived = 0;");
+
+    prepare_statements(database); //* The ones db_init could not prepare on a fresh file
+    return rc;
+}
+
+// === Row readers ===
+// Shared by the getters and the visitors, the statements select the columns in this order
+static void read_user(sqlite3_stmt *stmt, User *user)
+{
+    user->id = sqlite3_column_int(stmt, 0);
+    snprintf(user->username, sizeof(user->username), "%s", sqlite3_column_text(stmt, 1));
+    snprintf(user->password_hash, sizeof(user->password_hash), "%s", sqlite3_column_text(stmt, 2));
+    user->elo = sqlite3_column_int(stmt, 3);
+    user->wins = sqlite3_column_int(stmt, 4);
+    user->losses = sqlite3_column_int(stmt, 5);
+}
+
+static void read_match(sqlite3_stmt *stmt, Match *match)
+{
+    match->id = sqlite3_column_int(stmt, 0);
+    match->player1_id = sqlite3_column_int(stmt, 1);
+    match->player2_id = sqlite3_column_int(stmt, 2);
+    snprintf(match->result, sizeof(match->result), "%s", sqlite3_column_text(stmt, 3));
+}
+
+static void read_move(sqlite3_stmt *stmt, Move *move)
+{
+    move->id = sqlite3_column_int(stmt, 0);
+    move->match_id = sqlite3_column_int(stmt, 1);
+    move->player_id = sqlite3_column_int(stmt, 2);
+    move->x = sqlite3_column_int(stmt, 3);
+    move->y = sqlite3_column_int(stmt, 4);
+    snprintf(move->result, sizeof(move->result), "%s", sqlite3_column_text(stmt, 5));
+    move->turn_order = sqlite3_column_int(stmt, 6);
+}
+
+// Growing array behind the db_get_* functions that return every row
+typedef struct
+{
+    char *items;
+    size_t item_size;
+    int count;
+    int capacity;
+} Collector;
+
+static int collector_init(Collector *collector, size_t item_size)
+{
+    collector->item_size = item_size;
+    collector->count = 0;
+    collector->capacity = 8;
+    collector->items = malloc(item_size * collector->capacity);
+    return collector->items != NULL;
+}
+
+// @return 1 == kept, 0 == out of memory (stops the visit)
+static int collect(Collector *collector, const void *item)
+{
+    if (collector->count >= collector->capacity)
+    {
+        char *grown = realloc(collector->items, collector->item_size * collector->capacity * 2);
+        if (!grown)
+            return 0;
+        collector->items = grown;
+        collector->capacity *= 2;
+    }
+    memcpy(collector->items + collector->item_size * collector->count++, item, collector->item_size);
+    return 1;
+}
+
+static int collect_user(const User *user, void *context) { return collect(context, user); }
+static int collect_match(const Match *match, void *context) { return collect(context, match); }
+static int collect_move(const Move *move, void *context) { return collect(context, move); }
+
+// @return the collected array (count set), NULL if the visit failed
+static void *collected(Collector *collector, int visited, int *count)
+{
+    if (visited < 0)
+    {
+        free(collector->items);
+        return NULL;
+    }
+    *count = collector->count;
+    return collector->items;
 }
 
 // === USERS CRUD ===
 int db_create_user(Database *database, const char *username, const char *password_hash)
 {
-    sqlite3_stmt *stmt;
-    const char *sql = "INSERT INTO users (username, password_hash) VALUES (?, ?);";
-    if (sqlite3_prepare_v2(database->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_USER_CREATE);
+    if (!stmt)
         return 0; // fail
 
     sqlite3_bind_text(stmt, 1, username, -1, SQLITE_TRANSIENT);
     sqlite3_bind_text(stmt, 2, password_hash, -1, SQLITE_TRANSIENT);
 
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    sqlite3_reset(stmt);
 
     if (rc != SQLITE_DONE)
         return 0; // fail
 
+    leaderboard_set(username, LEADERBOARD_DEFAULT_ELO);
+
     // Return inserted user ID
     return (int)sqlite3_last_insert_rowid(database->db);
 }
@@ -89,102 +371,125 @@ int db_create_user(Database *database, const char *username, const char *passwor
 User db_get_user(Database *database, const char *username)
 {
     User user = {0};
-    sqlite3_stmt *stmt;
-    const char *sql = "SELECT id, username, password_hash, elo, wins, losses FROM users WHERE username = ?;";
-    if (sqlite3_prepare_v2(database->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    if (user_cache_get(username, &user))
+        return user;
+
+    unsigned int version = user_cache_version(username);
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_USER_GET);
+    if (!stmt)
         return user;
 
     sqlite3_bind_text(stmt, 1, username, -1, SQLITE_TRANSIENT);
 
     if (sqlite3_step(stmt) == SQLITE_ROW)
+        read_user(stmt, &user);
+
+    sqlite3_reset(stmt);
+    if (user.id > 0)
     {
-        user.id = sqlite3_column_int(stmt, 0);
-        snprintf(user.username, sizeof(user.username), "%s", sqlite3_column_text(stmt, 1));
-        snprintf(user.password_hash, sizeof(user.password_hash), "%s", sqlite3_column_text(stmt, 2));
-        user.elo = sqlite3_column_int(stmt, 3);
-        user.wins = sqlite3_column_int(stmt, 4);
-        user.losses = sqlite3_column_int(stmt, 5);
+        user_cache_fill(&user, version);
+        user_cache_fill_name(user.id, user.username);
     }
-
-    sqlite3_finalize(stmt);
     return user;
 }
 
 int db_update_user_elo(Database *database, const char *username, int new_elo)
 {
-    sqlite3_stmt *stmt;
-    const char *sql = "UPDATE users SET elo = ? WHERE username = ?;";
-    if (sqlite3_prepare_v2(database->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_USER_UPDATE_ELO);
+    if (!stmt)
         return 1;
 
     sqlite3_bind_int(stmt, 1, new_elo);
     sqlite3_bind_text(stmt, 2, username, -1, SQLITE_TRANSIENT);
 
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    return (rc == SQLITE_DONE) ? 0 : 1;
+    sqlite3_reset(stmt);
+    if (rc != SQLITE_DONE)
+        return 1;
+    user_cache_update(username, new_elo, 0, 0);
+    leaderboard_set(username, new_elo);
+    return 0;
 }
 
 int db_delete_user(Database *database, const char *username)
 {
-    sqlite3_stmt *stmt;
-    const char *sql = "DELETE FROM users WHERE username = ?;";
-    if (sqlite3_prepare_v2(database->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    int user_id = db_get_user(database, username).id;
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_USER_DELETE);
+    if (!stmt)
         return 1;
 
     sqlite3_bind_text(stmt, 1, username, -1, SQLITE_TRANSIENT);
 
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    sqlite3_reset(stmt);
+    user_cache_invalidate(username);
+    user_cache_forget_name(user_id);
+    if (rc == SQLITE_DONE)
+        leaderboard_remove(username);
     return (rc == SQLITE_DONE) ? 0 : 1;
 }
 
-User *db_get_all_users(Database *database, int *count)
+int db_get_username(Database *database, int user_id, char *username, int size)
 {
-    *count = 0;
-    sqlite3_stmt *stmt;
-    const char *sql = "SELECT id, username, password_hash, elo, wins, losses FROM users;";
-    if (sqlite3_prepare_v2(database->db, sql, -1, &stmt, NULL) != SQLITE_OK)
-        return NULL;
+    if (user_cache_get_name(user_id, username, size))
+        return 1;
 
-    int capacity = 8;
-    User *users = malloc(sizeof(User) * capacity);
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_USER_GET_NAME);
+    if (!stmt)
+        return 0;
 
-    while (sqlite3_step(stmt) == SQLITE_ROW)
+    sqlite3_bind_int(stmt, 1, user_id);
+    int found = sqlite3_step(stmt) == SQLITE_ROW;
+    if (found)
     {
-        if (*count >= capacity)
-        {
-            capacity *= 2;
-            users = realloc(users, sizeof(User) * capacity);
-        }
+        snprintf(username, size, "%s", sqlite3_column_text(stmt, 0));
+        user_cache_fill_name(user_id, username); //* Usernames never change, no version check needed
+    }
+    sqlite3_reset(stmt);
+    return found;
+}
 
-        User *u = &users[*count];
-        u->id = sqlite3_column_int(stmt, 0);
-        snprintf(u->username, sizeof(u->username), "%s", sqlite3_column_text(stmt, 1));
-        snprintf(u->password_hash, sizeof(u->password_hash), "%s", sqlite3_column_text(stmt, 2));
-        u->elo = sqlite3_column_int(stmt, 3);
-        u->wins = sqlite3_column_int(stmt, 4);
-        u->losses = sqlite3_column_int(stmt, 5);
-        (*count)++;
+int db_each_user(Database *database, DbUserVisitor visit, void *context)
+{
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_USER_GET_ALL);
+    if (!stmt)
+        return -1;
+
+    User user;
+    int count = 0;
+    int more = 1;
+    while (more && sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        read_user(stmt, &user);
+        count++;
+        more = visit(&user, context);
     }
 
-    sqlite3_finalize(stmt);
-    return users;
+    sqlite3_reset(stmt);
+    return count;
+}
+
+User *db_get_all_users(Database *database, int *count)
+{
+    Collector users;
+    *count = 0;
+    if (!collector_init(&users, sizeof(User)))
+        return NULL;
+    return collected(&users, db_each_user(database, collect_user, &users), count);
 }
 
 // === MATCHES CRUD ===
-int db_create_match(Database *database, const char *player1, const char *player2)
+int db_create_match(Database *database, int player1_id, int player2_id)
 {
-    sqlite3_stmt *stmt;
-    const char *sql = "INSERT INTO matches (player1, player2, result) VALUES (?, ?, 'IN_PROGRESS');";
-    if (sqlite3_prepare_v2(database->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_MATCH_CREATE);
+    if (!stmt)
         return 0;
 
-    sqlite3_bind_text(stmt, 1, player1, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, player2, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 1, player1_id);
+    sqlite3_bind_int(stmt, 2, player2_id);
 
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    sqlite3_reset(stmt);
 
     if (rc != SQLITE_DONE)
         return 0;
@@ -192,107 +497,278 @@ int db_create_match(Database *database, const char *player1, const char *player2
     return (int)sqlite3_last_insert_rowid(database->db);
 }
 
+int db_insert_match(Database *database, int match_id, int player1_id, int player2_id)
+{
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_MATCH_INSERT);
+    if (!stmt)
+        return 1;
+
+    sqlite3_bind_int(stmt, 1, match_id);
+    sqlite3_bind_int(stmt, 2, player1_id);
+    sqlite3_bind_int(stmt, 3, player2_id);
+
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    return (rc == SQLITE_DONE) ? 0 : 1;
+}
+
+int db_last_match_id(Database *database)
+{
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_MATCH_LAST_ID);
+    if (!stmt)
+        return -1;
+
+    int id = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : -1;
+    sqlite3_reset(stmt);
+    return id;
+}
+
 Match db_get_match(Database *database, int match_id)
 {
     Match match = {0};
-    sqlite3_stmt *stmt;
-    const char *sql = "SELECT id, player1, player2, result FROM matches WHERE id = ?;";
-    if (sqlite3_prepare_v2(database->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_MATCH_GET);
+    if (!stmt)
         return match;
 
     sqlite3_bind_int(stmt, 1, match_id);
 
     if (sqlite3_step(stmt) == SQLITE_ROW)
     {
-        match.id = sqlite3_column_int(stmt, 0);
-        snprintf(match.player1, sizeof(match.player1), "%s", sqlite3_column_text(stmt, 1));
-        snprintf(match.player2, sizeof(match.player2), "%s", sqlite3_column_text(stmt, 2));
-        snprintf(match.result, sizeof(match.result), "%s", sqlite3_column_text(stmt, 3));
+        read_match(stmt, &match);
     }
 
-    sqlite3_finalize(stmt);
+    sqlite3_reset(stmt);
     return match;
 }
 
-int db_update_match_result(Database *database, int match_id, const char *result)
+int db_update_match_result(Database *database, int match_id, const char *result) // Also stamps ended_at
 {
-    sqlite3_stmt *stmt;
-    const char *sql = "UPDATE matches SET result = ? WHERE id = ?;";
-    if (sqlite3_prepare_v2(database->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_MATCH_UPDATE_RESULT);
+    if (!stmt)
         return 1;
 
     sqlite3_bind_text(stmt, 1, result, -1, SQLITE_TRANSIENT);
     sqlite3_bind_int(stmt, 2, match_id);
 
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    sqlite3_reset(stmt);
     return (rc == SQLITE_DONE) ? 0 : 1;
 }
 
 int db_delete_match(Database *database, int match_id)
 {
-    sqlite3_stmt *stmt;
-    const char *sql = "DELETE FROM matches WHERE id = ?;";
-    if (sqlite3_prepare_v2(database->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_MATCH_DELETE);
+    if (!stmt)
         return 1;
 
     sqlite3_bind_int(stmt, 1, match_id);
 
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    sqlite3_reset(stmt);
     return (rc == SQLITE_DONE) ? 0 : 1;
 }
 
-Match *db_get_matches_by_user(Database *database, const char *username, int *count)
+// Run a cached statement that takes no parameters and returns no rows
+// @return 1 == success, 0 == failed
+static int step_stmt(Database *database, DbStatement id)
 {
-    *count = 0;
-    sqlite3_stmt *stmt;
-    const char *sql = "SELECT id, player1, player2, result FROM matches WHERE player1 = ? OR player2 = ?;";
-    if (sqlite3_prepare_v2(database->db, sql, -1, &stmt, NULL) != SQLITE_OK)
-        return NULL;
+    sqlite3_stmt *stmt = db_stmt(database, id);
+    if (!stmt)
+        return 0;
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    return rc == SQLITE_DONE;
+}
 
-    sqlite3_bind_text(stmt, 1, username, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, username, -1, SQLITE_TRANSIENT);
+// Set a player's new rating and count the game for them
+// @return 1 == success, 0 == failed
+static int record_player_result(Database *database, DbStatement id, int user_id, int new_elo)
+{
+    if (user_id <= 0)
+        return 1; //* A bot: no record to keep
+    sqlite3_stmt *stmt = db_stmt(database, id);
+    if (!stmt)
+        return 0;
 
-    int capacity = 8;
-    Match *matches = malloc(sizeof(Match) * capacity);
+    sqlite3_bind_int(stmt, 1, new_elo);
+    sqlite3_bind_int(stmt, 2, user_id);
 
-    while (sqlite3_step(stmt) == SQLITE_ROW)
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    return rc == SQLITE_DONE;
+}
+
+// Bring the cached user and rank of a player in line with a match ending (stored == 0: rolled back)
+static void sync_player_result(Database *database, int user_id, int elo, int won, int stored)
+{
+    char username[64];
+    if (user_id <= 0 || !db_get_username(database, user_id, username, sizeof(username)))
+        return;
+    if (stored)
     {
-        if (*count >= capacity)
+        user_cache_update(username, elo, won, !won);
+        leaderboard_set(username, elo);
+    }
+    else
+        user_cache_invalidate(username);
+}
+
+// Replace the move rows of a match by one packed blob, moves the format cannot express stay rows
+// @return 1 == success (packed or left as rows), 0 == failed
+static int pack_moves(Database *database, int match_id)
+{
+    Match match = db_get_match(database, match_id);
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_MOVES_GET);
+    if (match.id == 0 || !stmt)
+        return 0;
+
+    int capacity = 2 * BOARD_CELLS * DB_PACKED_MOVE_SIZE; //* Every cell shot by both sides
+    int size = 0;
+    unsigned char *blob = malloc(capacity);
+    int packable = blob != NULL;
+
+    sqlite3_bind_int(stmt, 1, match_id);
+    while (packable && sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        int player_id = sqlite3_column_int(stmt, 2);
+        const char *result = (const char *)sqlite3_column_text(stmt, 5);
+        int x = sqlite3_column_int(stmt, 3);
+        int y = sqlite3_column_int(stmt, 4);
+        int shooter = player_id == 0 ? -1 : player_id == match.player1_id ? 0 : player_id == match.player2_id ? 1 : -1;
+        int code = -1;
+        for (int i = 0; result && i < 3; i++)
+        {
+            if (strcmp(result, move_results[i]) == 0)
+                code = i;
+        }
+
+        if (shooter < 0 || code < 0 || x < 0 || x >= DB_PACKED_MOVE_COLS || y < 0 || y * DB_PACKED_MOVE_COLS + x > 0xff)
+            packable = 0;
+        else
         {
-            capacity *= 2;
-            matches = realloc(matches, sizeof(Match) * capacity);
+            if (size + DB_PACKED_MOVE_SIZE > capacity)
+            {
+                unsigned char *grown = realloc(blob, capacity * 2);
+                if (!grown)
+                {
+                    packable = 0;
+                    break;
+                }
+                blob = grown;
+                capacity *= 2;
+            }
+            blob[size++] = (unsigned char)(y * DB_PACKED_MOVE_COLS + x);
+            blob[size++] = (unsigned char)(shooter | code << 1);
         }
+    }
+    sqlite3_reset(stmt);
 
-        Match *m = &matches[*count];
-        m->id = sqlite3_column_int(stmt, 0);
-        snprintf(m->player1, sizeof(m->player1), "%s", sqlite3_column_text(stmt, 1));
-        snprintf(m->player2, sizeof(m->player2), "%s", sqlite3_column_text(stmt, 2));
-        snprintf(m->result, sizeof(m->result), "%s", sqlite3_column_text(stmt, 3));
-        (*count)++;
+    if (!packable || size == 0)
+    {
+        free(blob);
+        return 1;
     }
 
-    sqlite3_finalize(stmt);
-    return matches;
+    stmt = db_stmt(database, DB_STMT_MATCH_PACK_MOVES);
+    int rc = SQLITE_ERROR;
+    if (stmt)
+    {
+        sqlite3_bind_blob(stmt, 1, blob, size, SQLITE_TRANSIENT);
+        sqlite3_bind_int(stmt, 2, match_id);
+        rc = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+    }
+    free(blob);
+    return rc == SQLITE_DONE && db_delete_moves_by_match(database, match_id) == 0;
+}
+
+int db_finalize_match(Database *database, int match_id, const char *result,
+                      int winner_id, int winner_elo, int loser_id, int loser_elo)
+{
+    if (!step_stmt(database, DB_STMT_FINALIZE_BEGIN))
+        return 1;
+
+    int ok = db_update_match_result(database, match_id, result) == 0 &&
+             record_player_result(database, DB_STMT_USER_RECORD_WIN, winner_id, winner_elo) &&
+             record_player_result(database, DB_STMT_USER_RECORD_LOSS, loser_id, loser_elo) &&
+             (move_storage == DB_MOVES_ROWS || pack_moves(database, match_id));
+
+    if (!ok)
+        step_stmt(database, DB_STMT_FINALIZE_ROLLBACK); //* Nothing of the match end is kept, the savepoint is released below
+    if (!step_stmt(database, DB_STMT_FINALIZE_COMMIT))
+        ok = 0;
+
+    //* Cached users and ranks follow the database, or leave the cache when the ending was not stored
+    sync_player_result(database, winner_id, winner_elo, 1, ok);
+    sync_player_result(database, loser_id, loser_elo, 0, ok);
+    return ok ? 0 : 1;
+}
+
+int db_each_match_by_user(Database *database, int user_id, DbMatchVisitor visit, void *context)
+{
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_MATCHES_BY_USER);
+    if (!stmt)
+        return -1;
+
+    sqlite3_bind_int(stmt, 1, user_id);
+
+    Match match;
+    int count = 0;
+    int more = 1;
+    while (more && sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        read_match(stmt, &match);
+        count++;
+        more = visit(&match, context);
+    }
+
+    sqlite3_reset(stmt);
+    return count;
+}
+
+Match *db_get_matches_by_user(Database *database, int user_id, int *count)
+{
+    Collector matches;
+    *count = 0;
+    if (!collector_init(&matches, sizeof(Match)))
+        return NULL;
+    return collected(&matches, db_each_match_by_user(database, user_id, collect_match, &matches), count);
+}
+
+int db_get_match_page(Database *database, int user_id, int before_id, Match *matches, int limit)
+{
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_MATCH_PAGE);
+    if (!stmt || limit <= 0)
+        return 0;
+
+    sqlite3_bind_int(stmt, 1, user_id);
+    sqlite3_bind_int(stmt, 2, before_id > 0 ? before_id : INT_MAX);
+    sqlite3_bind_int(stmt, 3, limit);
+
+    int count = 0;
+    while (count < limit && sqlite3_step(stmt) == SQLITE_ROW)
+        read_match(stmt, &matches[count++]);
+
+    sqlite3_reset(stmt);
+    return count;
 }
 
 // === MOVES CRUD ===
-int db_create_move(Database *database, int match_id, const char *player, int x, int y, const char *result)
+int db_create_move(Database *database, int match_id, int player_id, int x, int y, const char *result, int turn_order)
 {
-    sqlite3_stmt *stmt;
-    const char *sql = "INSERT INTO moves (match_id, player, x, y, result) VALUES (?, ?, ?, ?, ?);";
-    if (sqlite3_prepare_v2(database->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_MOVE_CREATE);
+    if (!stmt)
         return 0;
 
     sqlite3_bind_int(stmt, 1, match_id);
-    sqlite3_bind_text(stmt, 2, player, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 2, player_id);
     sqlite3_bind_int(stmt, 3, x);
     sqlite3_bind_int(stmt, 4, y);
     sqlite3_bind_text(stmt, 5, result, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 6, turn_order);
 
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    sqlite3_reset(stmt);
 
     if (rc != SQLITE_DONE)
         return 0;
@@ -300,51 +776,223 @@ int db_create_move(Database *database, int match_id, const char *player, int x,
     return (int)sqlite3_last_insert_rowid(database->db);
 }
 
-Move *db_get_moves(Database *database, int match_id, int *count)
+// Visit the moves_packed row stmt is on
+static int visit_packed_moves(sqlite3_stmt *stmt, int match_id, DbMoveVisitor visit, void *context)
 {
-    *count = 0;
-    sqlite3_stmt *stmt;
-    const char *sql = "SELECT id, match_id, player, x, y, result, turn_order FROM moves WHERE match_id = ? ORDER BY turn_order ASC;";
-    if (sqlite3_prepare_v2(database->db, sql, -1, &stmt, NULL) != SQLITE_OK)
-        return NULL;
+    const unsigned char *blob = sqlite3_column_blob(stmt, 2);
+    int total = sqlite3_column_bytes(stmt, 2) / DB_PACKED_MOVE_SIZE;
+    int count = 0;
+    Move move = {.match_id = match_id}; //* id 0, packed moves have no row
 
-    sqlite3_bind_int(stmt, 1, match_id);
+    for (int i = 0; i < total; i++)
+    {
+        const unsigned char *record = blob + i * DB_PACKED_MOVE_SIZE;
+        int code = record[1] >> 1 & 3;
+        if (code > 2)
+            continue; //* Not written by pack_moves
+
+        move.player_id = sqlite3_column_int(stmt, (record[1] & 1) ? 1 : 0);
+        move.x = record[0] % DB_PACKED_MOVE_COLS;
+        move.y = record[0] / DB_PACKED_MOVE_COLS;
+        snprintf(move.result, sizeof(move.result), "%s", move_results[code]);
+        move.turn_order = i + 1;
+        count++;
+        if (!visit(&move, context))
+            break;
+    }
+    return count;
+}
 
-    int capacity = 16;
-    Move *moves = malloc(sizeof(Move) * capacity);
+// Visit the moves_archive row stmt is on, one match is decompressed at a time
+static int visit_archived_moves(sqlite3_stmt *stmt, int match_id, DbMoveVisitor visit, void *context)
+{
+    int total = sqlite3_column_int(stmt, 0);
+    uLongf size = (uLongf)(total > 0 ? total : 0) * DB_ARCHIVE_MOVE_SIZE;
+    unsigned char *records = malloc(size ? size : 1);
+    if (!records || total < 0 ||
+        uncompress(records, &size, sqlite3_column_blob(stmt, 1), sqlite3_column_bytes(stmt, 1)) != Z_OK)
+    {
+        free(records);
+        return -1;
+    }
 
-    while (sqlite3_step(stmt) == SQLITE_ROW)
+    int count = 0;
+    Move move = {.match_id = match_id}; //* id 0, archived moves have no row
+    for (int i = 0; i < (int)(size / DB_ARCHIVE_MOVE_SIZE); i++)
     {
-        if (*count >= capacity)
-        {
-            capacity *= 2;
-            moves = realloc(moves, sizeof(Move) * capacity);
-        }
+        const unsigned char *record = records + i * DB_ARCHIVE_MOVE_SIZE;
+        if (record[6] > 2)
+            continue;
+
+        move.player_id = (int)((unsigned int)record[0] | (unsigned int)record[1] << 8 | (unsigned int)record[2] << 16 | (unsigned int)record[3] << 24);
+        move.x = record[4];
+        move.y = record[5];
+        snprintf(move.result, sizeof(move.result), "%s", move_results[record[6]]);
+        move.turn_order = i + 1;
+        count++;
+        if (!visit(&move, context))
+            break;
+    }
+    free(records);
+    return count;
+}
 
-        Move *m = &moves[*count];
-        m->id = sqlite3_column_int(stmt, 0);
-        m->match_id = sqlite3_column_int(stmt, 1);
-        snprintf(m->player, sizeof(m->player), "%s", sqlite3_column_text(stmt, 2));
-        m->x = sqlite3_column_int(stmt, 3);
-        m->y = sqlite3_column_int(stmt, 4);
-        snprintf(m->result, sizeof(m->result), "%s", sqlite3_column_text(stmt, 5));
-        m->turn_order = sqlite3_column_int(stmt, 6);
-        (*count)++;
+int db_each_move(Database *database, int match_id, DbMoveVisitor visit, void *context)
+{
+    int count = -1;
+    sqlite3_stmt *packed = db_stmt(database, DB_STMT_MATCH_GET_PACKED_MOVES);
+    if (packed)
+    {
+        sqlite3_bind_int(packed, 1, match_id);
+        if (sqlite3_step(packed) == SQLITE_ROW)
+            count = visit_packed_moves(packed, match_id, visit, context);
+        sqlite3_reset(packed);
+        if (count >= 0)
+            return count;
     }
 
-    sqlite3_finalize(stmt);
-    return moves;
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_MOVES_GET);
+    if (!stmt)
+        return -1;
+
+    sqlite3_bind_int(stmt, 1, match_id);
+
+    Move move;
+    int more = 1;
+    count = 0;
+    while (more && sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        read_move(stmt, &move);
+        count++;
+        more = visit(&move, context);
+    }
+    sqlite3_reset(stmt);
+
+    //* No hot moves: the match may have been archived
+    sqlite3_stmt *archived = count == 0 ? db_stmt(database, DB_STMT_ARCHIVE_GET) : NULL;
+    if (archived)
+    {
+        sqlite3_bind_int(archived, 1, match_id);
+        if (sqlite3_step(archived) == SQLITE_ROW)
+            count = visit_archived_moves(archived, match_id, visit, context);
+        sqlite3_reset(archived);
+    }
+    return count;
+}
+
+Move *db_get_moves(Database *database, int match_id, int *count)
+{
+    Collector moves;
+    *count = 0;
+    if (!collector_init(&moves, sizeof(Move)))
+        return NULL;
+    return collected(&moves, db_each_move(database, match_id, collect_move, &moves), count);
 }
 
 int db_delete_moves_by_match(Database *database, int match_id)
 {
-    sqlite3_stmt *stmt;
-    const char *sql = "DELETE FROM moves WHERE match_id = ?;";
-    if (sqlite3_prepare_v2(database->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_MOVES_DELETE_BY_MATCH);
+    if (!stmt)
         return 1;
 
     sqlite3_bind_int(stmt, 1, match_id);
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    sqlite3_reset(stmt);
     return (rc == SQLITE_DONE) ? 0 : 1;
 }
+
+// === RETENTION ===
+// Append one DB_ARCHIVE_MOVE_SIZE record per visited move
+static int encode_archive_move(const Move *move, void *context)
+{
+    unsigned char record[DB_ARCHIVE_MOVE_SIZE];
+    unsigned int player_id = (unsigned int)move->player_id;
+    record[0] = player_id & 0xff;
+    record[1] = player_id >> 8 & 0xff;
+    record[2] = player_id >> 16 & 0xff;
+    record[3] = player_id >> 24 & 0xff;
+    record[4] = (unsigned char)move->x;
+    record[5] = (unsigned char)move->y;
+    record[6] = 3; //* Unknown result, skipped when read back
+    for (int r = 0; r < 3; r++)
+    {
+        if (strcmp(move->result, move_results[r]) == 0)
+            record[6] = (unsigned char)r;
+    }
+    return collect(context, record);
+}
+
+static int archive_match(Database *database, int match_id)
+{
+    Collector records;
+    if (!collector_init(&records, DB_ARCHIVE_MOVE_SIZE))
+        return 0;
+    int ok = db_each_move(database, match_id, encode_archive_move, &records) == records.count;
+
+    int count = records.count;
+    uLong size = (uLong)count * DB_ARCHIVE_MOVE_SIZE;
+    uLongf compressed_size = compressBound(size);
+    unsigned char *compressed = malloc(compressed_size);
+    ok = ok && compressed;
+
+    ok = ok && compress2(compressed, &compressed_size, (unsigned char *)records.items, size, Z_BEST_COMPRESSION) == Z_OK;
+    free(records.items);
+
+    sqlite3_stmt *stmt = ok && count > 0 ? db_stmt(database, DB_STMT_ARCHIVE_INSERT) : NULL;
+    if (stmt) //* A match without moves only gets marked
+    {
+        sqlite3_bind_int(stmt, 1, match_id);
+        sqlite3_bind_int(stmt, 2, count);
+        sqlite3_bind_blob(stmt, 3, compressed, (int)compressed_size, SQLITE_TRANSIENT);
+        ok = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_reset(stmt);
+    }
+    else if (count > 0)
+        ok = 0;
+    free(compressed);
+
+    stmt = ok ? db_stmt(database, DB_STMT_ARCHIVE_MARK) : NULL;
+    if (stmt)
+    {
+        sqlite3_bind_int(stmt, 1, match_id);
+        ok = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_reset(stmt);
+    }
+    return ok && stmt && db_delete_moves_by_match(database, match_id) == 0;
+}
+
+int db_archive_matches(Database *database, long ended_before, int max_matches)
+{
+    sqlite3_stmt *stmt = db_stmt(database, DB_STMT_ARCHIVE_CANDIDATES);
+    int *ids = max_matches > 0 ? malloc(sizeof(int) * max_matches) : NULL;
+    if (!stmt || !ids)
+    {
+        free(ids);
+        return max_matches > 0 ? -1 : 0;
+    }
+
+    //* Collected first, the candidates query must not run while its rows change
+    int count = 0;
+    sqlite3_bind_int64(stmt, 1, ended_before);
+    sqlite3_bind_int(stmt, 2, max_matches);
+    while (count < max_matches && sqlite3_step(stmt) == SQLITE_ROW)
+        ids[count++] = sqlite3_column_int(stmt, 0);
+    sqlite3_reset(stmt);
+
+    if (count == 0 || !step_stmt(database, DB_STMT_ARCHIVE_BEGIN))
+    {
+        free(ids);
+        return count == 0 ? 0 : -1;
+    }
+
+    int ok = 1;
+    for (int i = 0; ok && i < count; i++)
+        ok = archive_match(database, ids[i]);
+    free(ids);
+
+    if (!ok)
+        step_stmt(database, DB_STMT_ARCHIVE_ROLLBACK);
+    if (!step_stmt(database, DB_STMT_ARCHIVE_COMMIT))
+        ok = 0;
+    return ok ? count : -1;
+}
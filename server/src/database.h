@@ -4,9 +4,73 @@
 #include <sqlite3.h>
 
 //* ================== DATABASE STRUCT ==================
+//* One prepared statement per query, prepared by db_init() and reused (reset and rebound) on every call
+typedef enum
+{
+    DB_STMT_USER_CREATE,
+    DB_STMT_USER_GET,
+    DB_STMT_USER_UPDATE_ELO,
+    DB_STMT_USER_DELETE,
+    DB_STMT_USER_GET_ALL,
+    DB_STMT_USER_GET_NAME,
+    DB_STMT_MATCH_CREATE,
+    DB_STMT_MATCH_INSERT,
+    DB_STMT_MATCH_LAST_ID,
+    DB_STMT_MATCH_GET,
+    DB_STMT_MATCH_UPDATE_RESULT,
+    DB_STMT_MATCH_DELETE,
+    DB_STMT_MATCHES_BY_USER,
+    DB_STMT_MATCH_PAGE,
+    DB_STMT_MOVE_CREATE,
+    DB_STMT_MOVES_GET,
+    DB_STMT_MOVES_DELETE_BY_MATCH,
+    DB_STMT_FINALIZE_BEGIN,
+    DB_STMT_FINALIZE_COMMIT,
+    DB_STMT_FINALIZE_ROLLBACK,
+    DB_STMT_USER_RECORD_WIN,
+    DB_STMT_USER_RECORD_LOSS,
+    DB_STMT_MATCH_PACK_MOVES,
+    DB_STMT_MATCH_GET_PACKED_MOVES,
+    DB_STMT_ARCHIVE_BEGIN,
+    DB_STMT_ARCHIVE_COMMIT,
+    DB_STMT_ARCHIVE_ROLLBACK,
+    DB_STMT_ARCHIVE_CANDIDATES,
+    DB_STMT_ARCHIVE_INSERT,
+    DB_STMT_ARCHIVE_MARK,
+    DB_STMT_ARCHIVE_GET,
+    DB_STMT_COUNT
+} DbStatement;
+
+//* How hard a commit waits for the disk (PRAGMA synchronous, the journal is always WAL)
+typedef enum
+{
+    DB_SYNC_OFF,    //* No fsync: a crash of the OS or power loss may lose or corrupt recent commits
+    DB_SYNC_NORMAL, //* fsync at checkpoints: survives a server crash, power loss may lose the last commits
+    DB_SYNC_FULL    //* fsync every commit
+} DbSynchronous;
+
+//* Where the moves of a finished match are kept. Moves of a match in progress are always rows.
+typedef enum
+{
+    DB_MOVES_ROWS,  //* One moves row per shot
+    DB_MOVES_PACKED //* Packed into matches.moves_packed by db_finalize_match(), the rows are deleted
+} DbMoveStorage;
+
+//* matches.moves_packed: one DB_PACKED_MOVE_SIZE record per shot, in turn order
+//*   byte 0: cell index, y * DB_PACKED_MOVE_COLS + x
+//*   byte 1: bit 0 shooter (0 == player1_id, 1 == player2_id), bits 1-2 result (0 MISS, 1 HIT, 2 SUNK)
+//* The classic 10 x 10 layout whatever the variant, a match with a move outside it keeps its rows
+#define DB_PACKED_MOVE_SIZE 2
+#define DB_PACKED_MOVE_COLS 10
+
+//* moves_archive.moves: zlib-compressed, one DB_ARCHIVE_MOVE_SIZE record per shot, in turn order
+//*   bytes 0-3: player_id (little endian), byte 4: x, byte 5: y, byte 6: result (0 MISS, 1 HIT, 2 SUNK)
+#define DB_ARCHIVE_MOVE_SIZE 7
+
 typedef struct
 {
     sqlite3 *db;
+    sqlite3_stmt *stmts[DB_STMT_COUNT]; //* NULL until prepared
 } Database;
 
 //* ================== TYPES ==================
@@ -20,11 +84,16 @@ typedef struct
     int losses;
 } User;
 
+//* Bot accounts (-b) are named DB_BOT_PREFIX + level and carry a password hash no SHA-256 hex digest
+//* matches. Nobody can register the prefix, and bots keep no wins, losses or leaderboard rank.
+#define DB_BOT_PREFIX "bot_"
+#define DB_BOT_PASSWORD_HASH "!"
+
 typedef struct
 {
     int id;
-    char player1[64];
-    char player2[64];
+    int player1_id; //* users.id, usernames are resolved with db_get_username() when a response needs them
+    int player2_id;
     char result[16]; //* 'P1_WIN','P2_WIN','DRAW','IN_PROGRESS'
 } Match;
 
@@ -32,17 +101,31 @@ typedef struct
 {
     int id;
     int match_id;
-    char player[64];
+    int player_id; //* users.id of the shooter
     int x;
     int y;
     char result[8]; //* "HIT", "MISS", "SUNK"
     int turn_order;
 } Move;
 
+//* Called once per row, in the order the matching db_get_* returns them. The row is only valid
+//* during the call. Return 1 to continue, 0 to stop.
+typedef int (*DbUserVisitor)(const User *user, void *context);
+typedef int (*DbMatchVisitor)(const Match *match, void *context);
+typedef int (*DbMoveVisitor)(const Move *move, void *context);
+
 //* ================== INITIALIZATION ==================
 int db_init(Database *database, const char *filename);
 void db_close(Database *database);
 int db_create_tables(Database *database);
+int db_configure(Database *database, DbSynchronous synchronous); // WAL journal + synchronous level of this connection
+void db_set_busy_timeout(Database *database, int ms); // How long a write on this connection waits for another one's lock (db_init: 5000)
+void db_set_move_storage(DbMoveStorage storage); // Process-wide, for matches finalized from now on (default DB_MOVES_PACKED)
+
+//* ================== TRANSACTIONS ==================
+int db_begin(Database *database); // BEGIN IMMEDIATE, 0 == success
+int db_commit(Database *database);
+int db_rollback(Database *database);
 
 //* ================== USERS ==================
 int db_create_user(Database *database, const char *username, const char *password_hash);
@@ -50,17 +133,39 @@ User db_get_user(Database *database, const char *username); // Return full User
 int db_update_user_elo(Database *database, const char *username, int new_elo);
 int db_delete_user(Database *database, const char *username);
 User *db_get_all_users(Database *database, int *count); // Return array of users
+int db_get_username(Database *database, int user_id, char *username, int size); // 1 == found, read through the user cache
 
 //* ================== MATCHES ==================
-int db_create_match(Database *database, const char *player1, const char *player2);
+int db_create_match(Database *database, int player1_id, int player2_id);
+int db_insert_match(Database *database, int match_id, int player1_id, int player2_id); // Match whose id was handed out in memory, 0 == success
+int db_last_match_id(Database *database); // Highest match id ever given out (AUTOINCREMENT counter included), -1 == failed
 Match db_get_match(Database *database, int match_id); // Return full Match struct
 int db_update_match_result(Database *database, int match_id, const char *result);
 int db_delete_match(Database *database, int match_id);
-Match *db_get_matches_by_user(Database *database, const char *username, int *count); // Return array
+int db_finalize_match(Database *database, int match_id, const char *result,
+                      int winner_id, int winner_elo, int loser_id, int loser_elo); // Result + both ratings + wins/losses (users.id, 0 == a bot), all or nothing
+Match *db_get_matches_by_user(Database *database, int user_id, int *count); // Return array
+int db_get_match_page(Database *database, int user_id, int before_id, Match *matches, int limit); // Newest first with id < before_id (0 == from the newest), fills up to limit, returns the count
 
 //* ================== MOVES ==================
-int db_create_move(Database *database, int match_id, const char *player, int x, int y, const char *result);
-Move *db_get_moves(Database *database, int match_id, int *count); // Return array of moves
+int db_create_move(Database *database, int match_id, int player_id, int x, int y, const char *result, int turn_order);
+Move *db_get_moves(Database *database, int match_id, int *count); // Return array of moves in turn order, packed and archived ones decoded (with id 0)
 int db_delete_moves_by_match(Database *database, int match_id);
 
+//* ================== STREAMING ==================
+/** Visit rows straight from the statement, in constant memory, instead of building an array.
+ * The visitor must not use the same Database, its statement is still running.
+ * @return rows visited (including the one that stopped), -1 == failed
+ */
+int db_each_user(Database *database, DbUserVisitor visit, void *context);
+int db_each_match_by_user(Database *database, int user_id, DbMatchVisitor visit, void *context);
+int db_each_move(Database *database, int match_id, DbMoveVisitor visit, void *context); // Packed and archived moves decoded (with id 0)
+
+//* ================== RETENTION ==================
+/** Move the moves of up to max_matches matches that ended before ended_before (unix seconds) into
+ * moves_archive, compressed, and delete their rows / packed blob. All or nothing.
+ * @return matches archived, -1 == failed
+ */
+int db_archive_matches(Database *database, long ended_before, int max_matches);
+
 #endif
@@ -0,0 +1,522 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "db_writer.h"
+#include "database.h"
+#include "user_cache.h"
+#include "leaderboard.h"
+#include "server.h"
+
+_Static_assert((DB_QUEUE_CAPACITY & (DB_QUEUE_CAPACITY - 1)) == 0, "queue capacity must be a power of two");
+
+// todo: =============== TYPES DEFINITIONS =================
+typedef struct
+{
+    unsigned long sequence; //* == position: free for that producer, == position + 1: holds an op
+    DbOp op;
+} DbCell;
+
+// todo: ================ WRITER STATE =====================
+//* Bounded MPSC ring (per-cell sequence numbers): producers claim a position with a CAS on
+//* enqueue_pos, the writer is the only consumer and owns dequeue_pos
+static DbCell *cells;
+static unsigned long enqueue_pos __attribute__((aligned(64)));
+static unsigned long dequeue_pos __attribute__((aligned(64))); //* Read by other threads for the depth
+
+static int user_pending[DB_USER_STRIPES]; //* Queued or uncommitted writes per user stripe (atomic)
+static int last_match_id; //* Last id handed out by dbReserveMatchId() (atomic)
+
+static Database writer_db;
+static DbDurability config;
+static DbRetention retention;
+static DbOp *batch; //* Group being committed, config.max_batch operations
+static int *batch_ok;
+static pthread_t writer_tid;
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond; //* CLOCK_MONOTONIC, set up by dbWriterInit()
+static int writer_sleeping; //* Producers signal wake_cond only when set (atomic)
+static int writer_stop;
+
+static DbWriterStats stats; //* Written with atomics, producers update submitted and stalls
+
+// todo: ================= HELPER FUNCTIONS ===================
+static long nowUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+static unsigned int userStripe(int user_id)
+{
+    return (unsigned int)user_id & (DB_USER_STRIPES - 1); //* Ids are handed out in sequence, so they spread evenly
+}
+
+static void statMax(long *max, long value)
+{
+    long seen = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while (value > seen && !__atomic_compare_exchange_n(max, &seen, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// todo: ================= QUEUE =============================
+// Claim a cell and publish op into it
+// @return 1 == queued, 0 == queue full
+static int tryPush(const DbOp *op)
+{
+    unsigned long pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    DbCell *cell;
+
+    while (1)
+    {
+        cell = &cells[pos & (DB_QUEUE_CAPACITY - 1)];
+        unsigned long sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long)(sequence - pos);
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+            return 0; //* The writer has not freed this cell yet
+        else
+            pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    }
+
+    cell->op = *op;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Writer only
+// @return 1 == op filled in, 0 == queue empty
+static int tryPop(DbOp *op)
+{
+    DbCell *cell = &cells[dequeue_pos & (DB_QUEUE_CAPACITY - 1)];
+    if (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) != dequeue_pos + 1)
+        return 0;
+
+    *op = cell->op;
+    __atomic_store_n(&cell->sequence, dequeue_pos + DB_QUEUE_CAPACITY, __ATOMIC_RELEASE);
+    __atomic_store_n(&dequeue_pos, dequeue_pos + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static int queueEmpty(void)
+{
+    DbCell *cell = &cells[dequeue_pos & (DB_QUEUE_CAPACITY - 1)];
+    return __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) != dequeue_pos + 1;
+}
+
+static int queueDepth(void)
+{
+    unsigned long tail = __atomic_load_n(&dequeue_pos, __ATOMIC_ACQUIRE);
+    unsigned long head = __atomic_load_n(&enqueue_pos, __ATOMIC_ACQUIRE);
+    return head > tail ? (int)(head - tail) : 0;
+}
+
+static void wakeWriter(void)
+{
+    //* Pairs with the fence in waitForOps(): either the writer sees the op or we see it sleeping
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&writer_sleeping, __ATOMIC_RELAXED))
+    {
+        pthread_mutex_lock(&wake_lock);
+        pthread_cond_signal(&wake_cond);
+        pthread_mutex_unlock(&wake_lock);
+    }
+}
+
+// Count (delta 1) or uncount (-1) the users whose rows op writes
+static void markUsers(const DbOp *op, int delta)
+{
+    if (op->type != DB_OP_FINALIZE_MATCH)
+        return;
+    if (op->player_id > 0)
+        __atomic_add_fetch(&user_pending[userStripe(op->player_id)], delta, __ATOMIC_SEQ_CST);
+    if (op->loser_id > 0)
+        __atomic_add_fetch(&user_pending[userStripe(op->loser_id)], delta, __ATOMIC_SEQ_CST);
+}
+
+static void submit(DbOp *op)
+{
+    op->queued_us = nowUs();
+    markUsers(op, 1);
+
+    if (!tryPush(op))
+    {
+        //* Backpressure: the disk is DB_QUEUE_CAPACITY operations behind, hold this reactor until it catches up
+        __atomic_add_fetch(&stats.stalls, 1, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&stats.stalls, __ATOMIC_RELAXED) == 1)
+            printf("[WARNING] Database write queue is full, reactors wait for the writer\n");
+
+        struct timespec pause = {0, 100000};
+        do
+        {
+            wakeWriter();
+            nanosleep(&pause, NULL);
+        } while (!tryPush(op));
+    }
+
+    __atomic_add_fetch(&stats.submitted, 1, __ATOMIC_RELAXED);
+    int depth = queueDepth();
+    int seen = __atomic_load_n(&stats.max_depth, __ATOMIC_RELAXED);
+    while (depth > seen && !__atomic_compare_exchange_n(&stats.max_depth, &seen, depth, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    wakeWriter();
+}
+
+// todo: ================= WRITER THREAD =====================
+// Apply one operation inside the open transaction
+// @return 1 == success, 0 == failed
+static int applyOp(const DbOp *op)
+{
+    switch (op->type)
+    {
+    case DB_OP_CREATE_MATCH:
+        return db_insert_match(&writer_db, op->match_id, op->player_id, op->player2_id) == 0;
+    case DB_OP_DELETE_MATCH:
+        return db_delete_match(&writer_db, op->match_id) == 0;
+    case DB_OP_MOVE:
+        return db_create_move(&writer_db, op->match_id, op->player_id, op->x, op->y, op->result, op->turn_order) > 0;
+    case DB_OP_FINALIZE_MATCH:
+        return db_finalize_match(&writer_db, op->match_id, op->result, op->player_id, op->elo, op->loser_id, op->loser_elo) == 0;
+    }
+    return 0;
+}
+
+static void logFailure(const DbOp *op)
+{
+    switch (op->type)
+    {
+    case DB_OP_CREATE_MATCH:
+        printf("[ERROR] Failed to create match %d in database (users %d, %d)\n", op->match_id, op->player_id, op->player2_id);
+        break;
+    case DB_OP_DELETE_MATCH:
+        printf("[ERROR] Failed to delete cancelled match %d\n", op->match_id);
+        break;
+    case DB_OP_MOVE:
+        printf("[ERROR] Failed insert move into database: match %d, user %d (%d, %d)\n", op->match_id, op->player_id, op->x, op->y);
+        break;
+    case DB_OP_FINALIZE_MATCH:
+        printf("[ERROR] Failed to finalize match %d (%s, user %d %d, user %d %d)\n", op->match_id, op->result, op->player_id, op->elo, op->loser_id, op->loser_elo);
+        break;
+    }
+}
+
+// Sleep until an operation is queued, the deadline passes (-1 == no deadline) or the writer is asked to stop
+// @return 1 == an operation is queued, 0 == timed out or stopping with an empty queue
+static int waitForOps(long deadline_us)
+{
+    int ready;
+    pthread_mutex_lock(&wake_lock);
+    while (1)
+    {
+        __atomic_store_n(&writer_sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if ((ready = !queueEmpty()) || writer_stop)
+            break;
+        if (deadline_us < 0)
+        {
+            pthread_cond_wait(&wake_cond, &wake_lock);
+            continue;
+        }
+        if (nowUs() >= deadline_us)
+            break;
+
+        struct timespec ts;
+        ts.tv_sec = deadline_us / 1000000;
+        ts.tv_nsec = (deadline_us % 1000000) * 1000L;
+        pthread_cond_timedwait(&wake_cond, &wake_lock, &ts);
+    }
+    __atomic_store_n(&writer_sleeping, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&wake_lock);
+    return ready;
+}
+
+// Drop the cached user and put its rank back at the rating the database kept
+static void resyncUser(int user_id)
+{
+    char username[64];
+    if (!db_get_username(&writer_db, user_id, username, sizeof(username)))
+        return;
+    user_cache_invalidate(username);
+    User user = db_get_user(&writer_db, username);
+    if (user.id > 0)
+        leaderboard_set(username, user.elo);
+}
+
+// Archive one batch of old matches in its own transaction, between group commits
+// @return 1 if a full batch was archived (more may be waiting), 0 otherwise
+static int archiveOldMatches(void)
+{
+    long started = nowUs();
+    int archived = -1;
+    if (db_begin(&writer_db) == 0)
+    {
+        archived = db_archive_matches(&writer_db, (long)time(NULL) - retention.max_age_s, retention.batch);
+        if (archived < 0 || db_commit(&writer_db) != 0)
+        {
+            db_rollback(&writer_db);
+            archived = -1;
+        }
+    }
+
+    if (archived < 0)
+        printf("[ERROR] Failed to archive old matches\n");
+    else if (archived > 0)
+    {
+        __atomic_add_fetch(&stats.archived, archived, __ATOMIC_RELAXED);
+        statMax(&stats.archive_us_max, nowUs() - started);
+    }
+    return archived == retention.batch;
+}
+
+// Tell the reactors whose requests wait on committed writes
+static void notifyShards(void)
+{
+    uint64_t one = 1;
+    for (int i = 0; i < shard_count; i++)
+    {
+        if (__atomic_load_n(&shards[i].db_notify, __ATOMIC_SEQ_CST) &&
+            write(shards[i].wake_fd, &one, sizeof(one)) < 0)
+            perror("write eventfd");
+    }
+}
+
+static void *writer_thread(void *arg)
+{
+    (void)arg;
+    int *ok = batch_ok;
+    long next_archive = nowUs();
+
+    while (1)
+    {
+        //* A full archive batch means more is waiting: go again right after the queued writes
+        if (retention.max_age_s > 0 && nowUs() >= next_archive && !__atomic_load_n(&writer_stop, __ATOMIC_RELAXED))
+            next_archive = archiveOldMatches() ? nowUs() : nowUs() + DB_ARCHIVE_INTERVAL_MS * 1000L;
+        if (!waitForOps(retention.max_age_s > 0 ? next_archive : -1))
+        {
+            if (__atomic_load_n(&writer_stop, __ATOMIC_RELAXED))
+                break;
+            continue;
+        }
+
+        //* Group commit: the first write opens a window, everything arriving before it closes (or
+        //* until the group is full) shares one transaction and one fsync
+        long deadline = nowUs() + config.window_ms * 1000L;
+        int count = 0;
+        while (count < config.max_batch)
+        {
+            if (tryPop(&batch[count]))
+                count++;
+            else if (config.window_ms == 0 || __atomic_load_n(&writer_stop, __ATOMIC_RELAXED) || !waitForOps(deadline))
+                break;
+        }
+
+        long started = nowUs();
+        int committed = db_begin(&writer_db) == 0;
+        for (int i = 0; i < count; i++)
+            ok[i] = committed && applyOp(&batch[i]);
+        if (committed && db_commit(&writer_db) != 0)
+        {
+            db_rollback(&writer_db);
+            committed = 0;
+        }
+        long done = nowUs();
+
+        int user_writes = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (!committed || !ok[i])
+            {
+                logFailure(&batch[i]);
+                __atomic_add_fetch(&stats.failed, 1, __ATOMIC_RELAXED);
+                if (batch[i].type == DB_OP_FINALIZE_MATCH)
+                {
+                    //* Written through before the transaction was rolled back
+                    resyncUser(batch[i].player_id);
+                    resyncUser(batch[i].loser_id);
+                }
+            }
+            else
+                __atomic_add_fetch(&stats.committed, 1, __ATOMIC_RELAXED);
+
+            if (batch[i].type == DB_OP_FINALIZE_MATCH)
+            {
+                markUsers(&batch[i], -1);
+                user_writes = 1;
+            }
+            statMax(&stats.lag_us_max, done - batch[i].queued_us);
+        }
+
+        __atomic_add_fetch(&stats.batches, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats.commit_us_total, done - started, __ATOMIC_RELAXED);
+        statMax(&stats.commit_us_max, done - started);
+        if (count > __atomic_load_n(&stats.max_batch, __ATOMIC_RELAXED))
+            __atomic_store_n(&stats.max_batch, count, __ATOMIC_RELAXED);
+
+        if (user_writes)
+            notifyShards();
+    }
+    return NULL;
+}
+
+// todo: ================= WRITER API ========================
+int dbWriterInit(const char *filename, const DbDurability *durability, const DbRetention *db_retention)
+{
+    pthread_condattr_t attr;
+    config = *durability;
+    retention = *db_retention;
+
+    //* The commit window must not jump with the wall clock
+    if (pthread_condattr_init(&attr) != 0 ||
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) != 0 ||
+        pthread_cond_init(&wake_cond, &attr) != 0)
+        return 0;
+    pthread_condattr_destroy(&attr);
+
+    cells = malloc(sizeof(DbCell) * DB_QUEUE_CAPACITY);
+    batch = malloc(sizeof(DbOp) * config.max_batch);
+    batch_ok = malloc(sizeof(int) * config.max_batch);
+    if (!cells || !batch || !batch_ok)
+        return 0;
+    for (unsigned long i = 0; i < DB_QUEUE_CAPACITY; i++)
+        cells[i].sequence = i;
+    enqueue_pos = dequeue_pos = 0;
+
+    if (db_init(&writer_db, filename) != 0 || db_configure(&writer_db, config.synchronous) != 0)
+        return 0;
+    last_match_id = db_last_match_id(&writer_db);
+    if (last_match_id < 0)
+    {
+        db_close(&writer_db);
+        return 0;
+    }
+
+    if (pthread_create(&writer_tid, NULL, writer_thread, NULL) != 0)
+    {
+        db_close(&writer_db);
+        return 0;
+    }
+    return 1;
+}
+
+void dbWriterShutdown(void)
+{
+    pthread_mutex_lock(&wake_lock);
+    writer_stop = 1;
+    pthread_cond_signal(&wake_cond);
+    pthread_mutex_unlock(&wake_lock);
+
+    pthread_join(writer_tid, NULL);
+    db_close(&writer_db);
+    free(cells);
+    free(batch);
+    free(batch_ok);
+    cells = NULL;
+    batch = NULL;
+    batch_ok = NULL;
+}
+
+int parseDurability(const char *spec, DbDurability *durability)
+{
+    DbDurability parsed = *durability;
+    char level[16] = "";
+    int n = 0, m = 0, k = 0;
+
+    int fields = sscanf(spec, "%15[a-z]%n,%d%n,%d%n", level, &n, &parsed.window_ms, &m, &parsed.max_batch, &k);
+    if (!((fields == 1 && spec[n] == '\0') || (fields == 2 && spec[m] == '\0') || (fields == 3 && spec[k] == '\0')))
+        return 0;
+
+    if (strcmp(level, "off") == 0)
+        parsed.synchronous = DB_SYNC_OFF;
+    else if (strcmp(level, "normal") == 0)
+        parsed.synchronous = DB_SYNC_NORMAL;
+    else if (strcmp(level, "full") == 0)
+        parsed.synchronous = DB_SYNC_FULL;
+    else
+        return 0;
+
+    if (parsed.window_ms < 0 || parsed.window_ms > 1000 || parsed.max_batch < 1 || parsed.max_batch > DB_BATCH_MAX)
+        return 0;
+
+    *durability = parsed;
+    return 1;
+}
+
+int parseRetention(const char *spec, DbRetention *db_retention)
+{
+    DbRetention parsed = *db_retention;
+    int n = 0, m = 0;
+
+    int fields = sscanf(spec, "%ld%n,%d%n", &parsed.max_age_s, &n, &parsed.batch, &m);
+    if (!((fields == 1 && spec[n] == '\0') || (fields == 2 && spec[m] == '\0')))
+        return 0;
+    if (parsed.max_age_s < 0 || parsed.batch < 1 || parsed.batch > DB_BATCH_MAX)
+        return 0;
+
+    *db_retention = parsed;
+    return 1;
+}
+
+int dbReserveMatchId(void)
+{
+    return __atomic_add_fetch(&last_match_id, 1, __ATOMIC_RELAXED);
+}
+
+void dbWriteCreateMatch(int match_id, int player1_id, int player2_id)
+{
+    DbOp op = {.type = DB_OP_CREATE_MATCH, .match_id = match_id, .player_id = player1_id, .player2_id = player2_id};
+    submit(&op);
+}
+
+void dbWriteDeleteMatch(int match_id)
+{
+    DbOp op = {.type = DB_OP_DELETE_MATCH, .match_id = match_id};
+    submit(&op);
+}
+
+void dbWriteMove(int match_id, int turn_order, int player_id, int x, int y, const char *result)
+{
+    DbOp op = {.type = DB_OP_MOVE, .match_id = match_id, .x = x, .y = y, .turn_order = turn_order, .player_id = player_id};
+    snprintf(op.result, sizeof(op.result), "%s", result);
+    submit(&op);
+}
+
+void dbWriteFinalizeMatch(int match_id, const char *result, int winner_id, int winner_elo, int loser_id, int loser_elo)
+{
+    DbOp op = {.type = DB_OP_FINALIZE_MATCH, .match_id = match_id, .player_id = winner_id, .elo = winner_elo,
+               .loser_id = loser_id, .loser_elo = loser_elo};
+    snprintf(op.result, sizeof(op.result), "%s", result);
+    submit(&op);
+}
+
+int dbUserWritePending(int user_id)
+{
+    return __atomic_load_n(&user_pending[userStripe(user_id)], __ATOMIC_SEQ_CST) > 0;
+}
+
+void dbWriterGetStats(DbWriterStats *out)
+{
+    out->durability = config;
+    out->retention = retention;
+    out->archived = __atomic_load_n(&stats.archived, __ATOMIC_RELAXED);
+    out->archive_us_max = __atomic_load_n(&stats.archive_us_max, __ATOMIC_RELAXED);
+    out->submitted = __atomic_load_n(&stats.submitted, __ATOMIC_RELAXED);
+    out->committed = __atomic_load_n(&stats.committed, __ATOMIC_RELAXED);
+    out->failed = __atomic_load_n(&stats.failed, __ATOMIC_RELAXED);
+    out->batches = __atomic_load_n(&stats.batches, __ATOMIC_RELAXED);
+    out->max_batch = __atomic_load_n(&stats.max_batch, __ATOMIC_RELAXED);
+    out->depth = queueDepth();
+    out->max_depth = __atomic_load_n(&stats.max_depth, __ATOMIC_RELAXED);
+    out->stalls = __atomic_load_n(&stats.stalls, __ATOMIC_RELAXED);
+    out->commit_us_total = __atomic_load_n(&stats.commit_us_total, __ATOMIC_RELAXED);
+    out->commit_us_max = __atomic_load_n(&stats.commit_us_max, __ATOMIC_RELAXED);
+    out->lag_us_max = __atomic_load_n(&stats.lag_us_max, __ATOMIC_RELAXED);
+}
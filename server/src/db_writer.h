@@ -0,0 +1,115 @@
+#ifndef DB_WRITER_H
+#define DB_WRITER_H
+
+#include "database.h"
+
+//* Write-behind database thread. Reactors push game writes (moves, match endings)
+//* into a bounded lock-free queue and carry on; one writer thread drains it on its own SQLite
+//* connection and group-commits it: everything that arrives within the commit window after the
+//* first queued write, up to a size limit, goes into one transaction.
+//* Reads that must see a queued write (LOGIN after a game) check dbUserWritePending() and park the
+//* request, the writer wakes the shard when its writes are committed.
+
+#define DB_QUEUE_CAPACITY 65536 //* Queued operations, must be a power of two
+#define DB_BATCH_MAX 65536      //* Largest accepted group commit size
+#define DB_USER_STRIPES 1024    //* Pending-write counters, users.id modulo the stripe count
+#define DB_ARCHIVE_INTERVAL_MS 1000 //* How often an idle writer looks for matches to archive
+
+typedef enum
+{
+    DB_OP_CREATE_MATCH,  //* db_insert_match() with an id from dbReserveMatchId()
+    DB_OP_DELETE_MATCH,  //* A match cancelled before its first move
+    DB_OP_MOVE,
+    DB_OP_FINALIZE_MATCH //* db_finalize_match(): result, both ratings, wins/losses
+} DbOpType;
+
+typedef struct
+{
+    DbOpType type;
+    long queued_us; //* Monotonic time of submission
+    int match_id;   //* All
+    int x;          //* DB_OP_MOVE
+    int y;
+    int turn_order; //* DB_OP_MOVE: 1 for the first shot of the match
+    int player_id;  //* DB_OP_MOVE: users.id of the attacker, DB_OP_FINALIZE_MATCH: of the winner, DB_OP_CREATE_MATCH: player 1
+    int player2_id; //* DB_OP_CREATE_MATCH
+    int elo;        //* DB_OP_FINALIZE_MATCH: new rating of player_id
+    int loser_id;   //* DB_OP_FINALIZE_MATCH: users.id (0 == a bot, for either seat)
+    int loser_elo;
+    char result[16]; //* "HIT"/"MISS"/"SUNK" (DB_OP_MOVE) or "P1_WIN"/"P2_WIN"/"DRAW"
+} DbOp;
+
+//* Durability / latency trade-off, -d synchronous[,window_ms[,max_batch]]
+typedef struct
+{
+    DbSynchronous synchronous;
+    int window_ms; //* How long the first write of a group waits for company, 0 == commit what is queued
+    int max_batch; //* Operations per transaction, a full group commits without waiting out the window
+} DbDurability;
+
+//* Retention, -r max_age_s[,batch]: moves of matches that ended more than max_age_s ago go to the
+//* compressed archive, batch matches per transaction, between group commits
+typedef struct
+{
+    long max_age_s; //* 0 == keep every match hot
+    int batch;
+} DbRetention;
+
+typedef struct
+{
+    DbDurability durability;
+    DbRetention retention;
+    long submitted; //* Operations accepted into the queue
+    long committed; //* Operations whose transaction committed
+    long failed;    //* Operations that failed or whose transaction was rolled back
+    long batches;   //* Transactions
+    int max_batch;
+    int depth;     //* Operations waiting right now
+    int max_depth; //* Highest depth seen
+    long stalls;   //* Submissions that found the queue full and had to wait
+    long commit_us_total;
+    long commit_us_max;
+    long lag_us_max; //* Longest submit-to-commit delay
+    long archived;   //* Matches whose moves went to the archive
+    long archive_us_max; //* Longest archive transaction
+} DbWriterStats;
+
+/** Open the writer's database connection and start the writer thread
+ * @param durability synchronous level of the writer's connection and group commit settings (copied)
+ * @param retention when old matches are archived (copied)
+ * @return 1 == success, 0 == failed
+ */
+int dbWriterInit(const char *filename, const DbDurability *durability, const DbRetention *retention);
+
+/** Parse "off|normal|full[,window_ms[,max_batch]]"
+ * @return 1 == success, 0 == malformed (durability is left untouched)
+ */
+int parseDurability(const char *spec, DbDurability *durability);
+
+/** Parse "max_age_s[,batch]"
+ * @return 1 == success, 0 == malformed (retention is left untouched)
+ */
+int parseRetention(const char *spec, DbRetention *retention);
+
+/** Commit everything still queued and stop the writer thread */
+void dbWriterShutdown(void);
+
+/** Hand out the id of a new match (any thread), after the highest one the database has seen.
+ * The match row itself is queued with dbWriteCreateMatch(), ahead of every move of the match
+ */
+int dbReserveMatchId(void);
+
+//* Queue a write (any thread). When the queue is full the caller waits for room, that is the
+//* only time disk latency reaches a reactor.
+void dbWriteCreateMatch(int match_id, int player1_id, int player2_id);
+void dbWriteDeleteMatch(int match_id);
+void dbWriteMove(int match_id, int turn_order, int player_id, int x, int y, const char *result);
+void dbWriteFinalizeMatch(int match_id, const char *result, int winner_id, int winner_elo, int loser_id, int loser_elo);
+
+/** @return 1 if a write to the user (users.id) may still be queued or uncommitted */
+int dbUserWritePending(int user_id);
+
+/** Copy the writer counters (any thread) */
+void dbWriterGetStats(DbWriterStats *stats);
+
+#endif
@@ -1,44 +1,315 @@
 #include "game.h"
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
+
+_Static_assert(BOARD_CELLS <= 64 * BOARD_MASK_WORDS, "a CellMask holds every cell");
+
+#define SHIP_SIZE(type, name, size) [type] = size,
+#define SHIP_NAME(type, name, size) [type] = name,
+static const unsigned char ship_sizes[SHIP_TYPE_COUNT] = {SHIP_TYPES(SHIP_SIZE)};
+static const char *const ship_names[SHIP_TYPE_COUNT] = {SHIP_TYPES(SHIP_NAME)};
+#undef SHIP_SIZE
+#undef SHIP_NAME
 
 // =====================
-// Get ship size
+// Cell masks
 // =====================
-int get_ship_size(ShipType type)
+static int mask_test(const CellMask *mask, int cell)
+{
+    return (int)(mask->word[cell >> 6] >> (cell & 63) & 1);
+}
+
+static void mask_set(CellMask *mask, int cell)
+{
+    mask->word[cell >> 6] |= (uint64_t)1 << (cell & 63);
+}
+
+static int mask_empty(const CellMask *mask)
+{
+    uint64_t any = 0;
+    for (int i = 0; i < BOARD_MASK_WORDS; i++)
+        any |= mask->word[i];
+    return any == 0;
+}
+
+static int masks_overlap(const CellMask *a, const CellMask *b)
+{
+    uint64_t overlap = 0;
+    for (int i = 0; i < BOARD_MASK_WORDS; i++)
+        overlap |= a->word[i] & b->word[i];
+    return overlap != 0;
+}
+
+// Cells of a ship, empty if it does not fit on a rows x cols board
+static CellMask ship_mask(int rows, int cols, int row, int col, int size, Orientation orient)
+{
+    CellMask mask = {{0}};
+    if (row < 0 || col < 0 || row >= rows || col >= cols)
+        return mask;
+    if (orient == HORIZONTAL ? col + size > cols : row + size > rows)
+        return mask;
+
+    int step = orient == HORIZONTAL ? 1 : MAX_BOARD_COL;
+    for (int i = 0, cell = row * MAX_BOARD_COL + col; i < size; i++, cell += step)
+        mask_set(&mask, cell);
+    return mask;
+}
+
+// =====================
+// Packed board kernels
+// =====================
+//* Written once, forced inline into the functions GAME_VARIANTS generates below so every variant
+//* gets its own copy with the board size and fleet as constants (classic pays for no other variant)
+#define BOARD_KERNEL static inline __attribute__((always_inline))
+#define VARIANT_FUNCTION static __attribute__((noinline)) //* One per variant, the dispatch switch jumps straight into it
+
+BOARD_KERNEL int bits_test(const uint64_t *words, int cell)
+{
+    return (int)(words[cell >> 6] >> (cell & 63) & 1);
+}
+
+BOARD_KERNEL void bits_set(uint64_t *words, int cell)
+{
+    words[cell >> 6] |= (uint64_t)1 << (cell & 63);
+}
+
+#define MASK_WORDS(ROWS, COLS) (((ROWS) * (COLS) + 63) / 64)
+
+// 128 bits of words from bit first on, zero past the last word
+BOARD_KERNEL unsigned __int128 bits_window(const uint64_t *words, int count, int first)
+{
+    int word = first >> 6, shift = first & 63;
+    unsigned __int128 window = words[word];
+    if (word + 1 < count)
+        window |= (unsigned __int128)words[word + 1] << 64;
+    window >>= shift;
+    if (shift && word + 2 < count)
+        window |= (unsigned __int128)words[word + 2] << (128 - shift);
+    return window;
+}
+
+BOARD_KERNEL void kernel_init(uint64_t *occupied, unsigned char *cells, unsigned char *vertical, unsigned char *remaining,
+                              const FleetLayout *fleet, const ShipType *types, int ships, int cols)
+{
+    *vertical = fleet->vertical;
+    for (int i = 0; i < ships; i++)
+    {
+        cells[i] = fleet->cells[i];
+        if (cells[i] == FLEET_NO_SHIP)
+            continue;
+
+        int size = ship_sizes[types[i]];
+        int step = (fleet->vertical >> i & 1) ? cols : 1;
+        for (int j = 0, cell = cells[i]; j < size; j++, cell += step)
+            bits_set(occupied, cell);
+        *remaining += size;
+    }
+}
+
+BOARD_KERNEL AttackResult kernel_attack(const uint64_t *occupied, uint64_t *shots, const unsigned char *cells, unsigned char vertical,
+                                        unsigned char *remaining, const ShipType *types, int ships, int rows, int cols, int row, int col)
+{
+    if (row < 0 || row >= rows || col < 0 || col >= cols)
+        return ATTACK_INVALID;
+
+    int cell = row * cols + col;
+    if (bits_test(shots, cell))
+        return ATTACK_INVALID; // already attacked
+
+    bits_set(shots, cell);
+    if (!bits_test(occupied, cell))
+        return ATTACK_MISS;
+    (*remaining)--;
+
+    //* Which ship was hit: one branch-free range check per ship, no walk over its cells
+    unsigned int hit = 0;
+#pragma GCC unroll 8
+    for (int i = 0; i < ships; i++)
+    {
+        int size = ship_sizes[types[i]];
+        int from_bow = cell - cells[i]; //* Negative for FLEET_NO_SHIP
+        int on_ship = (vertical >> i & 1) ? ((unsigned int)from_bow <= (unsigned int)((size - 1) * cols)) & (from_bow % cols == 0)
+                                          : (unsigned int)from_bow < (unsigned int)size;
+        hit |= (unsigned int)on_ship << i;
+    }
+    if (!hit)
+        return ATTACK_HIT; //! (shouldn’t reach here)
+
+    //* Sunk: one mask test on the shots from the bow on, a vertical ship's cells are cols bits apart
+    int ship = __builtin_ctz(hit);
+    int size = ship_sizes[types[ship]];
+    unsigned __int128 column = 0;
+    for (int k = 0; k < rows && k * cols < 128; k++)
+        column |= (unsigned __int128)1 << (k * cols); //* Folded to a constant
+    unsigned __int128 mask = (vertical >> ship & 1) ? column & (((unsigned __int128)1 << ((size - 1) * cols + 1)) - 1)
+                                                    : ((unsigned __int128)1 << size) - 1;
+    return (bits_window(shots, MASK_WORDS(rows, cols), cells[ship]) & mask) == mask ? ATTACK_SUNK : ATTACK_HIT;
+}
+
+BOARD_KERNEL int kernel_shots(const uint64_t *shots, int words)
+{
+    int count = 0;
+    for (int i = 0; i < words; i++)
+        count += __builtin_popcountll(shots[i]);
+    return count;
+}
+
+#define UNPAREN(...) __VA_ARGS__
+#define FLEET_SIZE(KEY) ((int)(sizeof(KEY##_fleet) / sizeof(KEY##_fleet[0])))
+
+//* Per variant: its fleet, its packed board and the kernels specialized for both
+#define DEFINE_VARIANT(ID, KEY, ROWS, COLS, SHIPS)                                                                     \
+    static const ShipType KEY##_fleet[] = {UNPAREN SHIPS};                                                              \
+    _Static_assert((ROWS) <= MAX_BOARD_ROW && (COLS) <= MAX_BOARD_COL && FLEET_SIZE(KEY) <= MAX_SHIP_NUM,               \
+                   #KEY " does not fit MAX_BOARD_ROW, MAX_BOARD_COL or MAX_SHIP_NUM");                                  \
+    _Static_assert((ROWS) * (COLS) <= FLEET_NO_SHIP, #KEY " has cells a FleetLayout byte cannot hold");                 \
+    typedef struct                                                                                                      \
+    {                                                                                                                   \
+        unsigned char remaining; /* Ship cells not hit yet, first in every variant (packed_remaining()) */             \
+        unsigned char vertical;                                                                                         \
+        unsigned char cells[FLEET_SIZE(KEY)];                                                                           \
+        uint64_t occupied[MASK_WORDS(ROWS, COLS)];                                                                      \
+        uint64_t shots[MASK_WORDS(ROWS, COLS)]; /* Hits and misses */                                                   \
+    } KEY##_board;                                                                                                      \
+    _Static_assert(offsetof(KEY##_board, remaining) == 0, #KEY " keeps remaining where packed_remaining() reads it");   \
+    static void KEY##_init(void *board, const FleetLayout *fleet)                                                       \
+    {                                                                                                                   \
+        KEY##_board *b = board;                                                                                         \
+        memset(b, 0, sizeof(*b));                                                                                       \
+        kernel_init(b->occupied, b->cells, &b->vertical, &b->remaining, fleet, KEY##_fleet, FLEET_SIZE(KEY), COLS);     \
+    }                                                                                                                   \
+    VARIANT_FUNCTION AttackResult KEY##_attack(void *board, int row, int col)                                           \
+    {                                                                                                                   \
+        KEY##_board *b = board;                                                                                         \
+        return kernel_attack(b->occupied, b->shots, b->cells, b->vertical, &b->remaining, KEY##_fleet, FLEET_SIZE(KEY), \
+                             ROWS, COLS, row, col);                                                                     \
+    }                                                                                                                   \
+    static int KEY##_shots(const void *board)                                                                           \
+    {                                                                                                                   \
+        return kernel_shots(((const KEY##_board *)board)->shots, MASK_WORDS(ROWS, COLS));                               \
+    }                                                                                                                   \
+    static void KEY##_layout(const void *board, FleetLayout *fleet)                                                     \
+    {                                                                                                                   \
+        const KEY##_board *b = board;                                                                                   \
+        memset(fleet, 0, sizeof(*fleet));                                                                               \
+        fleet->variant = ID;                                                                                            \
+        fleet->vertical = b->vertical;                                                                                  \
+        memcpy(fleet->cells, b->cells, sizeof(b->cells));                                                               \
+    }
+GAME_VARIANTS(DEFINE_VARIANT)
+#undef DEFINE_VARIANT
+
+_Static_assert(sizeof(classic_board) <= 40, "a classic match is meant to fit in 120 bytes (server.h)");
+
+#define RULES_ENTRY(ID, KEY, ROWS, COLS, SHIPS) [ID] = {#KEY, ROWS, COLS, FLEET_SIZE(KEY), KEY##_fleet, sizeof(KEY##_board)},
+const GameRules game_rules[GAME_VARIANT_COUNT] = {GAME_VARIANTS(RULES_ENTRY)};
+#undef RULES_ENTRY
+
+// =====================
+// Packed board
+// =====================
+void init_packed_board(void *board, const FleetLayout *fleet)
+{
+    switch (fleet->variant)
+    {
+#define INIT_CASE(ID, KEY, ROWS, COLS, SHIPS) \
+    case ID:                                  \
+        KEY##_init(board, fleet);             \
+        break;
+        GAME_VARIANTS(INIT_CASE)
+#undef INIT_CASE
+    }
+}
+
+AttackResult attack_packed(GameVariant variant, void *board, int row, int col)
+{
+    if (!board)
+        return ATTACK_INVALID;
+
+    switch (variant)
+    {
+#define ATTACK_CASE(ID, KEY, ROWS, COLS, SHIPS) \
+    case ID:                                    \
+        return KEY##_attack(board, row, col);
+        GAME_VARIANTS(ATTACK_CASE)
+#undef ATTACK_CASE
+    default:
+        return ATTACK_INVALID;
+    }
+}
+
+int packed_shots(GameVariant variant, const void *board)
 {
-    switch (type)
+    switch (variant)
     {
-    case CARRIER:
-        return 5;
-    case BATTLESHIP:
-        return 4;
-    case CRUISER:
-        return 3;
-    case SUBMARINE:
-        return 3;
-    case DESTROYER:
-        return 2;
+#define SHOTS_CASE(ID, KEY, ROWS, COLS, SHIPS) \
+    case ID:                                   \
+        return KEY##_shots(board);
+        GAME_VARIANTS(SHOTS_CASE)
+#undef SHOTS_CASE
     default:
         return 0;
     }
 }
 
+void packed_fleet(GameVariant variant, const void *board, FleetLayout *fleet)
+{
+    switch (variant)
+    {
+#define LAYOUT_CASE(ID, KEY, ROWS, COLS, SHIPS) \
+    case ID:                                    \
+        KEY##_layout(board, fleet);             \
+        break;
+        GAME_VARIANTS(LAYOUT_CASE)
+#undef LAYOUT_CASE
+    default:
+        memset(fleet, 0, sizeof(*fleet));
+    }
+}
+
+// =====================
+// Ship types and variants
+// =====================
+int get_ship_size(ShipType type)
+{
+    return (type > NO_SHIP && type < SHIP_TYPE_COUNT) ? ship_sizes[type] : 0;
+}
+
+const char *get_ship_name(ShipType type)
+{
+    return (type > NO_SHIP && type < SHIP_TYPE_COUNT) ? ship_names[type] : NULL;
+}
+
+int find_variant(const char *name)
+{
+    for (int v = 0; name && v < GAME_VARIANT_COUNT; v++)
+    {
+        if (strcmp(name, game_rules[v].name) == 0)
+            return v;
+    }
+    return -1;
+}
+
 // =====================
 // Initialize board (board + ships)
 // =====================
 int init_board_state(BoardState *state)
 {
-    if (!state)
+    return init_variant_board(state, VARIANT_CLASSIC);
+}
+
+int init_variant_board(BoardState *state, GameVariant variant)
+{
+    if (!state || (unsigned int)variant >= GAME_VARIANT_COUNT)
         return 0; // failed
 
-    for (int r = 0; r < MAX_BOARD_ROW; r++)
-    {
-        for (int c = 0; c < MAX_BOARD_COL; c++)
-        {
-            state->board[r][c] = ' ';
-        }
-    }
+    state->variant = variant;
+    memset(&state->occupied, 0, sizeof(state->occupied));
+    memset(&state->hit, 0, sizeof(state->hit));
+    memset(&state->miss, 0, sizeof(state->miss));
+    memset(state->ship_at, 0, sizeof(state->ship_at));
+    state->remaining = 0;
 
     // Reset ships
     for (int i = 0; i < MAX_SHIP_NUM; i++)
@@ -63,25 +334,13 @@ int validate_ship_placement(BoardState *state, int row, int col, int size, Orien
     if (!state || size <= 0)
         return 0;
 
-    if (row < 0 || col < 0 || row >= MAX_BOARD_ROW || col >= MAX_BOARD_COL)
-        return 0;
+    const GameRules *rules = &game_rules[state->variant];
+    CellMask cells = ship_mask(rules->rows, rules->cols, row, col, size, orient);
+    if (mask_empty(&cells))
+        return 0; // off the board
 
-    if (orient == HORIZONTAL)
-    {
-        if (col + size > MAX_BOARD_COL)
-            return 0;
-        for (int c = col; c < col + size; c++)
-            if (state->board[row][c] != ' ')
-                return 0;
-    }
-    else // VERTICAL
-    {
-        if (row + size > MAX_BOARD_ROW)
-            return 0;
-        for (int r = row; r < row + size; r++)
-            if (state->board[r][col] != ' ')
-                return 0;
-    }
+    if (masks_overlap(&cells, &state->occupied))
+        return 0;
 
     return 1; // valid
 }
@@ -123,16 +382,13 @@ int place_ship(BoardState *state, ShipType type, int row, int col, Orientation o
     state->ships[index].sunk = 0;
 
     // Place ship cells on board
-    if (orient == HORIZONTAL)
-    {
-        for (int c = col; c < col + size; c++)
-            state->board[row][c] = 's';
-    }
-    else
+    int step = orient == HORIZONTAL ? 1 : MAX_BOARD_COL;
+    for (int i = 0, cell = row * MAX_BOARD_COL + col; i < size; i++, cell += step)
     {
-        for (int r = row; r < row + size; r++)
-            state->board[r][col] = 's';
+        mask_set(&state->occupied, cell);
+        state->ship_at[cell] = (unsigned char)(index + 1);
     }
+    state->remaining += size;
 
     return 1; // success
 }
@@ -145,49 +401,31 @@ AttackResult attack_cell(BoardState *state, int row, int col)
     if (!state)
         return ATTACK_INVALID;
 
-    if (row < 0 || row >= MAX_BOARD_ROW || col < 0 || col >= MAX_BOARD_COL)
+    if (row < 0 || row >= game_rules[state->variant].rows || col < 0 || col >= game_rules[state->variant].cols)
         return ATTACK_INVALID;
 
-    char cell = state->board[row][col];
-    if (cell == 'x' || cell == 'o')
+    int cell = row * MAX_BOARD_COL + col;
+    if (mask_test(&state->hit, cell) || mask_test(&state->miss, cell))
         return ATTACK_INVALID; // already attacked
 
-    if (cell == 's')
+    if (!state->ship_at[cell])
     {
-        state->board[row][col] = 'x';
+        mask_set(&state->miss, cell);
+        return ATTACK_MISS;
+    }
 
-        // todo: Find which ship was hit
-        for (int i = 0; i < MAX_SHIP_NUM; i++)
-        {
-            Ship *s = &state->ships[i];
-            if (s->size == 0 || s->sunk)
-                continue;
-
-            for (int j = 0; j < s->size; j++)
-            {
-                int r = s->row + (s->orient == VERTICAL ? j : 0);
-                int c = s->col + (s->orient == HORIZONTAL ? j : 0);
-
-                if (r == row && c == col)
-                {
-                    s->hits++;
-                    if (s->hits >= s->size)
-                    {
-                        s->sunk = 1;
-                        return ATTACK_SUNK;
-                    }
-                    return ATTACK_HIT;
-                }
-            }
-        }
+    mask_set(&state->hit, cell);
+    state->remaining--;
 
-        return ATTACK_HIT; //! (shouldn’t reach here)
-    }
-    else
+    // todo: The cell knows which ship was hit
+    Ship *s = &state->ships[state->ship_at[cell] - 1];
+    s->hits++;
+    if (s->hits >= s->size)
     {
-        state->board[row][col] = 'o';
-        return ATTACK_MISS;
+        s->sunk = 1;
+        return ATTACK_SUNK;
     }
+    return ATTACK_HIT;
 }
 
 // =====================
@@ -198,24 +436,58 @@ int all_ships_sunk(BoardState *state)
     if (!state)
         return 0;
 
-    // todo: Check ships
+    return state->remaining == 0; // Every ship cell hit
+}
+
+// =====================
+// Pack / unpack a fleet
+// =====================
+int pack_fleet(const BoardState *state, FleetLayout *fleet)
+{
+    if (!state || !fleet)
+        return 0;
+
+    const GameRules *rules = &game_rules[state->variant];
+    memset(fleet, 0, sizeof(*fleet));
+    memset(fleet->cells, FLEET_NO_SHIP, sizeof(fleet->cells));
+    fleet->variant = (unsigned char)state->variant;
     for (int i = 0; i < MAX_SHIP_NUM; i++)
     {
-        if (state->ships[i].size > 0 && !state->ships[i].sunk)
-            return 0;
+        const Ship *s = &state->ships[i];
+        if (s->size == 0)
+            continue;
+
+        // todo: First slot of the fleet for this type that is still free
+        int slot = 0;
+        while (slot < rules->ship_count && (rules->fleet[slot] != s->ship_type || fleet->cells[slot] != FLEET_NO_SHIP))
+            slot++;
+        if (slot == rules->ship_count)
+            return 0; // not in the fleet, or one too many
+
+        fleet->cells[slot] = (unsigned char)(s->row * rules->cols + s->col);
+        if (s->orient == VERTICAL)
+            fleet->vertical |= (unsigned char)(1 << slot);
     }
+    return 1;
+}
 
-    // todo: Check board
-    for (int r = 0; r < MAX_BOARD_ROW; r++)
+int unpack_fleet(const FleetLayout *fleet, BoardState *state)
+{
+    if (!fleet || !init_variant_board(state, (GameVariant)fleet->variant))
+        return 0;
+
+    const GameRules *rules = &game_rules[fleet->variant];
+    for (int i = 0; i < rules->ship_count; i++)
     {
-        for (int c = 0; c < MAX_BOARD_COL; c++)
-        {
-            if (state->board[r][c] == 's')
-                return 0;
-        }
-    }
+        int cell = fleet->cells[i];
+        if (cell == FLEET_NO_SHIP)
+            continue;
 
-    return 1; // all sunk
+        Orientation orient = (fleet->vertical >> i & 1) ? VERTICAL : HORIZONTAL;
+        if (!place_ship(state, rules->fleet[i], cell / rules->cols, cell % rules->cols, orient))
+            return 0;
+    }
+    return 1;
 }
 
 // =====================
@@ -226,21 +498,26 @@ void print_board(BoardState *state, int reveal_ships)
     if (!state)
         return;
 
+    const GameRules *rules = &game_rules[state->variant];
     printf("   ");
-    for (int c = 0; c < MAX_BOARD_COL; c++)
+    for (int c = 0; c < rules->cols; c++)
         printf("%2d ", c);
     printf("\n");
 
-    for (int r = 0; r < MAX_BOARD_ROW; r++)
+    for (int r = 0; r < rules->rows; r++)
     {
         printf("%2d ", r);
-        for (int c = 0; c < MAX_BOARD_COL; c++)
+        for (int c = 0; c < rules->cols; c++)
         {
-            char cell = state->board[r][c];
-            if (cell == 's' && !reveal_ships)
-                printf(" . ");
+            int cell = r * MAX_BOARD_COL + c;
+            if (mask_test(&state->hit, cell))
+                printf(" x ");
+            else if (mask_test(&state->miss, cell))
+                printf(" o ");
+            else if (mask_test(&state->occupied, cell))
+                printf(reveal_ships ? " s " : " . ");
             else
-                printf(" %c ", cell);
+                printf("   ");
         }
         printf("\n");
     }
@@ -279,5 +556,6 @@ void print_board_state(BoardState *state)
 // =====================
 void reset_board(BoardState *state)
 {
-    init_board_state(state);
+    if (state)
+        init_variant_board(state, state->variant);
 }
@@ -1,9 +1,16 @@
 #ifndef GAME_H
 #define GAME_H
 
-#define MAX_SHIP_NUM 5
-#define MAX_BOARD_COL 10
-#define MAX_BOARD_ROW 10
+#include <stdint.h>
+
+#include "game_rules.h"
+
+//* Room for the largest variant in GAME_VARIANTS (game.c checks every entry fits)
+#define MAX_SHIP_NUM 7
+#define MAX_BOARD_COL 15
+#define MAX_BOARD_ROW 15
+#define BOARD_CELLS (MAX_BOARD_ROW * MAX_BOARD_COL)
+#define BOARD_MASK_WORDS ((BOARD_CELLS + 63) / 64)
 
 //* ========== ENUM ============
 typedef enum
@@ -12,15 +19,22 @@ typedef enum
     VERTICAL
 } Orientation;
 
+#define SHIP_TYPE_ENUM(type, name, size) type,
 typedef enum
 {
     NO_SHIP = 0,
-    CARRIER = 1,    // SIZE 5
-    BATTLESHIP = 2, // SIZE 4
-    CRUISER = 3,    // SIZE 3
-    SUBMARINE = 4,  // SIZE 3
-    DESTROYER = 5   // SIZE 2
+    SHIP_TYPES(SHIP_TYPE_ENUM) //* CARRIER = 1 ... in table order, sizes in game_rules.h
+    SHIP_TYPE_COUNT
 } ShipType;
+#undef SHIP_TYPE_ENUM
+
+#define GAME_VARIANT_ENUM(variant, key, rows, cols, fleet) variant,
+typedef enum
+{
+    GAME_VARIANTS(GAME_VARIANT_ENUM)
+    GAME_VARIANT_COUNT
+} GameVariant;
+#undef GAME_VARIANT_ENUM
 
 typedef enum
 {
@@ -42,20 +56,71 @@ typedef struct
     int sunk; //* 0 = alive, 1 = sunk
 } Ship;
 
+//* Board size and fleet of a variant, from GAME_VARIANTS
+typedef struct
+{
+    const char *name; //* QUEUE_ENTER_REQ "variant"
+    int rows, cols;
+    int ship_count;
+    const ShipType *fleet; //* ship_count types, the order of FleetLayout.cells
+    int packed_size;       //* Bytes of one packed board, a multiple of 8
+} GameRules;
+
+extern const GameRules game_rules[GAME_VARIANT_COUNT];
+
+//* One bit per cell, cell = row * MAX_BOARD_COL + col
 typedef struct
 {
-    char board[MAX_BOARD_COL][MAX_BOARD_ROW]; //* " " -> blank, "o" -> miss, "x" -> hit, "s" -> ship
+    uint64_t word[BOARD_MASK_WORDS];
+} CellMask;
+
+//* A board of any variant, used to check a placement before it is packed
+typedef struct
+{
+    GameVariant variant;
+    CellMask occupied; //* Ship cells
+    CellMask hit;      //* Shots on a ship
+    CellMask miss;     //* Shots on water
+    unsigned char ship_at[BOARD_CELLS]; //* Index in ships + 1, 0 == water
+    int remaining;     //* Ship cells not hit yet, 0 == all sunk
     Ship ships[MAX_SHIP_NUM];
 } BoardState;
 
+//* ============ PACKED BOARD ==============
+#define FLEET_NO_SHIP 0xFF
+
+//* Ship placement in one byte per ship of the variant's fleet (game_rules[variant].fleet order):
+//*   cells[i]: bow cell (row * cols + col of the variant), FLEET_NO_SHIP == not placed
+//*   vertical: bit i set == ship i is VERTICAL
+typedef struct
+{
+    unsigned char variant; //* GameVariant
+    unsigned char vertical;
+    unsigned char cells[MAX_SHIP_NUM];
+} FleetLayout;
+
+//* A live match keeps each board packed: game_rules[variant].packed_size bytes (40 for classic), only
+//* read and written through the functions below, which call the kernels game.c builds for the variant
+
 // IN-BATTLE GAME LOGIC
 int get_ship_size(ShipType type);
 
-/** Initialize the board state for the game
+/** Key of a ship type in QUEUE_ENTER_REQ "ships", NULL if unknown */
+const char *get_ship_name(ShipType type);
+
+/** Variant called name, -1 if there is none */
+int find_variant(const char *name);
+
+/** Initialize the board state for a classic game
  * @return 1 == success, 0 == failed
  */
 int init_board_state(BoardState *state);
 
+/** Initialize the board state for a game of a variant
+ * @return 1 == success, 0 == failed
+ */
+int init_variant_board(BoardState *state, GameVariant variant);
+
 /** Validate the ship placement when place ship
  * @return 0 == failed, 1 == success
  */
@@ -67,7 +132,7 @@ int validate_ship_placement(BoardState *state, int row, int col, int size, Orien
 int place_ship(BoardState *state, ShipType type, int row, int col, Orientation orient);
 
 /** Mark attack on the board
- ** "o" -> miss, "x" -> hit
+ ** Sets the hit or miss bit, a cell already shot at is ATTACK_INVALID
  */
 AttackResult attack_cell(BoardState *state, int row, int col);
 
@@ -78,6 +143,34 @@ AttackResult attack_cell(BoardState *state, int row, int col);
  */
 int all_ships_sunk(BoardState *state);
 
+/** Pack the ships of a board (shots are not kept)
+ * @return 1 == success, 0 == a ship the variant's fleet has no place for
+ */
+int pack_fleet(const BoardState *state, FleetLayout *fleet);
+
+/** Place a packed fleet on a fresh board
+ * @return 1 == success, 0 == failed
+ */
+int unpack_fleet(const FleetLayout *fleet, BoardState *state);
+
+/** Start a packed board of the fleet's variant with the fleet and no shots */
+void init_packed_board(void *board, const FleetLayout *fleet);
+
+/** attack_cell() on a packed board */
+AttackResult attack_packed(GameVariant variant, void *board, int row, int col);
+
+/** Shots fired at a packed board so far */
+int packed_shots(GameVariant variant, const void *board);
+
+/** Ship cells of a packed board not hit yet, 0 == all sunk (the first byte in every variant) */
+static inline int packed_remaining(const void *board)
+{
+    return *(const unsigned char *)board;
+}
+
+/** The fleet a packed board was started with */
+void packed_fleet(GameVariant variant, const void *board, FleetLayout *fleet);
+
 /**
  * Print the board
  */
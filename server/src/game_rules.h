@@ -0,0 +1,26 @@
+#ifndef GAME_RULES_H
+#define GAME_RULES_H
+
+//* ================== RULES TABLE ==================
+//* Every ship type and every game variant is one line here. game.h turns the lists into the
+//* ShipType / GameVariant enums and game_rules[], game.c into one set of packed board kernels
+//* per variant with its board size and fleet built in as constants.
+
+//* X(TYPE, name, size): name is the key of the ship in QUEUE_ENTER_REQ "ships"
+#define SHIP_TYPES(X)                \
+    X(CARRIER, "carrier", 5)         \
+    X(BATTLESHIP, "battleship", 4)   \
+    X(CRUISER, "cruiser", 3)         \
+    X(SUBMARINE, "submarine", 3)     \
+    X(DESTROYER, "destroyer", 2)     \
+    X(DREADNOUGHT, "dreadnought", 6) \
+    X(PATROL_BOAT, "patrol_boat", 2)
+
+//* X(VARIANT, key, rows, cols, (fleet)): key is QUEUE_ENTER_REQ "variant", a fleet names each type once
+//! MAX_BOARD_ROW, MAX_BOARD_COL and MAX_SHIP_NUM (game.h) must cover the largest entry
+#define GAME_VARIANTS(X)                                                                  \
+    X(VARIANT_CLASSIC, classic, 10, 10, (CARRIER, BATTLESHIP, CRUISER, SUBMARINE, DESTROYER)) \
+    X(VARIANT_BLITZ, blitz, 8, 8, (BATTLESHIP, CRUISER, SUBMARINE, DESTROYER))           \
+    X(VARIANT_GRAND, grand, 15, 15, (DREADNOUGHT, CARRIER, BATTLESHIP, CRUISER, SUBMARINE, DESTROYER, PATROL_BOAT))
+
+#endif
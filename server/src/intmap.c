@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "intmap.h"
+
+#define INTMAP_MIN_CAPACITY 64
+
+// todo: ================= HELPER FUNCTIONS ===================
+static unsigned int hashKey(int key)
+{
+    unsigned int h = (unsigned int)key;
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return h;
+}
+
+// Slot of key, or of the empty slot ending its probe chain
+static unsigned int probe(IntMap *map, int key)
+{
+    unsigned int mask = map->capacity - 1;
+    unsigned int i = hashKey(key) & mask;
+    while (map->keys[i] != 0 && map->keys[i] != key)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static int resize(IntMap *map, int capacity)
+{
+    int *keys = calloc(capacity, sizeof(int));
+    void **values = calloc(capacity, sizeof(void *));
+    if (!keys || !values)
+    {
+        free(keys);
+        free(values);
+        return 0;
+    }
+
+    IntMap old = *map;
+    map->keys = keys;
+    map->values = values;
+    map->capacity = capacity;
+    for (int i = 0; i < old.capacity; i++)
+    {
+        if (old.keys[i] == 0)
+            continue;
+        unsigned int slot = probe(map, old.keys[i]);
+        map->keys[slot] = old.keys[i];
+        map->values[slot] = old.values[i];
+    }
+    free(old.keys);
+    free(old.values);
+    return 1;
+}
+
+// todo: ================= MAP ===============================
+int intMapInit(IntMap *map)
+{
+    memset(map, 0, sizeof(IntMap));
+    return resize(map, INTMAP_MIN_CAPACITY);
+}
+
+void intMapFree(IntMap *map)
+{
+    free(map->keys);
+    free(map->values);
+    memset(map, 0, sizeof(IntMap));
+}
+
+void *intMapGet(IntMap *map, int key)
+{
+    if (key == 0 || map->capacity == 0)
+        return NULL;
+    unsigned int i = probe(map, key);
+    return map->keys[i] ? map->values[i] : NULL;
+}
+
+int intMapPut(IntMap *map, int key, void *value)
+{
+    if (key == 0)
+        return 0;
+
+    //* Keep the load factor under 1/2
+    if ((map->count + 1) * 2 > map->capacity && !resize(map, map->capacity ? map->capacity * 2 : INTMAP_MIN_CAPACITY))
+        return 0;
+
+    unsigned int i = probe(map, key);
+    if (map->keys[i] == 0)
+    {
+        map->keys[i] = key;
+        map->count++;
+    }
+    map->values[i] = value;
+    return 1;
+}
+
+void *intMapRemove(IntMap *map, int key)
+{
+    if (key == 0 || map->capacity == 0)
+        return NULL;
+
+    unsigned int hole = probe(map, key);
+    if (map->keys[hole] == 0)
+        return NULL;
+    void *value = map->values[hole];
+
+    //* Backward-shift deletion: pull later entries of the probe chain into the hole
+    unsigned int mask = map->capacity - 1;
+    unsigned int j = (hole + 1) & mask;
+    while (map->keys[j] != 0)
+    {
+        unsigned int home = hashKey(map->keys[j]) & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask))
+        {
+            map->keys[hole] = map->keys[j];
+            map->values[hole] = map->values[j];
+            hole = j;
+        }
+        j = (j + 1) & mask;
+    }
+    map->keys[hole] = 0;
+    map->values[hole] = NULL;
+    map->count--;
+    return value;
+}
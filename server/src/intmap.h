@@ -0,0 +1,34 @@
+#ifndef INTMAP_H
+#define INTMAP_H
+
+//* Open-addressed hash map from a non-zero int key to a pointer (linear probing,
+//* backward-shift deletion, capacity is a power of two kept at most half full).
+//* Not thread safe, every map is owned by one thread.
+
+typedef struct
+{
+    int *keys; //* 0 == empty
+    void **values;
+    int capacity;
+    int count;
+} IntMap;
+
+/** Prepare an empty map
+ * @return 1 == success, 0 == failed
+ */
+int intMapInit(IntMap *map);
+
+void intMapFree(IntMap *map);
+
+/** @return the value stored under key, NULL if absent */
+void *intMapGet(IntMap *map, int key);
+
+/** Insert or replace the value of key (key must not be 0)
+ * @return 1 == success, 0 == out of memory
+ */
+int intMapPut(IntMap *map, int key, void *value);
+
+/** @return the value that was stored under key, NULL if absent */
+void *intMapRemove(IntMap *map, int key);
+
+#endif
@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "leaderboard.h"
+#include "cJSON.h"
+
+// === Types ===
+typedef struct RankNode
+{
+    char username[64];
+    int elo;
+    unsigned int hash;
+    unsigned int priority; //* Heap order of the treap, random so the expected depth is O(log n)
+    int size;              //* Users in this subtree, what makes rank and select O(log n)
+    struct RankNode *left; //* Ranked before (higher Elo)
+    struct RankNode *right;
+    struct RankNode *chain; //* Next user in the same name bucket
+} RankNode;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static RankNode *root;
+static RankNode **buckets; //* username -> node
+static unsigned int bucket_mask;
+static int user_count;
+static int loaded; //* 0 == not tracking, writes are ignored
+static char *top_json; //* Serialized top page, NULL when a write reached it
+static unsigned int seed = 2463534242u;
+
+// === Internal helpers ===
+static unsigned int hash_username(const char *username)
+{
+    unsigned int h = 2166136261u; // FNV-1a
+    for (const unsigned char *c = (const unsigned char *)username; *c; c++)
+        h = (h ^ *c) * 16777619u;
+    return h;
+}
+
+static unsigned int next_priority(void)
+{
+    seed ^= seed << 13; // xorshift32
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+// <0 == (elo, username) ranks before node
+static int compare(int elo, const char *username, const RankNode *node)
+{
+    if (elo != node->elo)
+        return elo > node->elo ? -1 : 1;
+    return strcmp(username, node->username);
+}
+
+static int size_of(const RankNode *node)
+{
+    return node ? node->size : 0;
+}
+
+static void resize(RankNode *node)
+{
+    node->size = 1 + size_of(node->left) + size_of(node->right);
+}
+
+// left = nodes ranked before (elo, username), right = the rest
+static void split(RankNode *t, int elo, const char *username, RankNode **left, RankNode **right)
+{
+    if (!t)
+    {
+        *left = *right = NULL;
+        return;
+    }
+    if (compare(elo, username, t) > 0)
+    {
+        split(t->right, elo, username, &t->right, right);
+        *left = t;
+    }
+    else
+    {
+        split(t->left, elo, username, left, &t->left);
+        *right = t;
+    }
+    resize(t);
+}
+
+// Every node of a ranks before every node of b
+static RankNode *merge(RankNode *a, RankNode *b)
+{
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+    if (a->priority > b->priority)
+    {
+        a->right = merge(a->right, b);
+        resize(a);
+        return a;
+    }
+    b->left = merge(a, b->left);
+    resize(b);
+    return b;
+}
+
+static RankNode *insert(RankNode *t, RankNode *node)
+{
+    if (!t)
+        return node;
+    if (node->priority > t->priority)
+    {
+        split(t, node->elo, node->username, &node->left, &node->right);
+        resize(node);
+        return node;
+    }
+    if (compare(node->elo, node->username, t) < 0)
+        t->left = insert(t->left, node);
+    else
+        t->right = insert(t->right, node);
+    resize(t);
+    return t;
+}
+
+static RankNode *erase(RankNode *t, RankNode *node)
+{
+    if (t == node)
+        return merge(t->left, t->right);
+    if (compare(node->elo, node->username, t) < 0)
+        t->left = erase(t->left, node);
+    else
+        t->right = erase(t->right, node);
+    resize(t);
+    return t;
+}
+
+// Users ranked before (elo, username), with username "" that is everyone with a higher Elo
+static int count_before(int elo, const char *username)
+{
+    int count = 0;
+    for (RankNode *n = root; n;)
+    {
+        if (compare(elo, username, n) > 0)
+        {
+            count += size_of(n->left) + 1;
+            n = n->right;
+        }
+        else
+            n = n->left;
+    }
+    return count;
+}
+
+// k-th user, 0 == best
+static RankNode *select_at(int k)
+{
+    for (RankNode *n = root; n;)
+    {
+        int left = size_of(n->left);
+        if (k < left)
+            n = n->left;
+        else if (k == left)
+            return n;
+        else
+        {
+            k -= left + 1;
+            n = n->right;
+        }
+    }
+    return NULL;
+}
+
+static RankNode *find(const char *username, unsigned int hash)
+{
+    for (RankNode *n = buckets[hash & bucket_mask]; n; n = n->chain)
+    {
+        if (n->hash == hash && strcmp(n->username, username) == 0)
+            return n;
+    }
+    return NULL;
+}
+
+// Keep at most one user per bucket on average
+static void grow_buckets(void)
+{
+    unsigned int count = (bucket_mask + 1) * 2;
+    RankNode **grown = calloc(count, sizeof(RankNode *));
+    if (!grown)
+        return; //* Longer chains, still correct
+
+    for (unsigned int i = 0; i <= bucket_mask; i++)
+    {
+        RankNode *n = buckets[i];
+        while (n)
+        {
+            RankNode *next = n->chain;
+            n->chain = grown[n->hash & (count - 1)];
+            grown[n->hash & (count - 1)] = n;
+            n = next;
+        }
+    }
+    free(buckets);
+    buckets = grown;
+    bucket_mask = count - 1;
+}
+
+static void invalidate_top(int old_position, int new_position)
+{
+    //* Moves that start and end below the page shift nobody on it
+    if (old_position < LEADERBOARD_TOP_SIZE || new_position < LEADERBOARD_TOP_SIZE)
+    {
+        free(top_json);
+        top_json = NULL;
+    }
+}
+
+static void clear(void)
+{
+    for (unsigned int i = 0; buckets && i <= bucket_mask; i++)
+    {
+        RankNode *n = buckets[i];
+        while (n)
+        {
+            RankNode *next = n->chain;
+            free(n);
+            n = next;
+        }
+    }
+    free(buckets);
+    free(top_json);
+    buckets = NULL;
+    top_json = NULL;
+    root = NULL;
+    user_count = 0;
+    loaded = 0;
+}
+
+static void set_locked(const char *username, int elo)
+{
+    unsigned int hash = hash_username(username);
+    RankNode *node = find(username, hash);
+    int old_position = INT_MAX;
+
+    if (node)
+    {
+        if (node->elo == elo)
+            return;
+        old_position = count_before(node->elo, node->username);
+        root = erase(root, node);
+    }
+    else
+    {
+        node = calloc(1, sizeof(RankNode));
+        if (!node)
+            return;
+        snprintf(node->username, sizeof(node->username), "%s", username);
+        node->hash = hash;
+        node->priority = next_priority();
+        node->chain = buckets[hash & bucket_mask];
+        buckets[hash & bucket_mask] = node;
+        if (++user_count > (int)bucket_mask + 1)
+            grow_buckets();
+    }
+
+    node->elo = elo;
+    node->left = node->right = NULL;
+    node->size = 1;
+    root = insert(root, node);
+    invalidate_top(old_position, count_before(elo, node->username));
+}
+
+// === Setup ===
+static int load_user(const User *user, void *context)
+{
+    (void)context;
+    if (strcmp(user->password_hash, DB_BOT_PASSWORD_HASH) != 0) //* Bots are not ranked
+        set_locked(user->username, user->elo);
+    return 1;
+}
+
+int leaderboard_load(Database *database)
+{
+    pthread_mutex_lock(&lock);
+    clear();
+    buckets = calloc(16, sizeof(RankNode *)); //* Grown while the users stream in
+    int count = -1;
+    if (buckets)
+    {
+        bucket_mask = 15;
+        loaded = 1;
+        count = db_each_user(database, load_user, NULL);
+        if (count < 0)
+            clear();
+        else
+            count = user_count;
+    }
+    pthread_mutex_unlock(&lock);
+    return count;
+}
+
+void leaderboard_free(void)
+{
+    pthread_mutex_lock(&lock);
+    clear();
+    pthread_mutex_unlock(&lock);
+}
+
+// === Writes ===
+void leaderboard_set(const char *username, int elo)
+{
+    pthread_mutex_lock(&lock);
+    if (loaded)
+        set_locked(username, elo);
+    pthread_mutex_unlock(&lock);
+}
+
+void leaderboard_remove(const char *username)
+{
+    pthread_mutex_lock(&lock);
+    RankNode *node = loaded ? find(username, hash_username(username)) : NULL;
+    if (node)
+    {
+        int position = count_before(node->elo, node->username);
+        root = erase(root, node);
+
+        RankNode **link = &buckets[node->hash & bucket_mask];
+        while (*link != node)
+            link = &(*link)->chain;
+        *link = node->chain;
+        free(node);
+        user_count--;
+        invalidate_top(position, INT_MAX);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+// === Queries ===
+int leaderboard_size(void)
+{
+    pthread_mutex_lock(&lock);
+    int count = user_count;
+    pthread_mutex_unlock(&lock);
+    return count;
+}
+
+char *leaderboard_top_json(void)
+{
+    pthread_mutex_lock(&lock);
+    if (loaded && !top_json)
+    {
+        cJSON *top = cJSON_CreateArray();
+        int rank = 0;
+        for (int k = 0; k < LEADERBOARD_TOP_SIZE && k < user_count; k++)
+        {
+            RankNode *n = select_at(k);
+            RankNode *previous = k ? select_at(k - 1) : NULL;
+            if (!previous || previous->elo != n->elo)
+                rank = k + 1;
+
+            cJSON *entry = cJSON_CreateObject();
+            cJSON_AddNumberToObject(entry, "rank", rank);
+            cJSON_AddStringToObject(entry, "username", n->username);
+            cJSON_AddNumberToObject(entry, "elo", n->elo);
+            cJSON_AddItemToArray(top, entry);
+        }
+        top_json = cJSON_PrintUnformatted(top);
+        cJSON_Delete(top);
+    }
+    char *copy = top_json ? strdup(top_json) : NULL;
+    pthread_mutex_unlock(&lock);
+    return copy;
+}
+
+int leaderboard_around(const char *username, LeaderboardEntry *entries, int *self)
+{
+    int filled = 0;
+    pthread_mutex_lock(&lock);
+    RankNode *node = loaded ? find(username, hash_username(username)) : NULL;
+    if (node)
+    {
+        int position = count_before(node->elo, node->username);
+        int first = position > LEADERBOARD_NEIGHBOURS ? position - LEADERBOARD_NEIGHBOURS : 0;
+        int last = position + LEADERBOARD_NEIGHBOURS < user_count ? position + LEADERBOARD_NEIGHBOURS : user_count - 1;
+
+        for (int k = first; k <= last; k++)
+        {
+            RankNode *n = select_at(k);
+            entries[filled].rank = count_before(n->elo, "") + 1;
+            entries[filled].elo = n->elo;
+            snprintf(entries[filled].username, sizeof(entries[filled].username), "%s", n->username);
+            filled++;
+        }
+        *self = position - first;
+    }
+    pthread_mutex_unlock(&lock);
+    return filled;
+}
@@ -0,0 +1,42 @@
+#ifndef LEADERBOARD_H
+#define LEADERBOARD_H
+
+#include "database.h"
+
+//* Process-wide ranking of every user by Elo, loaded from the database at startup and kept up
+//* to date by the same database calls that write ratings (db_create_user, db_update_user_elo,
+//* db_finalize_match, db_delete_user). An order-statistic treap ordered by Elo (highest first,
+//* ties by username) answers rank and "who is k-th" in O(log n). The top page is serialized once
+//* and rebuilt only when a rating change reaches it. Bot accounts are never ranked.
+
+#define LEADERBOARD_TOP_SIZE 10  //* Users in the cached top page
+#define LEADERBOARD_NEIGHBOURS 5 //* Users shown above and below the caller
+#define LEADERBOARD_DEFAULT_ELO 1000 //* users.elo default, the rating of a fresh registration
+
+typedef struct
+{
+    int rank; //* 1 + users with a strictly higher Elo, ties share a rank
+    int elo;
+    char username[64];
+} LeaderboardEntry;
+
+//* ================== SETUP ==================
+int leaderboard_load(Database *database); // Build from the users table and start tracking, returns the ranked user count or -1
+void leaderboard_free(void);
+
+//* ================== WRITES ==================
+void leaderboard_set(const char *username, int elo); // Insert or move a user, no-op before leaderboard_load()
+void leaderboard_remove(const char *username);
+
+//* ================== QUERIES ==================
+int leaderboard_size(void);
+char *leaderboard_top_json(void); // JSON array of the top page, the caller frees it (NULL when not loaded)
+
+/** The caller and the users ranked right around it
+ * @param entries room for 2 * LEADERBOARD_NEIGHBOURS + 1 entries, best first
+ * @param self index of username in entries
+ * @return number of entries filled in, 0 if username is not ranked
+ */
+int leaderboard_around(const char *username, LeaderboardEntry *entries, int *self);
+
+#endif
@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "server.h"
+#include "match_pool.h"
+
+_Static_assert(sizeof(MatchSession) <= 40, "a classic match (header + 2 x 40 byte boards) is meant to fit in 120 bytes");
+
+// todo: ================= HELPER FUNCTIONS ===================
+static MatchSession *slotAt(MatchPool *pool, unsigned int slot)
+{
+    return (MatchSession *)(pool->blocks[slot / MATCH_BLOCK_SIZE] + (slot % MATCH_BLOCK_SIZE) * pool->session_size);
+}
+
+static int growPool(MatchPool *pool)
+{
+    unsigned char *block = calloc(MATCH_BLOCK_SIZE, pool->session_size);
+    unsigned char **blocks = realloc(pool->blocks, sizeof(unsigned char *) * (pool->block_count + 1));
+    if (blocks)
+        pool->blocks = blocks;
+    if (!block || !blocks)
+    {
+        free(block);
+        return 0;
+    }
+
+    //* The free list must be able to hold every slot at once
+    int capacity = (pool->block_count + 1) * MATCH_BLOCK_SIZE;
+    if (capacity > pool->free_capacity)
+    {
+        unsigned int *free_slots = realloc(pool->free_slots, sizeof(unsigned int) * capacity);
+        if (!free_slots)
+        {
+            free(block);
+            return 0;
+        }
+        pool->free_slots = free_slots;
+        pool->free_capacity = capacity;
+    }
+
+    unsigned int first = pool->block_count * MATCH_BLOCK_SIZE;
+    pool->blocks[pool->block_count++] = block;
+    for (int i = MATCH_BLOCK_SIZE - 1; i >= 0; i--)
+    {
+        MatchSession *match = slotAt(pool, first + i);
+        match->slot = first + i;
+        match->generation = 1;
+        pool->free_slots[pool->free_count++] = first + i;
+    }
+    return 1;
+}
+
+// todo: ================= MATCH POOL =========================
+int matchPoolInit(MatchPool *pool, unsigned int variant, size_t session_size)
+{
+    memset(pool, 0, sizeof(MatchPool));
+    pool->variant = variant;
+    pool->session_size = session_size;
+    return intMapInit(&pool->by_id);
+}
+
+void matchPoolFree(MatchPool *pool)
+{
+    for (int i = 0; i < pool->block_count; i++)
+        free(pool->blocks[i]);
+    free(pool->blocks);
+    free(pool->free_slots);
+    intMapFree(&pool->by_id);
+    memset(pool, 0, sizeof(MatchPool));
+}
+
+MatchSession *matchPoolAlloc(MatchPool *pool, int match_id)
+{
+    if (pool->free_count == 0 && !growPool(pool))
+        return NULL;
+
+    MatchSession *match = slotAt(pool, pool->free_slots[pool->free_count - 1]);
+    if (!intMapPut(&pool->by_id, match_id, match))
+        return NULL;
+    pool->free_count--;
+
+    unsigned int slot = match->slot;
+    unsigned int generation = match->generation;
+    memset(match, 0, pool->session_size);
+    match->slot = slot;
+    match->generation = generation;
+    match->variant = (unsigned char)pool->variant;
+    match->match_id = match_id;
+    pool->count++;
+    return match;
+}
+
+void matchPoolRelease(MatchPool *pool, MatchSession *match)
+{
+    if (match->match_id == 0)
+        return; //* Already released
+
+    if (intMapGet(&pool->by_id, match->match_id) == match)
+        intMapRemove(&pool->by_id, match->match_id);
+
+    match->match_id = 0;
+    if (++match->generation == 0)
+        match->generation = 1; //* 0 is reserved for "no match"
+    pool->free_slots[pool->free_count++] = match->slot;
+    pool->count--;
+}
+
+MatchSession *matchPoolGet(MatchPool *pool, MatchHandle handle)
+{
+    if (handle.generation == 0 || handle.variant != pool->variant || handle.slot >= (unsigned int)pool->block_count * MATCH_BLOCK_SIZE)
+        return NULL;
+
+    MatchSession *match = slotAt(pool, handle.slot);
+    return (match->generation == handle.generation && match->match_id != 0) ? match : NULL;
+}
+
+MatchSession *matchPoolFind(MatchPool *pool, int match_id)
+{
+    return intMapGet(&pool->by_id, match_id);
+}
+
+MatchHandle matchHandleOf(const MatchSession *match)
+{
+    MatchHandle handle = {match->slot, match->generation, match->variant};
+    return handle;
+}
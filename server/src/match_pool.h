@@ -0,0 +1,61 @@
+#ifndef MATCH_POOL_H
+#define MATCH_POOL_H
+
+#include <stddef.h>
+
+#include "intmap.h"
+
+typedef struct MatchSession MatchSession; //* server.h
+
+//* Match sessions of one game variant on one shard, only touched by the shard's thread.
+//* A session is the MatchSession header followed by the two packed boards of the variant, so
+//* every pool has its own session size. Sessions live in blocks that are never moved or freed
+//* while the server runs; a released slot goes on a free list and its generation is bumped,
+//* so a MatchHandle taken before the release no longer resolves.
+
+#define MATCH_BLOCK_SIZE 1024 //* Sessions allocated at once when the pool runs dry
+
+typedef struct
+{
+    unsigned int slot;
+    unsigned int generation; //* 0 == no match
+    unsigned int variant;    //* Pool the session lives in
+} MatchHandle;
+
+typedef struct
+{
+    unsigned int variant; //* GameVariant of every session, copied into them and their handles
+    size_t session_size;  //* sizeof(MatchSession) + both packed boards
+    unsigned char **blocks;
+    int block_count;
+    unsigned int *free_slots;
+    int free_count;
+    int free_capacity;
+    IntMap by_id; //* match_id -> MatchSession
+    int count;    //* Sessions in use
+} MatchPool;
+
+/** Prepare an empty pool of sessions of session_size bytes (a multiple of 8)
+ * @return 1 == success, 0 == failed
+ */
+int matchPoolInit(MatchPool *pool, unsigned int variant, size_t session_size);
+
+void matchPoolFree(MatchPool *pool);
+
+/** Take a zeroed session and index it under match_id
+ * @return the session, NULL if out of memory
+ */
+MatchSession *matchPoolAlloc(MatchPool *pool, int match_id);
+
+/** Unindex a session and give its slot back, every handle to it goes stale */
+void matchPoolRelease(MatchPool *pool, MatchSession *match);
+
+/** @return the session the handle was taken from, NULL if it has been released since (or is from another pool) */
+MatchSession *matchPoolGet(MatchPool *pool, MatchHandle handle);
+
+/** @return the live session with match_id, NULL if none */
+MatchSession *matchPoolFind(MatchPool *pool, int match_id);
+
+MatchHandle matchHandleOf(const MatchSession *match);
+
+#endif
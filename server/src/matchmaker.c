@@ -0,0 +1,633 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "matchmaker.h"
+#include "intmap.h"
+#include "utils.h"
+
+#define BUCKET_WORDS (ELO_BUCKETS / 64)
+#define MATCH_BATCH 64 //* Pairs posted per lock hold
+
+_Static_assert(BUCKET_WORDS == 64, "the word summary is a single uint64_t");
+
+// todo: =============== TYPES DEFINITIONS =================
+typedef struct QueueEntry
+{
+    WaitingPlayer waiting;
+    int bucket;
+    struct QueueEntry *prev; //* Bucket FIFO, oldest first
+    struct QueueEntry *next;
+    struct QueueEntry *pending_prev; //* Not looked at by the matchmaker yet
+    struct QueueEntry *pending_next;
+    int pending;
+    long enqueued_ms; //* Monotonic time the player entered the queue
+    long retry_ms;    //* When the window may reach the nearest opponent
+    int heap_index;   //* Position in retry_heap, -1 == not scheduled
+} QueueEntry;
+
+typedef struct
+{
+    QueueEntry *head;
+    QueueEntry *tail;
+} Bucket;
+
+//* Players of one game variant, only ever paired with each other
+typedef struct
+{
+    Bucket buckets[ELO_BUCKETS];
+    uint64_t bucket_bits[BUCKET_WORDS]; //* Bit set == bucket not empty
+    uint64_t word_bits;                 //* Bit set == bucket_bits word not 0
+} EloQueue;
+
+typedef struct
+{
+    WaitingPlayer p1; //* Hosts the match
+    WaitingPlayer p2; //* Unset when bot_level >= 0
+    int bot_level;    //* AiLevel of the bot in seat 2 against p1, -1 == p2 is a player
+} MatchPair;
+
+// todo: ================ QUEUE STATE ======================
+//* Everything below is guarded by queue_lock
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond; //* CLOCK_MONOTONIC, set up by matchmakerInit()
+static EloQueue queues[GAME_VARIANT_COUNT]; //* By FleetLayout.variant
+static IntMap queued;                       //* user_id -> QueueEntry
+static QueueEntry *pending_head;
+static QueueEntry *pending_tail;
+static QueueEntry **retry_heap; //* Min-heap on retry_ms
+static int retry_count;
+static int retry_capacity;
+static MatchWindow match_window_cfg;
+static BotFallback bot_cfg;
+static MatchmakerStats stats;
+static uint32_t bot_seed = 2463534242u; //* Bot fleets, only used by the matchmaker thread
+
+const int stats_wait_bounds_ms[STATS_WAIT_BOUNDS] = {10, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000};
+const int stats_gap_bounds[STATS_GAP_BOUNDS] = {0, 25, 50, 100, 150, 200, 300, 400, 600, 800};
+
+// todo: ================= HELPER FUNCTIONS ===================
+static long nowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static int bucketOf(int elo)
+{
+    if (elo < 0)
+        return 0;
+    return elo < ELO_BUCKETS ? elo : ELO_BUCKETS - 1;
+}
+
+static EloQueue *queueOf(const QueueEntry *entry)
+{
+    return &queues[entry->waiting.fleet.variant];
+}
+
+// First non-empty bucket >= b, -1 if none
+static int nextBucket(const EloQueue *queue, int b)
+{
+    if (b >= ELO_BUCKETS)
+        return -1;
+
+    int w = b >> 6;
+    uint64_t bits = queue->bucket_bits[w] & (~0ULL << (b & 63));
+    if (bits)
+        return (w << 6) + __builtin_ctzll(bits);
+
+    uint64_t words = (w < BUCKET_WORDS - 1) ? queue->word_bits & (~0ULL << (w + 1)) : 0;
+    if (!words)
+        return -1;
+    w = __builtin_ctzll(words);
+    return (w << 6) + __builtin_ctzll(queue->bucket_bits[w]);
+}
+
+// Last non-empty bucket <= b, -1 if none
+static int prevBucket(const EloQueue *queue, int b)
+{
+    if (b < 0)
+        return -1;
+
+    int w = b >> 6;
+    uint64_t bits = queue->bucket_bits[w] & (~0ULL >> (63 - (b & 63)));
+    if (bits)
+        return (w << 6) + 63 - __builtin_clzll(bits);
+
+    uint64_t words = (w > 0) ? queue->word_bits & (~0ULL >> (64 - w)) : 0;
+    if (!words)
+        return -1;
+    w = 63 - __builtin_clzll(words);
+    return (w << 6) + 63 - __builtin_clzll(queue->bucket_bits[w]);
+}
+
+static void linkPending(QueueEntry *entry)
+{
+    entry->pending = 1;
+    entry->pending_next = NULL;
+    entry->pending_prev = pending_tail;
+    if (pending_tail)
+        pending_tail->pending_next = entry;
+    else
+        pending_head = entry;
+    pending_tail = entry;
+}
+
+static void unlinkPending(QueueEntry *entry)
+{
+    if (!entry->pending)
+        return;
+    if (entry->pending_prev)
+        entry->pending_prev->pending_next = entry->pending_next;
+    else
+        pending_head = entry->pending_next;
+    if (entry->pending_next)
+        entry->pending_next->pending_prev = entry->pending_prev;
+    else
+        pending_tail = entry->pending_prev;
+    entry->pending = 0;
+}
+
+static void heapSet(int i, QueueEntry *entry)
+{
+    retry_heap[i] = entry;
+    entry->heap_index = i;
+}
+
+static void siftUp(int i)
+{
+    QueueEntry *entry = retry_heap[i];
+    while (i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if (retry_heap[parent]->retry_ms <= entry->retry_ms)
+            break;
+        heapSet(i, retry_heap[parent]);
+        i = parent;
+    }
+    heapSet(i, entry);
+}
+
+static void siftDown(int i)
+{
+    QueueEntry *entry = retry_heap[i];
+    while (1)
+    {
+        int child = 2 * i + 1;
+        if (child >= retry_count)
+            break;
+        if (child + 1 < retry_count && retry_heap[child + 1]->retry_ms < retry_heap[child]->retry_ms)
+            child++;
+        if (entry->retry_ms <= retry_heap[child]->retry_ms)
+            break;
+        heapSet(i, retry_heap[child]);
+        i = child;
+    }
+    heapSet(i, entry);
+}
+
+static void unschedule(QueueEntry *entry)
+{
+    int i = entry->heap_index;
+    if (i < 0)
+        return;
+    entry->heap_index = -1;
+
+    QueueEntry *last = retry_heap[--retry_count];
+    if (i == retry_count)
+        return;
+    heapSet(i, last);
+    siftUp(i);
+    siftDown(last->heap_index);
+}
+
+// Look at the entry again at retry_ms (replaces an earlier schedule)
+static void schedule(QueueEntry *entry, long retry_ms)
+{
+    unschedule(entry);
+    if (retry_count == retry_capacity)
+    {
+        int capacity = retry_capacity ? retry_capacity * 2 : 1024;
+        QueueEntry **heap = realloc(retry_heap, sizeof(QueueEntry *) * capacity);
+        if (!heap)
+            return; //* Still matched by the next compatible newcomer
+        retry_heap = heap;
+        retry_capacity = capacity;
+    }
+
+    entry->retry_ms = retry_ms;
+    heapSet(retry_count++, entry);
+    siftUp(entry->heap_index);
+}
+
+static int statsBand(int elo)
+{
+    int band = (elo - STATS_ELO_BAND_MIN) / STATS_ELO_BAND_WIDTH + 1;
+    if (elo < STATS_ELO_BAND_MIN || band < 0)
+        return 0;
+    return band < STATS_ELO_BANDS ? band : STATS_ELO_BANDS - 1;
+}
+
+static int histBucket(const int *bounds, int count, long value)
+{
+    int i = 0;
+    while (i < count && value > bounds[i])
+        i++;
+    return i;
+}
+
+static void recordMatch(QueueEntry *a, QueueEntry *b, long now)
+{
+    int gap = abs(a->waiting.player.elo - b->waiting.player.elo);
+    QueueEntry *sides[2] = {a, b};
+
+    stats.matches++;
+    for (int i = 0; i < 2; i++)
+    {
+        int band = statsBand(sides[i]->waiting.player.elo);
+        stats.wait_hist[band][histBucket(stats_wait_bounds_ms, STATS_WAIT_BOUNDS, now - sides[i]->enqueued_ms)]++;
+        stats.gap_hist[band][histBucket(stats_gap_bounds, STATS_GAP_BOUNDS, gap)]++;
+    }
+}
+
+static void recordBotMatch(QueueEntry *entry, int bot_elo, long now)
+{
+    int band = statsBand(entry->waiting.player.elo);
+    stats.bot_matches++;
+    stats.wait_hist[band][histBucket(stats_wait_bounds_ms, STATS_WAIT_BOUNDS, now - entry->enqueued_ms)]++;
+    stats.gap_hist[band][histBucket(stats_gap_bounds, STATS_GAP_BOUNDS, abs(entry->waiting.player.elo - bot_elo))]++;
+}
+
+// Bot level for a player: the configured one, or the one rated closest
+static int botLevelFor(int elo)
+{
+    if (bot_cfg.level >= 0)
+        return bot_cfg.level;
+
+    int best = 0;
+    for (int i = 1; i < AI_LEVEL_COUNT; i++)
+    {
+        if (abs(bot_cfg.elo[i] - elo) < abs(bot_cfg.elo[best] - elo))
+            best = i;
+    }
+    return best;
+}
+
+static void insertEntry(QueueEntry *entry)
+{
+    EloQueue *queue = queueOf(entry);
+    Bucket *bucket = &queue->buckets[entry->bucket];
+    entry->next = NULL;
+    entry->prev = bucket->tail;
+    if (bucket->tail)
+        bucket->tail->next = entry;
+    else
+        bucket->head = entry;
+    bucket->tail = entry;
+
+    queue->bucket_bits[entry->bucket >> 6] |= 1ULL << (entry->bucket & 63);
+    queue->word_bits |= 1ULL << (entry->bucket >> 6);
+}
+
+// Unlink an entry from every list and the index, the caller frees it
+static void removeEntry(QueueEntry *entry)
+{
+    EloQueue *queue = queueOf(entry);
+    Bucket *bucket = &queue->buckets[entry->bucket];
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        bucket->head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        bucket->tail = entry->prev;
+
+    if (!bucket->head)
+    {
+        int w = entry->bucket >> 6;
+        queue->bucket_bits[w] &= ~(1ULL << (entry->bucket & 63));
+        if (!queue->bucket_bits[w])
+            queue->word_bits &= ~(1ULL << w);
+    }
+
+    unlinkPending(entry);
+    unschedule(entry);
+    intMapRemove(&queued, entry->waiting.player.user_id);
+}
+
+/** Nearest compatible opponent of entry: the oldest player of the closest non-empty bucket
+ * below, at or above its own, in the queue of its variant. Looks at three buckets, whatever the queue length. A pair is
+ * compatible when its gap fits the wider of the two windows, so a long wait on either side helps.
+ * @param retry_ms set to when the closest candidate may come into range, -1 if it never will
+ * @return the opponent, NULL if nobody is in range yet
+ */
+static QueueEntry *findOpponent(QueueEntry *entry, long now, long *retry_ms)
+{
+    int elo = entry->waiting.player.elo;
+    int window = match_window(&match_window_cfg, now - entry->enqueued_ms);
+    QueueEntry *candidates[3];
+
+    const EloQueue *queue = queueOf(entry);
+    QueueEntry *same = queue->buckets[entry->bucket].head;
+    candidates[0] = (same == entry) ? entry->next : same;
+    int below = prevBucket(queue, entry->bucket - 1);
+    candidates[1] = (below >= 0) ? queue->buckets[below].head : NULL;
+    int above = nextBucket(queue, entry->bucket + 1);
+    candidates[2] = (above >= 0) ? queue->buckets[above].head : NULL;
+
+    QueueEntry *best = NULL;
+    int best_diff = 0;
+    *retry_ms = -1;
+    for (int i = 0; i < 3; i++)
+    {
+        QueueEntry *candidate = candidates[i];
+        if (!candidate)
+            continue;
+
+        int diff = abs(candidate->waiting.player.elo - elo);
+        int candidate_window = match_window(&match_window_cfg, now - candidate->enqueued_ms);
+
+        // todo: Check elo 2 players (diff within the widest window -> OK)
+        if (can_match(elo, candidate->waiting.player.elo, window > candidate_window ? window : candidate_window))
+        {
+            if (!best || diff < best_diff)
+            {
+                best = candidate;
+                best_diff = diff;
+            }
+            continue;
+        }
+
+        //* The side that has waited longer is the first whose window covers the gap
+        long wait = match_window_wait(&match_window_cfg, diff);
+        if (wait < 0)
+            continue;
+        long oldest = (candidate->enqueued_ms < entry->enqueued_ms) ? candidate->enqueued_ms : entry->enqueued_ms;
+        if (*retry_ms < 0 || oldest + wait < *retry_ms)
+            *retry_ms = oldest + wait;
+    }
+    return best;
+}
+
+// Hand a player over to its own shard with a bot as player 2 (runs without queue_lock)
+static void postBotMatch(MatchPair *pair)
+{
+    Player *p1 = &pair->p1.player;
+    int level = pair->bot_level;
+
+    ShardCommand *create = calloc(1, sizeof(ShardCommand));
+    if (!create || !ai_random_fleet((GameVariant)pair->p1.fleet.variant, &bot_seed, &create->fleet_2))
+    {
+        free(create);
+        enqueuePlayer(*p1, pair->p1.fleet); //* Try again later
+        return;
+    }
+
+    create->type = CMD_MATCH_CREATE;
+    create->player_1 = *p1;
+    create->fleet_1 = pair->p1.fleet;
+    create->vs_bot = 1;
+    create->bot_level = level;
+    Player *bot = &create->player_2;
+    bot->socket_fd = -1; //* No connection, never found in a connection table
+    bot->shard_id = p1->shard_id;
+    bot->user_id = bot_cfg.user_id[level];
+    bot->elo = bot_cfg.elo[level];
+    snprintf(bot->username, sizeof(bot->username), "%s", bot_cfg.username[level]);
+    printf("New match: %s vs bot %s (ELO %d vs %d)\n", p1->username, bot->username, p1->elo, bot->elo);
+
+    shardPost(&shards[p1->shard_id], create);
+}
+
+// Hand a pair over to the shards (runs without queue_lock)
+static void postMatch(MatchPair *pair)
+{
+    if (pair->bot_level >= 0)
+    {
+        postBotMatch(pair);
+        return;
+    }
+
+    Player *p1 = &pair->p1.player;
+    Player *p2 = &pair->p2.player;
+
+    //* The match is pinned to player 1's shard, player 2's connection moves there
+    ShardCommand *create = calloc(1, sizeof(ShardCommand));
+    ShardCommand *migrate = (p2->shard_id != p1->shard_id) ? calloc(1, sizeof(ShardCommand)) : NULL;
+    if (!create || (p2->shard_id != p1->shard_id && !migrate))
+    {
+        free(create);
+        free(migrate);
+        enqueuePlayer(*p1, pair->p1.fleet); //* Try again later
+        enqueuePlayer(*p2, pair->p2.fleet);
+        return;
+    }
+
+    create->type = CMD_MATCH_CREATE;
+    create->player_1 = *p1;
+    create->player_2 = *p2;
+    create->fleet_1 = pair->p1.fleet;
+    create->fleet_2 = pair->p2.fleet;
+    printf("New match: %s vs %s (ELO %d vs %d)\n", p1->username, p2->username, p1->elo, p2->elo);
+
+    //! CMD_MATCH_CREATE must be queued before the CMD_ADOPT that the migration produces
+    shardPost(&shards[p1->shard_id], create);
+    if (migrate)
+    {
+        migrate->type = CMD_MIGRATE;
+        migrate->target_shard = p1->shard_id;
+        migrate->player_1 = *p2;
+        migrate->fleet_1 = pair->p2.fleet;
+        shardPost(&shards[p2->shard_id], migrate);
+    }
+}
+
+// todo: ================= QUEUE FUNCTION ======================
+int matchmakerInit(const MatchWindow *window, const BotFallback *bots)
+{
+    pthread_condattr_t attr;
+    match_window_cfg = *window;
+    bot_cfg = *bots;
+
+    //* Timed waits for widening windows must not jump with the wall clock
+    if (pthread_condattr_init(&attr) != 0 ||
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) != 0 ||
+        pthread_cond_init(&queue_cond, &attr) != 0)
+        return 0;
+    pthread_condattr_destroy(&attr);
+
+    return intMapInit(&queued);
+}
+
+int parseBotFallback(const char *spec, BotFallback *bots)
+{
+    long after_s = 0;
+    char level[16] = "";
+    int n = 0, m = 0;
+
+    int fields = sscanf(spec, "%ld%n,%15[a-z]%n", &after_s, &n, level, &m);
+    if (!((fields == 1 && spec[n] == '\0') || (fields == 2 && spec[m] == '\0')))
+        return 0;
+    if (after_s < 0 || after_s > 24L * 3600)
+        return 0;
+
+    int parsed = -1;
+    if (fields == 2 && strcmp(level, "auto") != 0 && (parsed = ai_find_level(level)) < 0)
+        return 0;
+
+    bots->after_ms = after_s * 1000;
+    bots->level = parsed;
+    return 1;
+}
+
+int enqueuePlayer(Player p, FleetLayout fleet)
+{
+    QueueEntry *entry = (fleet.variant < GAME_VARIANT_COUNT) ? malloc(sizeof(QueueEntry)) : NULL;
+    if (!entry)
+        return 0;
+    entry->waiting.player = p;
+    entry->waiting.fleet = fleet;
+    entry->bucket = bucketOf(p.elo);
+    entry->enqueued_ms = nowMs();
+    entry->heap_index = -1;
+
+    pthread_mutex_lock(&queue_lock);
+    if (intMapGet(&queued, p.user_id) || !intMapPut(&queued, p.user_id, entry))
+    {
+        pthread_mutex_unlock(&queue_lock);
+        free(entry);
+        return 0;
+    }
+    insertEntry(entry);
+    linkPending(entry);
+    stats.queued++;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+    return 1;
+}
+
+int dequeuePlayer(int user_id)
+{
+    pthread_mutex_lock(&queue_lock);
+    QueueEntry *entry = intMapGet(&queued, user_id);
+    if (entry)
+    {
+        removeEntry(entry);
+        stats.queued--;
+    }
+    pthread_mutex_unlock(&queue_lock);
+
+    free(entry);
+    return entry != NULL;
+}
+
+void matchmakerGetStats(MatchmakerStats *out)
+{
+    pthread_mutex_lock(&queue_lock);
+    *out = stats;
+    out->window = match_window_cfg;
+    pthread_mutex_unlock(&queue_lock);
+}
+
+// todo: ================= MATCHMAKING THREAD ===================
+// Wait until there is a newcomer or the earliest retry is due
+static void waitForWork(void)
+{
+    while (!pending_head)
+    {
+        if (retry_count == 0)
+        {
+            pthread_cond_wait(&queue_cond, &queue_lock);
+            continue;
+        }
+
+        long due = retry_heap[0]->retry_ms;
+        if (due <= nowMs())
+            return;
+
+        struct timespec ts;
+        ts.tv_sec = due / 1000;
+        ts.tv_nsec = (due % 1000) * 1000000L;
+        pthread_cond_timedwait(&queue_cond, &queue_lock, &ts);
+    }
+}
+
+void *matchmaking_thread(void *arg)
+{
+    static MatchPair batch[MATCH_BATCH];
+
+    while (1)
+    {
+        pthread_mutex_lock(&queue_lock);
+        waitForWork();
+
+        //* Waiting players were checked against each other already: only newcomers, and players
+        //* whose window has grown enough to reach their nearest opponent, need a search
+        long now = nowMs();
+        int count = 0;
+        while (count < MATCH_BATCH)
+        {
+            QueueEntry *entry;
+            if (pending_head)
+            {
+                entry = pending_head;
+                unlinkPending(entry);
+            }
+            else if (retry_count > 0 && retry_heap[0]->retry_ms <= now)
+            {
+                entry = retry_heap[0];
+                unschedule(entry);
+            }
+            else
+                break;
+
+            long retry_ms;
+            QueueEntry *opponent = findOpponent(entry, now, &retry_ms);
+            if (!opponent)
+            {
+                long bot_ms = bot_cfg.after_ms > 0 ? entry->enqueued_ms + bot_cfg.after_ms : -1;
+                if (bot_ms >= 0 && bot_ms <= now)
+                {
+                    //* Nobody came in time: a bot plays the player on its own shard
+                    batch[count].p1 = entry->waiting;
+                    batch[count].bot_level = botLevelFor(entry->waiting.player.elo);
+                    recordBotMatch(entry, bot_cfg.elo[batch[count].bot_level], now);
+                    removeEntry(entry);
+                    free(entry);
+                    stats.queued--;
+                    count++;
+                    continue;
+                }
+
+                if (bot_ms >= 0 && (retry_ms < 0 || bot_ms < retry_ms))
+                    retry_ms = bot_ms;
+                if (retry_ms >= 0)
+                    schedule(entry, retry_ms > now ? retry_ms : now + 1);
+                continue; //* Otherwise waits for a compatible newcomer
+            }
+
+            recordMatch(entry, opponent, now);
+            batch[count].p1 = opponent->waiting; //* Longest waiting side hosts the match
+            batch[count].p2 = entry->waiting;
+            batch[count].bot_level = -1;
+            removeEntry(opponent);
+            removeEntry(entry);
+            free(opponent);
+            free(entry);
+            stats.queued -= 2;
+            count++;
+        }
+        pthread_mutex_unlock(&queue_lock);
+
+        //* Allocation and cross-shard posts happen outside the lock; the match row is
+        //* created and the players notified by the hosting shard
+        for (int i = 0; i < count; i++)
+            postMatch(&batch[i]);
+    }
+    return NULL;
+}
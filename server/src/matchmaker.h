@@ -0,0 +1,77 @@
+#ifndef MATCHMAKER_H
+#define MATCHMAKER_H
+
+#include "server.h"
+#include "utils.h"
+#include "ai.h"
+
+//* Matchmaking queue shared by every shard. Waiting players are kept apart by game variant,
+//* then in per-Elo buckets with a two-level occupancy bitmap, so the nearest opponent of a player is found without
+//* scanning the queue. The matchmaker thread sleeps until a player is enqueued or until the
+//* widening window of a waiting player reaches its nearest opponent. A player nobody came for
+//* within the bot fallback wait is paired with a bot instead.
+
+#define ELO_BUCKETS 4096 //* One bucket per Elo point, ratings outside [0, ELO_BUCKETS) share the edge buckets
+
+//* Stats: every matched player adds one time-to-match and one Elo gap sample to the band of its rating
+#define STATS_ELO_BANDS 8   //* < 800, 800-999, ..., 1800-1999, >= 2000
+#define STATS_ELO_BAND_MIN 800
+#define STATS_ELO_BAND_WIDTH 200
+#define STATS_WAIT_BOUNDS 11 //* Histogram upper bounds, one more bucket counts everything above the last
+#define STATS_GAP_BOUNDS 10
+
+extern const int stats_wait_bounds_ms[STATS_WAIT_BOUNDS];
+extern const int stats_gap_bounds[STATS_GAP_BOUNDS];
+
+//* Bot opponents for players left waiting (-b), the accounts are set up by main before the thread starts
+typedef struct
+{
+    long after_ms; //* Wait before a player is paired with a bot, 0 == never
+    int level;     //* AiLevel of the bot, -1 == the level whose rating is closest to the player's
+    int user_id[AI_LEVEL_COUNT];
+    char username[AI_LEVEL_COUNT][64];
+    int elo[AI_LEVEL_COUNT]; //* Fixed, a bot's rating never changes
+} BotFallback;
+
+typedef struct
+{
+    long matches;     //* Pairs formed since start
+    long bot_matches; //* Players paired with a bot since start (not in matches)
+    int queued;       //* Players waiting right now
+    MatchWindow window;
+    long wait_hist[STATS_ELO_BANDS][STATS_WAIT_BOUNDS + 1]; //* Time-to-match in ms (bucket i: <= stats_wait_bounds_ms[i])
+    long gap_hist[STATS_ELO_BANDS][STATS_GAP_BOUNDS + 1];   //* |Elo difference| at match time
+} MatchmakerStats;
+
+/** Set up the queue
+ * @param window match window settings (copied)
+ * @param bots bot fallback settings (copied)
+ * @return 1 == success, 0 == failed
+ */
+int matchmakerInit(const MatchWindow *window, const BotFallback *bots);
+
+/** Parse "after_s[,easy|medium|hard|auto]" into the wait and level of bots (accounts untouched)
+ * @return 1 == success, 0 == invalid spec
+ */
+int parseBotFallback(const char *spec, BotFallback *bots);
+
+/** Add a player to the queue and wake the matchmaker
+ * @return 1 == queued, 0 == already queued or out of memory
+ */
+int enqueuePlayer(Player p, FleetLayout fleet);
+
+/** Remove a player from the queue
+ * @return 1 == removed, 0 == was not queued
+ */
+int dequeuePlayer(int user_id);
+
+/** Copy the current matchmaking stats (any thread) */
+void matchmakerGetStats(MatchmakerStats *stats);
+
+/** Matchmaker thread: pairs newly queued players with their nearest compatible opponent,
+ * retries waiting players as their windows widen, falls back to a bot once they waited too long,
+ * and posts the matches to the shards (never returns)
+ */
+void *matchmaking_thread(void *arg);
+
+#endif
@@ -1,18 +1,35 @@
 #include <stdlib.h>
-#include <sys/types.h>
-#include <sys/socket.h>
 #include <string.h>
 #include "response.h"
+#include "transport.h"
+#include "server.h"
 #include "cJSON.h"
 
 // todo: ================= RESPONSE HELPER FUNCTION ====================
 
 int sendResponse(int sock_fd, cJSON *response)
 {
-    char *str = cJSON_PrintUnformatted(response);  // Convert JSON to string
-    int sent = send(sock_fd, str, strlen(str), 0); // Send JSON to client
-    free(str);                                     // Free allocated memory
-    return sent;                                   // Return number of bytes sent (or -1 on error)
+    char *str = cJSON_PrintUnformatted(response); // Convert JSON to string
+    if (!str)
+        return -1;
+    size_t len = strlen(str);
+
+    if (getConnectionFraming(sock_fd) == FRAMING_NDJSON) // Negotiated clients get one response per line
+    {
+        char *line = realloc(str, len + 2);
+        if (!line)
+        {
+            free(str);
+            return -1;
+        }
+        str = line;
+        str[len++] = '\n';
+        str[len] = '\0';
+    }
+
+    int sent = transportSend(sock_fd, str, len); // Send JSON through the shard's reactor backend
+    free(str);                                   // Free allocated memory
+    return sent;                                 // Return number of bytes sent (or -1 on error)
 }
 
 int sendError(int sock_fd, const char *message)
@@ -52,7 +69,7 @@ int sendLoginResult(int sock_fd, int user_id, const char *username, int elo)
     return 1;
 }
 
-int sendNotifyMatchFound(int sock_fd, int match_id, char *player_1_username, char *player_2_username, int first_turn)
+int sendNotifyMatchFound(int sock_fd, int match_id, char *player_1_username, char *player_2_username, int first_turn, const char *variant)
 {
     cJSON *msg = cJSON_CreateObject();
     cJSON_AddStringToObject(msg, "type", "MATCH_FOUND");
@@ -60,6 +77,7 @@ int sendNotifyMatchFound(int sock_fd, int match_id, char *player_1_username, cha
     cJSON_AddStringToObject(msg, "player1", player_1_username);
     cJSON_AddStringToObject(msg, "player2", player_2_username);
     cJSON_AddNumberToObject(msg, "first_turn", first_turn);
+    cJSON_AddStringToObject(msg, "variant", variant);
 
     sendResponse(sock_fd, msg);
 
@@ -94,4 +112,129 @@ int sendMatchResult(int socket_fd, int match_id, const char *result, int new_elo
     sendResponse(socket_fd, msg);
     cJSON_Delete(msg);
     return 1;
-}
\ No newline at end of file
+}
+int sendHistory(int socket_fd, const char *username, const Match *matches, const MatchPlayers *players, int count, int next_cursor)
+{
+    cJSON *msg = cJSON_CreateObject();
+    cJSON_AddStringToObject(msg, "type", "HISTORY_RES");
+    cJSON_AddStringToObject(msg, "username", username);
+
+    cJSON *list = cJSON_AddArrayToObject(msg, "matches");
+    for (int i = 0; i < count; i++)
+    {
+        cJSON *match = cJSON_CreateObject();
+        cJSON_AddNumberToObject(match, "match_id", matches[i].id);
+        cJSON_AddStringToObject(match, "player1", players[i].player1);
+        cJSON_AddStringToObject(match, "player2", players[i].player2);
+        cJSON_AddStringToObject(match, "result", matches[i].result);
+        cJSON_AddItemToArray(list, match);
+    }
+    cJSON_AddNumberToObject(msg, "next_cursor", next_cursor); // 0 == no more pages
+
+    sendResponse(socket_fd, msg);
+    cJSON_Delete(msg);
+    return 1;
+}
+
+int sendLeaderboard(int socket_fd, const char *top_json, int total, const LeaderboardEntry *around, int count, int self)
+{
+    cJSON *msg = cJSON_CreateObject();
+    cJSON_AddStringToObject(msg, "type", "LEADERBOARD_RES");
+    cJSON_AddNumberToObject(msg, "total", total);
+    cJSON_AddRawToObject(msg, "top", top_json ? top_json : "[]"); // Already serialized, shared by every request
+
+    if (count > 0) // Only when the asked user is ranked
+    {
+        cJSON_AddStringToObject(msg, "username", around[self].username);
+        cJSON_AddNumberToObject(msg, "rank", around[self].rank);
+        cJSON_AddNumberToObject(msg, "elo", around[self].elo);
+
+        cJSON *list = cJSON_AddArrayToObject(msg, "neighbours");
+        for (int i = 0; i < count; i++)
+        {
+            cJSON *entry = cJSON_CreateObject();
+            cJSON_AddNumberToObject(entry, "rank", around[i].rank);
+            cJSON_AddStringToObject(entry, "username", around[i].username);
+            cJSON_AddNumberToObject(entry, "elo", around[i].elo);
+            cJSON_AddItemToArray(list, entry);
+        }
+    }
+
+    sendResponse(socket_fd, msg);
+    cJSON_Delete(msg);
+    return 1;
+}
+
+int sendStats(int socket_fd, const MatchmakerStats *stats, const DbWriterStats *db_stats, const UserCacheStats *cache_stats)
+{
+    static const char *curves[] = {"linear", "quadratic", "sqrt"};
+    static const char *levels[] = {"off", "normal", "full"};
+    cJSON *msg = cJSON_CreateObject();
+    cJSON_AddStringToObject(msg, "type", "STATS_RES");
+    cJSON_AddNumberToObject(msg, "queued", stats->queued);
+    cJSON_AddNumberToObject(msg, "matches", stats->matches);
+    cJSON_AddNumberToObject(msg, "bot_matches", stats->bot_matches);
+
+    cJSON *window = cJSON_AddObjectToObject(msg, "window");
+    cJSON_AddNumberToObject(window, "base", stats->window.base);
+    cJSON_AddNumberToObject(window, "rate", stats->window.rate);
+    cJSON_AddNumberToObject(window, "cap", stats->window.cap);
+    cJSON_AddStringToObject(window, "curve", curves[stats->window.curve]);
+
+    // Histogram bucket i counts samples <= bounds[i], the extra last bucket counts the rest
+    cJSON_AddItemToObject(msg, "wait_ms_bounds", cJSON_CreateIntArray(stats_wait_bounds_ms, STATS_WAIT_BOUNDS));
+    cJSON_AddItemToObject(msg, "elo_gap_bounds", cJSON_CreateIntArray(stats_gap_bounds, STATS_GAP_BOUNDS));
+
+    cJSON *bands = cJSON_AddArrayToObject(msg, "bands");
+    for (int i = 0; i < STATS_ELO_BANDS; i++)
+    {
+        cJSON *band = cJSON_CreateObject();
+        int elo_from = (i == 0) ? 0 : STATS_ELO_BAND_MIN + (i - 1) * STATS_ELO_BAND_WIDTH;
+        cJSON_AddNumberToObject(band, "elo_from", elo_from);
+        if (i < STATS_ELO_BANDS - 1)
+            cJSON_AddNumberToObject(band, "elo_to", STATS_ELO_BAND_MIN + i * STATS_ELO_BAND_WIDTH - 1);
+
+        cJSON *wait = cJSON_AddArrayToObject(band, "wait_ms");
+        for (int j = 0; j <= STATS_WAIT_BOUNDS; j++)
+            cJSON_AddItemToArray(wait, cJSON_CreateNumber(stats->wait_hist[i][j]));
+        cJSON *gap = cJSON_AddArrayToObject(band, "elo_gap");
+        for (int j = 0; j <= STATS_GAP_BOUNDS; j++)
+            cJSON_AddItemToArray(gap, cJSON_CreateNumber(stats->gap_hist[i][j]));
+        cJSON_AddItemToArray(bands, band);
+    }
+
+    // Write-behind database thread
+    cJSON *db = cJSON_AddObjectToObject(msg, "db");
+    cJSON_AddStringToObject(db, "synchronous", levels[db_stats->durability.synchronous]);
+    cJSON_AddNumberToObject(db, "commit_window_ms", db_stats->durability.window_ms);
+    cJSON_AddNumberToObject(db, "commit_max_batch", db_stats->durability.max_batch);
+    cJSON_AddNumberToObject(db, "submitted", db_stats->submitted);
+    cJSON_AddNumberToObject(db, "committed", db_stats->committed);
+    cJSON_AddNumberToObject(db, "failed", db_stats->failed);
+    cJSON_AddNumberToObject(db, "queued", db_stats->depth);
+    cJSON_AddNumberToObject(db, "max_queued", db_stats->max_depth);
+    cJSON_AddNumberToObject(db, "stalls", db_stats->stalls);
+    cJSON_AddNumberToObject(db, "transactions", db_stats->batches);
+    cJSON_AddNumberToObject(db, "max_batch", db_stats->max_batch);
+    cJSON_AddNumberToObject(db, "avg_commit_us", db_stats->batches ? db_stats->commit_us_total / db_stats->batches : 0);
+    cJSON_AddNumberToObject(db, "max_commit_us", db_stats->commit_us_max);
+    cJSON_AddNumberToObject(db, "max_lag_us", db_stats->lag_us_max);
+    cJSON_AddNumberToObject(db, "archive_after_s", db_stats->retention.max_age_s);
+    cJSON_AddNumberToObject(db, "archived_matches", db_stats->archived);
+    cJSON_AddNumberToObject(db, "max_archive_us", db_stats->archive_us_max);
+
+    // User cache in front of db_get_user
+    cJSON *cache = cJSON_AddObjectToObject(msg, "user_cache");
+    cJSON_AddNumberToObject(cache, "capacity", cache_stats->capacity);
+    cJSON_AddNumberToObject(cache, "size", cache_stats->size);
+    cJSON_AddNumberToObject(cache, "hits", cache_stats->hits);
+    cJSON_AddNumberToObject(cache, "misses", cache_stats->misses);
+    cJSON_AddNumberToObject(cache, "evictions", cache_stats->evictions);
+    cJSON_AddNumberToObject(cache, "invalidations", cache_stats->invalidations);
+    cJSON_AddNumberToObject(cache, "name_hits", cache_stats->name_hits);
+    cJSON_AddNumberToObject(cache, "name_misses", cache_stats->name_misses);
+
+    sendResponse(socket_fd, msg);
+    cJSON_Delete(msg);
+    return 1;
+}
@@ -1,6 +1,10 @@
 #ifndef RESPONSE_H
 #define RESPONSE_H
 #include "cJSON.h"
+#include "matchmaker.h"
+#include "db_writer.h"
+#include "user_cache.h"
+#include "leaderboard.h"
 
 int sendResponse(int sock_fd, cJSON *response);
 int sendError(int sock_fd, const char *message);
@@ -8,8 +12,11 @@ int sendResult(int sock_fd, const char *type, const int result, const char *mess
 
 int sendLoginResult(int sock_fd, int user_id, const char *username, int elo);
 
-int sendNotifyMatchFound(int sock_fd, int match_id, char *player_1_username, char *player_2_username, int first_turn);
+int sendNotifyMatchFound(int sock_fd, int match_id, char *player_1_username, char *player_2_username, int first_turn, const char *variant);
 int sendMoveResult(int socket_fd, int match_id, char *attacker_username, int row, int col, const char *result, int next_turn_user_id);
 int sendMatchResult(int socket_fd, int match_id, const char *result, int elo_change);
+int sendHistory(int socket_fd, const char *username, const Match *matches, const MatchPlayers *players, int count, int next_cursor);
+int sendStats(int socket_fd, const MatchmakerStats *stats, const DbWriterStats *db_stats, const UserCacheStats *cache_stats);
+int sendLeaderboard(int socket_fd, const char *top_json, int total, const LeaderboardEntry *around, int count, int self);
 
 #endif
\ No newline at end of file
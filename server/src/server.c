@@ -1,196 +1,294 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <ctype.h>
+#include <sched.h>
 #include <arpa/inet.h>
-#include <sys/select.h>
-#include <poll.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <pthread.h>
 #include <sys/socket.h>
 #include <openssl/sha.h> // TODO: SHA256 for password hashing
 #include <sqlite3.h>     // TODO: SQLite for user storage
 #include "cJSON.h"       // TODO: JSON parsing/serialization
 
+#include "server.h"
+#include "transport.h"
 #include "database.h"
 #include "game.h"
 #include "utils.h"
 #include "response.h"
-
-pthread_mutex_t connections_lock = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t match_lock = PTHREAD_MUTEX_INITIALIZER;
-
-#define PORT 8080
-#define BUFFER_SIZE 1024
-#define MAX_CLIENTS 100
-#define MAX_MATCHES_NUM 50
-// todo: =============== TYPES DEFINITIONS =================
-typedef struct
-{
-    //* CLIENT SOCKET information
-    int socket_fd;
-    struct sockaddr_in addr;
-    //* Status
-    int in_game;
-    int is_login;
-    int in_queue;
-    //* User information
-    int user_id;
-    char username[64];
-    int elo;
-} Player;
-
-typedef struct
-{
-    Player player;
-    BoardState board;
-} WaitingPlayer;
-
-typedef struct
-{
-    int match_id;
-    Player player_1;
-    Player player_2;
-    BoardState board_p1;
-    BoardState board_p2;
-    int current_turn;
-} MatchSession;
-
-// todo: ================ DATABASE =============================
-Database db;
-
-// todo: ================ LISTS & QUEUES =======================
-Player connectedPlayers[MAX_CLIENTS];
-WaitingPlayer queuePlayer[MAX_CLIENTS];
-MatchSession matchSessionList[MAX_MATCHES_NUM];
+#include "matchmaker.h"
+#include "db_writer.h"
+#include "user_cache.h"
+#include "leaderboard.h"
+#include "ai.h"
+
+// todo: ================ SHARDS ===============================
+Shard *shards;
+int shard_count;
+int max_clients = DEFAULT_MAX_CLIENTS;
+static int connection_count; //* Open connections across all shards (atomic)
+static DbDurability durability = {DB_SYNC_NORMAL, 5, 512}; //* fsync at checkpoints, 5 ms group commit window
+static DbRetention retention = {30L * 24 * 3600, 32};      //* Archive the moves of matches older than 30 days, 32 per transaction
+static BotFallback bots = {.after_ms = 0, .level = -1};      //* No bots unless -b
+static const int bot_elo[AI_LEVEL_COUNT] = {800, 1100, 1400}; //* Fixed ratings of bot_easy, bot_medium, bot_hard
+__thread Shard *current_shard; //* Shard owned by the calling reactor thread
 
 // todo: ================= HELPER FUNCITONS =====================
 
 // Find player by socket_fd, return pointer to allow modification
 Player *getPlayerBySockFd(int socket_fd)
 {
-    for (int i = 0; i < MAX_CLIENTS; i++)
-    {
-        if (connectedPlayers[i].socket_fd == socket_fd)
-            return &connectedPlayers[i];
-    }
-    return NULL;
+    return connTableGetByFd(&current_shard->connections, socket_fd);
 }
 
-// Find player by user_id
+Framing getConnectionFraming(int socket_fd)
+{
+    Player *player = getPlayerBySockFd(socket_fd);
+    return player ? player->framing : FRAMING_AUTO;
+}
+
+// Find a logged in player of the current shard by user_id
 Player *getPlayerByUserId(int user_id)
 {
-    for (int i = 0; i < MAX_CLIENTS; i++)
+    return connTableGetByUserId(&current_shard->connections, user_id);
+}
+
+// Local connection of a player copy (queue entry, match side), NULL if it disconnected in the meantime
+Player *getPairedPlayer(Player *p)
+{
+    Player *player = getPlayerByUserId(p->user_id);
+    return (player && player->socket_fd == p->socket_fd) ? player : NULL;
+}
+
+// Take a slot in the current shard's connection table for socket_fd
+Player *addConnectedPlayer(int socket_fd)
+{
+    return connTableAdd(&current_shard->connections, socket_fd);
+}
+
+// Give the slot back, the Player is zeroed
+void removeConnectedPlayer(Player *player)
+{
+    connTableRemove(&current_shard->connections, player);
+}
+
+/** Count a new connection against max_clients
+ * @return 1 == accepted, 0 == server full
+ */
+int reserveConnection(void)
+{
+    if (__atomic_add_fetch(&connection_count, 1, __ATOMIC_RELAXED) > max_clients)
     {
-        if (connectedPlayers[i].user_id == user_id)
-            return &connectedPlayers[i];
+        __atomic_sub_fetch(&connection_count, 1, __ATOMIC_RELAXED);
+        return 0;
     }
-    return NULL;
+    return 1;
+}
+
+void releaseConnection(void)
+{
+    __atomic_sub_fetch(&connection_count, 1, __ATOMIC_RELAXED);
 }
 
-// todo: ================= QUEUE FUNCTION ======================
-int enqueuePlayer(Player p, BoardState board)
+// todo: ================= SHARD MAILBOX ======================
+void shardPost(Shard *shard, ShardCommand *cmd)
 {
-    pthread_mutex_lock(&queue_lock);
-    for (int i = 0; i < MAX_CLIENTS; i++)
+    uint64_t one = 1;
+    cmd->next = NULL;
+
+    pthread_mutex_lock(&shard->mailbox_lock);
+    if (shard->mailbox_tail)
+        shard->mailbox_tail->next = cmd;
+    else
+        shard->mailbox_head = cmd;
+    shard->mailbox_tail = cmd;
+    pthread_mutex_unlock(&shard->mailbox_lock);
+
+    if (write(shard->wake_fd, &one, sizeof(one)) < 0)
+        perror("write eventfd");
+}
+
+// todo: ================= DATABASE WAITERS ===================
+/** Park the connection's current request until the writer has committed the queued writes of a user (users.id)
+ * @return 1 == parked, 0 == out of memory (handle the request now)
+ */
+int parkForDatabase(Player *player, int user_id)
+{
+    Shard *shard = current_shard;
+    if (shard->db_waiter_count == shard->db_waiter_capacity)
     {
-        if (queuePlayer[i].player.user_id == 0)
-        {
-            queuePlayer[i].player = p;
-            queuePlayer[i].board = board;
-            pthread_mutex_unlock(&queue_lock);
-            return 1;
-        }
+        int capacity = shard->db_waiter_capacity ? shard->db_waiter_capacity * 2 : 16;
+        DbWaiter *waiters = realloc(shard->db_waiters, sizeof(DbWaiter) * capacity);
+        if (!waiters)
+            return 0;
+        shard->db_waiters = waiters;
+        shard->db_waiter_capacity = capacity;
     }
-    pthread_mutex_unlock(&queue_lock);
-    return 0;
+    shard->db_waiters[shard->db_waiter_count++] = (DbWaiter){player, player->conn_id};
+    player->db_wait = 1;
+
+    __atomic_store_n(&shard->db_notify, 1, __ATOMIC_SEQ_CST);
+    if (!dbUserWritePending(user_id))
+    {
+        //* Committed before the writer could see db_notify: wake ourselves
+        uint64_t one = 1;
+        if (write(shard->wake_fd, &one, sizeof(one)) < 0)
+            perror("write eventfd");
+    }
+    return 1;
 }
 
-int dequeuePlayer(int user_id)
+// The writer committed something: run the parked requests again (they park again if still behind)
+void resumeDbWaiters(void)
 {
-    pthread_mutex_lock(&queue_lock);
-    for (int i = 0; i < MAX_CLIENTS; i++)
+    Shard *shard = current_shard;
+    DbWaiter *waiters = shard->db_waiters;
+    int count = shard->db_waiter_count;
+
+    shard->db_waiters = NULL;
+    shard->db_waiter_count = shard->db_waiter_capacity = 0;
+    __atomic_store_n(&shard->db_notify, 0, __ATOMIC_SEQ_CST);
+
+    for (int i = 0; i < count; i++)
     {
-        if (queuePlayer[i].player.user_id == user_id)
-        {
-            memset(&queuePlayer[i], 0, sizeof(WaitingPlayer));
-            pthread_mutex_unlock(&queue_lock);
-            return 1;
-        }
+        Player *player = waiters[i].player;
+        if (player->conn_id != waiters[i].conn_id || !player->db_wait)
+            continue; //* Disconnected or migrated meanwhile
+        player->db_wait = 0;
+        handleInput(player, NULL, 0);
+
+        //* Reading stopped while it was parked, the rest of its input may still be in the socket
+        if (!player->db_wait && !player->migrating && player->io && !transportResume(player))
+            handleDisconnect(player);
     }
-    pthread_mutex_unlock(&queue_lock);
-    return 0;
+    free(waiters);
 }
 
-// todo: ================= MATCHMAKING FUNCTION =================
-int createMatchSession(Player p1, Player p2, BoardState b1, BoardState b2)
+// todo: ================= MATCH SESSION FUNCTION ===============
+//* Match sessions live in the shard that hosts the match and are only touched by its thread
+#define BOT_SEAT 1 //* A bot always plays player 2, the player it was found for hosts the match
+
+// Packed board of a seat, right after the session header
+void *matchBoard(MatchSession *match, int seat)
 {
-    pthread_mutex_lock(&match_lock);
-    for (int i = 0; i < MAX_MATCHES_NUM; i++)
-    {
-        if (matchSessionList[i].match_id == 0)
-        {
+    return (unsigned char *)match->boards + seat * game_rules[match->variant].packed_size;
+}
 
-            int new_match_id = db_create_match(&db, p1.username, p2.username); //* Create match in db
-            matchSessionList[i].match_id = new_match_id;
-            matchSessionList[i].player_1 = p1;
-            matchSessionList[i].player_2 = p2;
-            matchSessionList[i].board_p1 = b1;
-            matchSessionList[i].board_p2 = b2;
-            matchSessionList[i].current_turn = (rand() % 2 == 0) ? p1.user_id : p2.user_id; //? RANDOM THE FIRST TURN
-            printf("[NEW MATCH] Match %d: %s (%d) vs %s (%d). \n", new_match_id, p1.username, p1.elo, p2.username, p2.elo);
-            pthread_mutex_unlock(&match_lock);
-            return matchSessionList[i].match_id; //* Return match_id created in db
-        }
-    }
-    pthread_mutex_unlock(&match_lock);
-    return 0;
+MatchSession *createMatchSession(Player p1, Player p2, FleetLayout f1, FleetLayout f2)
+{
+    //* The id is handed out in memory, the row goes through the writer ahead of the match's moves
+    int new_match_id = dbReserveMatchId();
+    MatchSession *match = matchPoolAlloc(&current_shard->matches[f1.variant], new_match_id);
+    if (!match)
+        return NULL;
+    dbWriteCreateMatch(new_match_id, p1.user_id, p2.user_id);
+
+    match->seats[0] = (MatchSeat){p1.user_id, p1.socket_fd, p1.elo};
+    match->seats[1] = (MatchSeat){p2.user_id, p2.socket_fd, p2.elo};
+    init_packed_board(matchBoard(match, 0), &f1);
+    init_packed_board(matchBoard(match, 1), &f2);
+    match->turn = rand() % 2; //? RANDOM THE FIRST TURN
+    printf("[NEW MATCH] Match %d on shard %d: %s (%d) vs %s (%d). \n", new_match_id, current_shard->id, p1.username, p1.elo, p2.username, p2.elo);
+    return match; //* match_id is the one created in db
 }
 
 MatchSession *getMatchById(int match_id)
 {
-    pthread_mutex_lock(&match_lock);
-    for (int i = 0; i < MAX_MATCHES_NUM; i++)
+    for (int v = 0; v < GAME_VARIANT_COUNT; v++)
     {
-        if (matchSessionList[i].match_id == match_id)
-        {
-            pthread_mutex_unlock(&match_lock);
-            return &matchSessionList[i];
-        }
+        MatchSession *match = matchPoolFind(&current_shard->matches[v], match_id);
+        if (match)
+            return match;
     }
-    pthread_mutex_unlock(&match_lock);
     return NULL;
 }
 
-MatchSession *getMatchByPlayerClientFd(int player_client_fd)
+// Match the connection plays in, NULL if none (or it has ended since the link was set)
+MatchSession *getPlayerMatch(Player *player)
 {
-    pthread_mutex_lock(&match_lock);
-    for (int i = 0; i < MAX_MATCHES_NUM; i++)
-    {
-        if (matchSessionList[i].player_1.socket_fd == player_client_fd || matchSessionList[i].player_2.socket_fd == player_client_fd)
-        {
-            pthread_mutex_unlock(&match_lock);
-            return &matchSessionList[i];
-        }
-    }
-    pthread_mutex_unlock(&match_lock);
-    return NULL;
+    if (player->match.variant >= GAME_VARIANT_COUNT)
+        return NULL;
+    return matchPoolGet(&current_shard->matches[player->match.variant], player->match);
+}
+
+
+// Seat of user_id in the match, -1 if it does not play in it
+int getSeat(MatchSession *match, int user_id)
+{
+    if (match->seats[0].user_id == user_id)
+        return 0;
+    return match->seats[1].user_id == user_id ? 1 : -1;
+}
+
+// Connection of a seat, NULL if it is not attached to the match (gone, or still migrating)
+Player *getSeatPlayer(MatchSession *match, int seat)
+{
+    MatchHandle handle = matchHandleOf(match);
+    Player *player = getPlayerBySockFd(match->seats[seat].socket_fd);
+    if (!player || player->user_id != match->seats[seat].user_id)
+        return NULL;
+    return (player->match.slot == handle.slot && player->match.generation == handle.generation &&
+            player->match.variant == handle.variant)
+               ? player
+               : NULL;
+}
+
+// Username of a seat, from its connection or else through the name cache
+void getSeatName(MatchSession *match, int seat, char *username, int size)
+{
+    Player *player = getSeatPlayer(match, seat);
+    if (player)
+        snprintf(username, size, "%s", player->username);
+    else if (!db_get_username(&current_shard->db, match->seats[seat].user_id, username, size))
+        snprintf(username, size, "%s", "");
+}
+
+// Bot of a match, NULL if both seats are players
+AiPlayer *getMatchBot(MatchSession *match)
+{
+    return intMapGet(&current_shard->bots, match->match_id);
 }
 
-int removeMatchSession(int match_id)
+// Rating of a seat once the match is scored (score 1 == won, 0 == lost), a bot keeps its fixed rating
+int seatEloAfter(MatchSession *match, int seat, float score)
 {
-    pthread_mutex_lock(&match_lock);
-    for (int i = 0; i < MAX_MATCHES_NUM; i++)
+    if (seat == BOT_SEAT && getMatchBot(match))
+        return match->seats[seat].elo;
+    return calculate_elo(match->seats[seat].elo, match->seats[1 - seat].elo, score);
+}
+
+// users.id whose wins, losses and rank a match ending updates, 0 for a bot
+int seatRecordId(MatchSession *match, int seat)
+{
+    return seat == BOT_SEAT && getMatchBot(match) ? 0 : match->seats[seat].user_id;
+}
+
+// End a match: unlink both local connections from it and give the slot back
+void removeMatchSession(MatchSession *match)
+{
+    free(intMapRemove(&current_shard->bots, match->match_id));
+
+    for (int seat = 0; seat < 2; seat++)
     {
-        if (matchSessionList[i].match_id == match_id)
+        int user_id = match->seats[seat].user_id;
+        if (intMapGet(&current_shard->awaiting, user_id) == match)
+            intMapRemove(&current_shard->awaiting, user_id);
+
+        Player *player = getSeatPlayer(match, seat);
+        if (player)
         {
-            memset(&matchSessionList[i], 0, sizeof(MatchSession));
-            pthread_mutex_unlock(&match_lock);
-            return 1;
+            player->match.generation = 0;
+            player->in_game = 0;
         }
     }
-    pthread_mutex_unlock(&match_lock);
-    return 0;
+
+    matchPoolRelease(&current_shard->matches[match->variant], match);
 }
 
 // todo: HELPER FUNCTION =========================================
@@ -210,99 +308,1055 @@ int place_ship_from_json(BoardState *board, cJSON *ships_json, const char *ship_
     return place_ship(board, type_enum, row, col, orient == 1 ? HORIZONTAL : VERTICAL);
 }
 
-// todo: ================= MATCHMAKING THREAD ===================
-void *matchmaking_thread(void *arg)
+// todo: ================= MOVES ================
+/** Fire the shot of a seat at the other seat's board, store it, tell both players, and end the match
+ * on the last ship (the session is released then)
+ * @param attacker connection of the seat, NULL for a bot
+ * @return the result, ATTACK_INVALID == the cell cannot be fired at, nothing changed
+ */
+AttackResult playMove(MatchSession *match, int seat, Player *attacker, int row, int col)
 {
-    srand(time(NULL));
-    while (1)
+    int match_id = match->match_id;
+    Player *opponent = getSeatPlayer(match, 1 - seat); //* NULL if its connection is no longer here, or a bot
+    void *opponent_board = matchBoard(match, 1 - seat); // Only attack opponent's board
+    int next_turn_user_id = match->seats[1 - seat].user_id;
+
+    // Perform the attack
+    AttackResult result = attack_packed(match->variant, opponent_board, row, col);
+    const char *result_str = NULL;
+
+    switch (result)
+    {
+    case ATTACK_INVALID:
+        return result;
+    case ATTACK_MISS:
+        result_str = "MISS";
+        break;
+    case ATTACK_HIT:
+        result_str = "HIT";
+        break;
+    case ATTACK_SUNK:
+        result_str = "SUNK";
+        break;
+    }
+    // todo: Insert move to database (write-behind, failures are logged by the writer)
+    int turn_order = packed_shots(match->variant, matchBoard(match, 0)) + packed_shots(match->variant, matchBoard(match, 1));
+    dbWriteMove(match_id, turn_order, match->seats[seat].user_id, col, row, result_str);
+
+    char attacker_name[64];
+    if (attacker)
+        snprintf(attacker_name, sizeof(attacker_name), "%s", attacker->username);
+    else
+        getSeatName(match, seat, attacker_name, sizeof(attacker_name));
+
+    // todo: Check for match end
+    if (packed_remaining(opponent_board) == 0)
     {
-        pthread_mutex_lock(&queue_lock);
-        for (int i = 0; i < MAX_CLIENTS; i++)
+        // Notify both players of move result --> End game next turn 0 means no move next move
+        if (attacker)
+            sendMoveResult(attacker->socket_fd, match_id, attacker_name, row, col, result_str, 0);
+        if (opponent)
+            sendMoveResult(opponent->socket_fd, match_id, attacker_name, row, col, result_str, 0);
+
+        const char *winner_str = (seat == 0) ? "P1_WIN" : "P2_WIN";
+
+        // todo: Update ELOs
+        int new_elo_attacker = seatEloAfter(match, seat, 1.0);
+        int new_elo_opponent = seatEloAfter(match, 1 - seat, 0.0);
+
+        dbWriteFinalizeMatch(match_id, winner_str, seatRecordId(match, seat), new_elo_attacker,
+                             seatRecordId(match, 1 - seat), new_elo_opponent);
+
+        // Notify players
+        if (attacker)
         {
-            if (queuePlayer[i].player.user_id == 0)
-                continue;
+            attacker->elo = new_elo_attacker;
+            sendMatchResult(attacker->socket_fd, match_id, "WIN", new_elo_attacker);
+        }
+        if (opponent)
+        {
+            opponent->elo = new_elo_opponent;
+            sendMatchResult(opponent->socket_fd, match_id, "LOSE", new_elo_opponent);
+        }
+        printf("[GAME OVER] Match %d: %s won!\n", match_id, attacker_name);
+        removeMatchSession(match);
+    }
+    else
+    {
+        // Notify both players of move result
+        if (attacker)
+            sendMoveResult(attacker->socket_fd, match_id, attacker_name, row, col, result_str, next_turn_user_id);
+        if (opponent)
+            sendMoveResult(opponent->socket_fd, match_id, attacker_name, row, col, result_str, next_turn_user_id);
+
+        // Update next turn
+        match->turn = 1 - seat;
+    }
+    return result;
+}
 
-            for (int j = i + 1; j < MAX_CLIENTS; j++)
+// The bot of a match fires if it is its turn. Its shot may end the match, which frees the bot
+void playBotTurn(int match_id)
+{
+    MatchSession *match = getMatchById(match_id);
+    AiPlayer *ai = match ? getMatchBot(match) : NULL;
+    if (!ai || match->turn != BOT_SEAT || match->attached_mask != 3)
+        return;
+
+    int row, col;
+    while (ai_next_shot(ai, &row, &col))
+    {
+        AttackResult result = playMove(match, BOT_SEAT, NULL, row, col);
+        if (result != ATTACK_INVALID && !getMatchById(match_id))
+            return; //* Won, the bot went with the session
+        ai_record_shot(ai, row, col, result); //* A refused cell is marked fired at, the next try picks another
+        if (result != ATTACK_INVALID)
+            return;
+    }
+}
+
+// todo: ================= MATCH START HANDSHAKE ================
+/** Mark one side of a pending match as present (attached) or gone, then start or cancel
+ * the match once both sides are known. Runs on the shard hosting the match.
+ */
+void resolveMatchStart(MatchSession *match, int player_bit, int attached)
+{
+    if (attached)
+        match->attached_mask |= player_bit;
+    else
+        match->gone_mask |= player_bit;
+
+    if ((match->attached_mask | match->gone_mask) != 3)
+        return; //* Still waiting for a connection to migrate
+
+    if (match->gone_mask == 0)
+    {
+        char names[2][64];
+        getSeatName(match, 0, names[0], sizeof(names[0]));
+        getSeatName(match, 1, names[1], sizeof(names[1]));
+
+        // todo: Send notify to each players (a bot has no connection)
+        int first_turn = match->seats[match->turn].user_id;
+        const char *variant = game_rules[match->variant].name;
+        for (int seat = 0; seat < 2; seat++)
+        {
+            Player *player = getSeatPlayer(match, seat);
+            if (player && sendNotifyMatchFound(player->socket_fd, match->match_id, names[0], names[1], first_turn, variant))
             {
-                if (queuePlayer[j].player.user_id == 0)
-                    continue;
+                printf("[INFO] Send match invitation to %s socket %d. \n", player->username, player->socket_fd);
+            }
+        }
 
-                // todo: Check elo 2 players ( diff <= 200 -> OK)
-                if (!can_match(queuePlayer[i].player.elo, queuePlayer[j].player.elo))
-                    continue;
+        playBotTurn(match->match_id); //* A bot that got the first turn fires right away
+        return;
+    }
 
-                Player p1 = queuePlayer[i].player;
-                Player p2 = queuePlayer[j].player;
-                BoardState b1 = queuePlayer[i].board;
-                BoardState b2 = queuePlayer[j].board;
+    // todo: Someone left before the match started -> drop it and put the other player back in the queue
+    printf("[CANCEL MATCH] Match %d: a player left before the start. \n", match->match_id);
+    dbWriteDeleteMatch(match->match_id);
 
-                int match_id = createMatchSession(p1, p2, b1, b2);
-                if (match_id <= 0)
-                    continue;
+    for (int seat = 0; seat < 2; seat++)
+    {
+        if (!(match->attached_mask & (1 << seat)) || (match->gone_mask & (1 << seat)))
+            continue;
+
+        Player *player = getSeatPlayer(match, seat);
+        if (!player)
+            continue;
+
+        player->in_game = 0;
+        FleetLayout fleet;
+        packed_fleet(match->variant, matchBoard(match, seat), &fleet);
+        player->in_queue = enqueuePlayer(*player, fleet);
+        if (!player->in_queue)
+            sendResult(player->socket_fd, "QUEUE_EXIT_RES", 1, "Opponent left, please enter the queue again");
+    }
 
-                MatchSession *new_match = getMatchById(match_id);
-                printf("New match %d: %s vs %s (ELO %d vs %d)\n", match_id, p1.username, p2.username, p1.elo, p2.elo);
+    removeMatchSession(match);
+}
 
-                // todo: dequeue the player
-                memset(&queuePlayer[i], 0, sizeof(WaitingPlayer));
-                memset(&queuePlayer[j], 0, sizeof(WaitingPlayer));
+// todo: ================= REQUEST HANDLING ===================
+void handleRequest(Player *player, cJSON *payload)
+{
+    int client_fd = player->socket_fd;
 
-                pthread_mutex_lock(&connections_lock);
-                Player *player1 = getPlayerByUserId(p1.user_id);
-                player1->in_queue = 0;
-                player1->in_game = 1;
-                Player *player2 = getPlayerByUserId(p2.user_id);
-                player2->in_queue = 0;
-                player2->in_game = 1;
-                pthread_mutex_unlock(&connections_lock);
+    // todo: Get the endpoint type
+    cJSON *endpoint_type = cJSON_GetObjectItem(payload, "type");
 
-                // todo: Send notify to each players
-                if (sendNotifyMatchFound(p1.socket_fd, new_match->match_id, p1.username, p2.username, new_match->current_turn))
-                {
-                    printf("[INFO] Send match invitation to %s socket %d. \n", p1.username, p1.socket_fd);
-                }
+    if (cJSON_IsString(endpoint_type) && endpoint_type->valuestring != NULL) // todo: Checking null endpoint
+    {
+        const char *endpoint = endpoint_type->valuestring;
+        printf("[%s] %s:%d\n", endpoint, inet_ntoa(player->addr.sin_addr), ntohs(player->addr.sin_port));
+
+        // todo: HELLO (framing negotiation, optional)
+        if (strcmp(endpoint, "HELLO_REQ") == 0)
+        {
+            cJSON *framing_json = cJSON_GetObjectItem(payload, "framing");
+            if (cJSON_IsString(framing_json) && strcmp(framing_json->valuestring, "ndjson") == 0)
+            {
+                player->framing = FRAMING_NDJSON;
+                sendResult(client_fd, "HELLO_RES", 1, "ndjson");
+            }
+            else
+            {
+                player->framing = FRAMING_AUTO;
+                sendResult(client_fd, "HELLO_RES", 1, "auto");
+            }
+        }
+        // todo: STATS (matchmaking histograms)
+        else if (strcmp(endpoint, "STATS_REQ") == 0)
+        {
+            MatchmakerStats stats;
+            DbWriterStats db_stats;
+            UserCacheStats cache_stats;
+            matchmakerGetStats(&stats);
+            dbWriterGetStats(&db_stats);
+            user_cache_get_stats(&cache_stats);
+            sendStats(client_fd, &stats, &db_stats, &cache_stats);
+        }
+        // todo: HISTORY (keyset pagination: pass back next_cursor to get the following page)
+        else if (strcmp(endpoint, "HISTORY_REQ") == 0)
+        {
+            cJSON *username_json = cJSON_GetObjectItem(payload, "username");
+            cJSON *cursor_json = cJSON_GetObjectItem(payload, "cursor");
+            cJSON *limit_json = cJSON_GetObjectItem(payload, "limit");
+
+            const char *username = cJSON_IsString(username_json) ? username_json->valuestring : (player->is_login ? player->username : NULL);
+            if (!username)
+            {
+                sendError(client_fd, "Invalid HISTORY_REQ payload.");
+                return;
+            }
+
+            int cursor = cJSON_IsNumber(cursor_json) ? cursor_json->valueint : 0;
+            int limit = cJSON_IsNumber(limit_json) ? limit_json->valueint : HISTORY_PAGE_DEFAULT;
+            if (limit < 1)
+                limit = HISTORY_PAGE_DEFAULT;
+            if (limit > HISTORY_PAGE_MAX)
+                limit = HISTORY_PAGE_MAX;
+
+            //* Matches reference users by id, unknown usernames have no history
+            int user_id = (username == player->username) ? player->user_id : db_get_user(&current_shard->db, username).id;
+
+            //* One row more than asked tells whether another page follows
+            Match page[HISTORY_PAGE_MAX + 1];
+            MatchPlayers players[HISTORY_PAGE_MAX];
+            int count = user_id > 0 ? db_get_match_page(&current_shard->db, user_id, cursor, page, limit + 1) : 0;
+            int next_cursor = (count > limit) ? page[limit - 1].id : 0;
+            if (count > limit)
+                count = limit;
+
+            for (int i = 0; i < count; i++)
+            {
+                if (!db_get_username(&current_shard->db, page[i].player1_id, players[i].player1, sizeof(players[i].player1)))
+                    players[i].player1[0] = '\0'; //* Deleted user
+                if (!db_get_username(&current_shard->db, page[i].player2_id, players[i].player2, sizeof(players[i].player2)))
+                    players[i].player2[0] = '\0';
+            }
+            sendHistory(client_fd, username, page, players, count, next_cursor);
+        }
+        // todo: LEADERBOARD (cached top page, plus the rank and neighbours of username or the caller)
+        else if (strcmp(endpoint, "LEADERBOARD_REQ") == 0)
+        {
+            cJSON *username_json = cJSON_GetObjectItem(payload, "username");
+            const char *username = cJSON_IsString(username_json) ? username_json->valuestring : (player->is_login ? player->username : NULL);
+
+            LeaderboardEntry around[2 * LEADERBOARD_NEIGHBOURS + 1];
+            int self = 0;
+            int count = username ? leaderboard_around(username, around, &self) : 0;
+            char *top = leaderboard_top_json();
+            sendLeaderboard(client_fd, top, leaderboard_size(), around, count, self);
+            free(top);
+        }
+        // todo: REGISTER
+        else if (strcmp(endpoint, "REGISTER_REQ") == 0)
+        {
+            cJSON *username_json = cJSON_GetObjectItem(payload, "username");
+            cJSON *password_json = cJSON_GetObjectItem(payload, "password");
+            if (!username_json || !password_json)
+            {
+                sendError(client_fd, "No username or password");
+                return;
+            }
+
+            //* Bot accounts are created at startup, a player holding one of their names would turn bots off
+            if (cJSON_IsString(username_json) && strncmp(username_json->valuestring, DB_BOT_PREFIX, strlen(DB_BOT_PREFIX)) == 0)
+            {
+                sendResult(client_fd, "REGISTER_RES", 0, "Username is reserved");
+                return;
+            }
+
+            char password_hash[65];
+            hash_password(password_json->valuestring, password_hash);
+
+            int success = db_create_user(&current_shard->db, username_json->valuestring, password_hash);
+
+            sendResult(client_fd, "REGISTER_RES", success ? 1 : 0, success ? "Success register" : "Failed to insert to database");
+        }
+        // todo: LOGIN
+        else if (strcmp(endpoint, "LOGIN_REQ") == 0)
+        {
+            cJSON *username_json = cJSON_GetObjectItem(payload, "username");
+            cJSON *password_json = cJSON_GetObjectItem(payload, "password");
+
+            if (!username_json || !password_json ||
+                !cJSON_IsString(username_json) || !cJSON_IsString(password_json))
+            {
+                sendResult(client_fd, "LOGIN_RES", 0, "Missing ");
+                return;
+            }
+
+            const char *username = username_json->valuestring;
+            const char *password = password_json->valuestring;
+
+            // Hash the password
+            char password_hash[65];
+            hash_password(password, password_hash);
+
+            // Get user from database
+            User db_user = db_get_user(&current_shard->db, username);
 
-                if (sendNotifyMatchFound(p2.socket_fd, new_match->match_id, p1.username, p2.username, new_match->current_turn))
+            //* The Elo of a game that just ended may still be on its way to the database
+            if (db_user.id > 0 && dbUserWritePending(db_user.id) && parkForDatabase(player, db_user.id))
+                return;
+
+            // Check if user exists and password matches
+            if (db_user.id > 0 && strcmp(db_user.password_hash, password_hash) == 0)
+            {
+                // Successful login, update player struct
+                connTableUnindexUser(&current_shard->connections, player);
+                player->user_id = db_user.id;
+                strncpy(player->username, db_user.username, sizeof(player->username) - 1);
+                player->elo = db_user.elo;
+                player->is_login = 1;
+                connTableIndexUser(&current_shard->connections, player);
+
+                // Send login response
+                sendLoginResult(client_fd, db_user.id, db_user.username, db_user.elo);
+                printf("Player logged in: %s (ELO %d)\n", db_user.username, db_user.elo);
+            }
+            else
+            {
+                // Failed login
+                sendResult(client_fd, "LOGIN_RES", 0, "Wrong password or username");
+                printf("Failed login attempt: %s\n", username);
+            }
+        }
+        // todo: LOGOUT
+        else if (strcmp(endpoint, "LOGOUT") == 0)
+        {
+            connTableUnindexUser(&current_shard->connections, player);
+            player->user_id = 0;
+            player->is_login = 0;
+            player->in_game = 0;
+            player->in_queue = 0;
+            player->elo = 0;
+            memset(player->username, 0, sizeof(player->username));
+            sendResult(client_fd, "LOGOUT_RES", 1, "Success logout");
+        }
+        // todo: ENTER WAITING QUEUE
+        else if (strcmp(endpoint, "QUEUE_ENTER_REQ") == 0)
+        {
+            if (!player->is_login)
+            {
+                sendResult(client_fd, "QUEUE_ENTER_RES", 0, "Use is not login");
+                return;
+            }
+
+            cJSON *ships_json = cJSON_GetObjectItem(payload, "ships");
+            if (!ships_json || !cJSON_IsObject(ships_json))
+            {
+                sendResult(client_fd, "QUEUE_ENTER_RES", 0, "No ships was found");
+                return;
+            }
+
+            // todo: Init board for player, classic unless the request names a variant
+            cJSON *variant_json = cJSON_GetObjectItem(payload, "variant");
+            int variant = VARIANT_CLASSIC;
+            if (variant_json)
+                variant = cJSON_IsString(variant_json) ? find_variant(variant_json->valuestring) : -1;
+            if (variant < 0)
+            {
+                sendResult(client_fd, "QUEUE_ENTER_RES", 0, "Unknown variant");
+                return;
+            }
+
+            BoardState board;
+            init_variant_board(&board, (GameVariant)variant);
+
+            // todo: Place ship, every ship of the variant's fleet
+            const GameRules *rules = &game_rules[variant];
+            for (int i = 0; i < rules->ship_count; i++)
+            {
+                if (!place_ship_from_json(&board, ships_json, get_ship_name(rules->fleet[i]), rules->fleet[i]))
                 {
-                    printf("[INFO] Send match invitation to %s socket %d. \n", p2.username, p2.socket_fd);
+                    sendResult(client_fd, "QUEUE_ENTER_RES", 0, "Failed to place ship");
+                    return;
                 }
             }
+
+            // todo:  Add player to queue
+            FleetLayout fleet;
+            if (pack_fleet(&board, &fleet) && enqueuePlayer(*player, fleet))
+            {
+                player->in_queue = 1;
+
+                sendResult(client_fd, "QUEUE_ENTER_RES", 1, "Enter queue success");
+                printf("Player %s entered matchmaking queue\n", player->username);
+            }
+            else
+            {
+
+                sendResult(client_fd, "QUEUE_ENTER_RES", 0, "Failed to enter the queue");
+            }
+        }
+        // todo: EXIT WAITING QUEUE
+        else if (strcmp(endpoint, "QUEUE_EXIT_REQ") == 0)
+        {
+
+            if (dequeuePlayer(player->user_id))
+            {
+                player->in_queue = 0;
+                sendResult(client_fd, "QUEUE_EXIT_RES", 1, "Exit queue success");
+            }
+            else
+            {
+                sendResult(client_fd, "QUEUE_EXIT_RES", 0, "Exit queue failed");
+            }
         }
-        pthread_mutex_unlock(&queue_lock);
+        // todo: MOVE
+        else if (strcmp(endpoint, "MOVE_REQ") == 0)
+        {
+            cJSON *match_id_json = cJSON_GetObjectItem(payload, "match_id");
+            cJSON *row_json = cJSON_GetObjectItem(payload, "row");
+            cJSON *col_json = cJSON_GetObjectItem(payload, "col");
+
+            if (!match_id_json || !row_json || !col_json)
+            {
+                sendError(client_fd, "Invalid MOVE_REQ payload.");
+                return;
+            }
 
-        // printf("Match-making loop is still running... \n");
-        sleep(1); //* sleep 1s
+            int match_id = match_id_json->valueint;
+            int row = row_json->valueint;
+            int col = col_json->valueint;
+
+            MatchSession *match = getMatchById(match_id);
+            if (!match)
+            {
+                sendError(client_fd, "Match not found.");
+                return;
+            }
+
+            // todo: Check who is attacker and opponent
+            int seat = getSeat(match, player->user_id);
+            if (seat < 0)
+            {
+                sendError(client_fd, "You are not part of this match.");
+                return;
+            }
+            if (match->turn != seat)
+            {
+                sendError(client_fd, "Not your turn.");
+                return;
+            }
+
+            if (playMove(match, seat, player, row, col) == ATTACK_INVALID)
+            {
+                sendError(client_fd, "Invalid move.");
+                return;
+            }
+            playBotTurn(match_id); //* Answers right away when the opponent is a bot
+        }
+        // todo: RESIGN
+        else if (strcmp(endpoint, "RESIGN_REQ") == 0)
+        {
+            cJSON *match_id_json = cJSON_GetObjectItem(payload, "match_id");
+            cJSON *user_id_json = cJSON_GetObjectItem(payload, "user_id");
+
+            if (!match_id_json || !user_id_json)
+            {
+                sendError(client_fd, "Invalid RESIGN_REQ payload.");
+                return;
+            }
+
+            int match_id = match_id_json->valueint;
+            int user_id = user_id_json->valueint;
+
+            MatchSession *match = getMatchById(match_id);
+            if (!match)
+            {
+                sendError(client_fd, "Match not found.");
+                return;
+            }
+
+            int seat = getSeat(match, user_id);
+            if (seat < 0)
+            {
+                sendError(client_fd, "You are not part of this match.");
+                return;
+            }
+            const char *result_str = (seat == 0) ? "P2_WIN" : "P1_WIN";
+            Player *resigner = getSeatPlayer(match, seat);
+            Player *opponent = getSeatPlayer(match, 1 - seat);
+
+            // Calculate ELO change
+            int new_elo_opponent = seatEloAfter(match, 1 - seat, 1.0);
+            int new_elo_resigner = seatEloAfter(match, seat, 0.0);
+
+            // Update DB match result, ratings and win/loss counts in one go
+            dbWriteFinalizeMatch(match_id, result_str, seatRecordId(match, 1 - seat), new_elo_opponent,
+                                 seatRecordId(match, seat), new_elo_resigner);
+
+            // Update local state and notify both players
+            if (resigner)
+            {
+                resigner->elo = new_elo_resigner;
+                sendMatchResult(resigner->socket_fd, match_id, "LOSE", new_elo_resigner);
+            }
+            if (opponent)
+            {
+                opponent->elo = new_elo_opponent;
+                sendMatchResult(opponent->socket_fd, match_id, "WIN", new_elo_opponent);
+            }
+
+            printf("[GAME OVER] Match %d: user %d resigned, user %d wins!\n", match_id, match->seats[seat].user_id, match->seats[1 - seat].user_id);
+
+            // Remove match from session
+            removeMatchSession(match);
+        }
+        else // todo: UNKNOWN
+        {
+            printf("[UNKNOWN] %s:%d\n", inet_ntoa(player->addr.sin_addr), ntohs(player->addr.sin_port));
+            sendError(client_fd, "Unknown endpoint type.");
+        }
+    }
+    else // todo: Handling null endpoint
+    {
+        printf("[NULL] %s:%d\n", inet_ntoa(player->addr.sin_addr), ntohs(player->addr.sin_port));
+        sendError(client_fd, "Null endpoint type.");
     }
-    return NULL;
 }
 
-// todo: ================= MAIN THREAD ==========================
-int main(int argc, char const *argv[])
+// todo: ================= CONNECTION HANDLING ================
+void handleDisconnect(Player *player)
 {
-    /* code */
-    int server_fd;
-    struct sockaddr_in server_addr, client_addr;
-    struct pollfd fds[MAX_CLIENTS + 1];
-    char buffer[BUFFER_SIZE];
+    int client_fd = player->socket_fd;
 
-    // todo: Init database
-    if (db_init(&db, "games.db") != 0)
-        return 1;
-    db_create_tables(&db);
+    if (player->in_queue)
+    {
+        dequeuePlayer(player->user_id);
+    }
+
+    if (player->in_game)
+    {
+        MatchSession *match = getPlayerMatch(player);
+        int seat = match ? getSeat(match, player->user_id) : -1;
+        if (seat >= 0 && match->attached_mask != 3)
+        {
+            //* Left while the opponent's connection was still migrating: cancel instead of forfeit
+            resolveMatchStart(match, 1 << seat, 0);
+        }
+        else if (seat >= 0)
+        {
+            Player *opponent = getSeatPlayer(match, 1 - seat);
+
+            // Update ELO
+            const char *result_str = (seat == 0) ? "P2_WIN" : "P1_WIN";
+            int new_elo_opponent = seatEloAfter(match, 1 - seat, 1.0);
+            int new_elo_disconnected = seatEloAfter(match, seat, 0.0);
+
+            // Update DB match result, ratings and win/loss counts in one go
+            dbWriteFinalizeMatch(match->match_id, result_str, seatRecordId(match, 1 - seat), new_elo_opponent,
+                                 seatRecordId(match, seat), new_elo_disconnected);
+
+            // Notify opponent
+            if (opponent)
+            {
+                opponent->elo = new_elo_opponent;
+                sendMatchResult(opponent->socket_fd, match->match_id, "WIN", new_elo_opponent);
+            }
+
+            printf("[DISCONNECT IN GAME] Player %s disconnected, user %d wins by default!\n", player->username, match->seats[1 - seat].user_id);
+
+            // Remove match
+            removeMatchSession(match);
+        }
+    }
+
+    if (player->migrating)
+    {
+        //* Closed while handing over to the match shard: tell it the connection is gone
+        ShardCommand *cmd = player->migrating;
+        cmd->player_1.socket_fd = 0;
+        cmd->type = CMD_ADOPT;
+        shardPost(&shards[cmd->target_shard], cmd);
+    }
+
+    printf("Disconnection from %s:%d\n", inet_ntoa(player->addr.sin_addr), ntohs(player->addr.sin_port));
+    transportRelease(player);
+    free(player->in_buf);
+    removeConnectedPlayer(player);
+    close(client_fd);
+    releaseConnection();
+}
+
+Player *acceptPlayer(int socket_fd, const struct sockaddr_in *addr)
+{
+    printf("New connection from %s:%d (shard %d)\n",
+           inet_ntoa(addr->sin_addr),
+           ntohs(addr->sin_port),
+           current_shard->id);
+
+    // todo: Add client
+    if (!reserveConnection())
+    {
+        sendError(socket_fd, "Server full. Try again later.");
+        close(socket_fd);
+        return NULL;
+    }
+
+    Player *slot = addConnectedPlayer(socket_fd);
+    if (slot)
+    {
+        slot->addr = *addr;
+        slot->shard_id = current_shard->id;
+        slot->conn_id = ++current_shard->next_conn_id;
+    }
+    if (!slot || !transportAttach(slot))
+    {
+        if (slot)
+            removeConnectedPlayer(slot);
+        close(socket_fd);
+        releaseConnection();
+        return NULL;
+    }
+    return slot;
+}
+
+// todo: ================= REQUEST FRAMING ==================
+/** Length of the JSON object at the start of data (string-aware brace matching)
+ * @return > 0 == complete object, 0 == need more bytes, -1 == data does not start with an object
+ */
+long scanJsonObject(const char *data, size_t len)
+{
+    int depth = 0, in_string = 0, escaped = 0;
+
+    if (len > 0 && data[0] != '{')
+        return -1;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = data[i];
+        if (in_string)
+        {
+            if (escaped)
+                escaped = 0;
+            else if (c == '\\')
+                escaped = 1;
+            else if (c == '"')
+                in_string = 0;
+        }
+        else if (c == '"')
+            in_string = 1;
+        else if (c == '{')
+            depth++;
+        else if (c == '}' && --depth == 0)
+            return (long)i + 1;
+    }
+    return 0;
+}
+
+/** Length of the line at the start of data, '\n' included
+ * @return > 0 == complete line, 0 == need more bytes
+ */
+long scanLine(const char *data, size_t len)
+{
+    const char *newline = memchr(data, '\n', len);
+    return newline ? (long)(newline - data) + 1 : 0;
+}
+
+/** Drop the next bytes of an oversized request
+ * @return bytes of data that still belong to it, discard.active is cleared once it ended
+ */
+size_t discardInput(Player *player, const char *data, size_t len)
+{
+    InputDiscard *discard = &player->discard;
+
+    if (player->framing == FRAMING_NDJSON)
+    {
+        long line_len = scanLine(data, len);
+        if (line_len == 0)
+            return len;
+        discard->active = 0;
+        return (size_t)line_len;
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = data[i];
+        if (discard->in_string)
+        {
+            if (discard->escaped)
+                discard->escaped = 0;
+            else if (c == '\\')
+                discard->escaped = 1;
+            else if (c == '"')
+                discard->in_string = 0;
+        }
+        else if (c == '"')
+            discard->in_string = 1;
+        else if (c == '{')
+            discard->depth++;
+        else if (c == '}' && --discard->depth == 0)
+        {
+            discard->active = 0;
+            return i + 1;
+        }
+    }
+    return len;
+}
+
+// Append received bytes to the connection's input stream
+int appendInput(Player *player, const char *data, size_t len)
+{
+    if (player->in_len + len > player->in_cap)
+    {
+        size_t capacity = player->in_cap ? player->in_cap : BUFFER_SIZE;
+        while (capacity < player->in_len + len)
+            capacity *= 2;
+        char *in_buf = realloc(player->in_buf, capacity);
+        if (!in_buf)
+            return 0;
+        player->in_buf = in_buf;
+        player->in_cap = capacity;
+    }
+
+    memcpy(player->in_buf + player->in_len, data, len);
+    player->in_len += len;
+    return 1;
+}
+
+void dispatchRequest(Player *player, const char *data, size_t len)
+{
+    cJSON *payload = cJSON_ParseWithLength(data, len);
+    if (!payload)
+    {
+        sendError(player->socket_fd, "Payload is not valid");
+        return;
+    }
+    // printf("Received payload: %s\n", cJSON_Print(payload));
+    handleRequest(player, payload);
+
+    // todo: Free cJSON payload (memory leak)
+    cJSON_Delete(payload);
+}
+
+void handleInput(Player *player, const char *data, size_t len)
+{
+    if (player->discard.active && len > 0)
+    {
+        //* The rest of an oversized request never reaches the buffer, framing resumes right after it
+        size_t skipped = discardInput(player, data, len);
+        data += skipped;
+        len -= skipped;
+    }
+
+    if (len > 0 && !appendInput(player, data, len))
+    {
+        //* Out of memory: drop what is buffered, the framing resynchronises on the next request
+        sendError(player->socket_fd, "Server out of memory.");
+        player->in_len = 0;
+        return;
+    }
+
+    // todo: Handle every complete request, clients may pipeline several without waiting for replies
+    size_t pos = 0;
+    //* A migrating connection keeps its input for the new shard, a parked one until the writer catches up
+    while (pos < player->in_len && !player->migrating && !player->db_wait)
+    {
+        const char *request = player->in_buf + pos;
+        size_t avail = player->in_len - pos;
+
+        //* Whitespace and blank lines between requests
+        if (isspace((unsigned char)request[0]))
+        {
+            pos++;
+            continue;
+        }
+
+        long request_len = (player->framing == FRAMING_NDJSON) ? scanLine(request, avail) : scanJsonObject(request, avail);
+        if (request_len == 0)
+        {
+            //* Incomplete: wait for more bytes, unless the request is already over the limit
+            if (avail > MAX_REQUEST_SIZE)
+            {
+                sendError(player->socket_fd, "Request too large.");
+                player->discard = (InputDiscard){.active = 1};
+                pos += discardInput(player, request, avail); //* Picks up where the request stands, it goes on
+            }
+            break;
+        }
+
+        if (request_len < 0)
+        {
+            //* Stray bytes between requests (never inside one): skip to the next object
+            const char *next = memchr(request + 1, '{', avail - 1);
+            pos += next ? (size_t)(next - request) : avail;
+            sendError(player->socket_fd, "Payload is not valid");
+            continue;
+        }
+
+        pos += request_len;
+        if (request_len > MAX_REQUEST_SIZE)
+        {
+            sendError(player->socket_fd, "Request too large."); //* Completed by the read that crossed the limit
+            continue;
+        }
+        dispatchRequest(player, request, request_len);
+        if (player->db_wait)
+            pos -= request_len; //* Parked: dispatched again by resumeDbWaiters()
+    }
+
+    memmove(player->in_buf, player->in_buf + pos, player->in_len - pos);
+    player->in_len -= pos;
+}
+
+// todo: ================= SHARD COMMANDS =====================
+// Attach a player that is now local to the match it was paired into
+void attachToMatch(MatchSession *match, Player *player)
+{
+    player->in_queue = 0;
+    player->in_game = 1;
+    player->match = matchHandleOf(match);
+    int seat = getSeat(match, player->user_id);
+    match->seats[seat].socket_fd = player->socket_fd;
+    resolveMatchStart(match, 1 << seat, 1);
+}
+
+// A player the matchmaker paired with a bot: the bot is attached from the start
+void handleBotMatchCreate(ShardCommand *cmd)
+{
+    Player *p1 = getPairedPlayer(&cmd->player_1);
+    AiPlayer *ai = malloc(sizeof(AiPlayer));
+    MatchSession *match = ai ? createMatchSession(cmd->player_1, cmd->player_2, cmd->fleet_1, cmd->fleet_2) : NULL;
+    if (match && (!ai_init(ai, match->variant, cmd->bot_level, (uint32_t)rand() ^ (uint32_t)match->match_id) ||
+                  !intMapPut(&current_shard->bots, match->match_id, ai)))
+    {
+        dbWriteDeleteMatch(match->match_id);
+        removeMatchSession(match);
+        match = NULL;
+    }
+
+    if (!match)
+    {
+        free(ai);
+        printf("[ERROR] Failed to create match: %s vs bot %s \n", cmd->player_1.username, cmd->player_2.username);
+        if (p1 && !enqueuePlayer(*p1, cmd->fleet_1))
+            p1->in_queue = 0;
+        return;
+    }
+
+    resolveMatchStart(match, 1 << BOT_SEAT, 1);
+    if (p1)
+        attachToMatch(match, p1);
+    else
+        resolveMatchStart(match, 1, 0);
+}
+
+void handleMatchCreate(ShardCommand *cmd)
+{
+    if (cmd->vs_bot)
+    {
+        handleBotMatchCreate(cmd);
+        return;
+    }
+
+    MatchSession *match = createMatchSession(cmd->player_1, cmd->player_2, cmd->fleet_1, cmd->fleet_2);
+    Player *p1 = getPairedPlayer(&cmd->player_1);
+    Player *p2 = (cmd->player_2.shard_id == current_shard->id) ? getPairedPlayer(&cmd->player_2) : NULL;
+
+    if (!match)
+    {
+        //* No room for the match: local players go back to the queue, a migrating one is re-queued on adoption
+        printf("[ERROR] Failed to create match: %s vs %s \n", cmd->player_1.username, cmd->player_2.username);
+        if (p1 && !enqueuePlayer(*p1, cmd->fleet_1))
+            p1->in_queue = 0;
+        if (p2 && !enqueuePlayer(*p2, cmd->fleet_2))
+            p2->in_queue = 0;
+        return;
+    }
+
+    if (p1)
+        attachToMatch(match, p1);
+    else
+        resolveMatchStart(match, 1, 0);
+
+    if (cmd->player_2.shard_id == current_shard->id)
+    {
+        if (p2)
+            attachToMatch(match, p2);
+        else
+            resolveMatchStart(match, 2, 0);
+    }
+    else if (!intMapPut(&current_shard->awaiting, cmd->player_2.user_id, match))
+    {
+        resolveMatchStart(match, 2, 0); //* Could not be found on adoption
+    }
+}
+
+void completeMigration(Player *player)
+{
+    ShardCommand *cmd = player->migrating;
+
+    cmd->player_1 = *player;
+    cmd->player_1.migrating = NULL;
+    cmd->player_1.io = NULL;
+    removeConnectedPlayer(player);
+
+    cmd->type = CMD_ADOPT;
+    shardPost(&shards[cmd->target_shard], cmd);
+}
+
+void handleMigrate(ShardCommand *cmd)
+{
+    Player *player = getPairedPlayer(&cmd->player_1);
+    if (!player)
+    {
+        cmd->player_1.socket_fd = 0; //* Connection is gone
+        cmd->type = CMD_ADOPT;
+        shardPost(&shards[cmd->target_shard], cmd);
+        return;
+    }
+
+    //* Unread input stays in the socket buffer, the new owner picks it up when it starts receiving
+    player->migrating = cmd;
+    if (transportDetach(player))
+        completeMigration(player);
+}
+
+void handleAdopt(ShardCommand *cmd)
+{
+    //* Set by handleMatchCreate(), which always runs first: CMD_MATCH_CREATE is posted before CMD_MIGRATE
+    MatchSession *match = intMapRemove(&current_shard->awaiting, cmd->player_1.user_id);
+
+    if (cmd->player_1.socket_fd == 0)
+    {
+        if (match)
+            resolveMatchStart(match, 1 << getSeat(match, cmd->player_1.user_id), 0);
+        return;
+    }
+
+    Player *slot = addConnectedPlayer(cmd->player_1.socket_fd);
+    if (slot)
+    {
+        *slot = cmd->player_1;
+        slot->shard_id = current_shard->id;
+        slot->db_wait = 0; //* Parked on the old shard, the buffered request runs again below
+        slot->conn_id = ++current_shard->next_conn_id;
+        connTableIndexUser(&current_shard->connections, slot);
+    }
+    if (!slot || !transportAttach(slot))
+    {
+        if (slot)
+            removeConnectedPlayer(slot);
+        sendError(cmd->player_1.socket_fd, "Server full. Try again later.");
+        close(cmd->player_1.socket_fd);
+        releaseConnection();
+        free(cmd->player_1.in_buf);
+        if (match)
+            resolveMatchStart(match, 1 << getSeat(match, cmd->player_1.user_id), 0);
+        return;
+    }
+
+    if (match)
+    {
+        attachToMatch(match, slot);
+    }
+    else if (!enqueuePlayer(*slot, cmd->fleet_1)) //* Match creation failed on this shard
+    {
+        slot->in_queue = 0;
+        sendResult(slot->socket_fd, "QUEUE_EXIT_RES", 1, "Matchmaking failed, please enter the queue again");
+    }
+
+    //* Requests that arrived while the connection was moving
+    if (slot->in_len > 0)
+        handleInput(slot, NULL, 0);
+}
+
+void processMailbox(void)
+{
+    uint64_t pending;
+    if (read(current_shard->wake_fd, &pending, sizeof(pending)) < 0 && errno != EAGAIN)
+        perror("read eventfd");
+
+    pthread_mutex_lock(&current_shard->mailbox_lock);
+    ShardCommand *cmd = current_shard->mailbox_head;
+    current_shard->mailbox_head = current_shard->mailbox_tail = NULL;
+    pthread_mutex_unlock(&current_shard->mailbox_lock);
+
+    while (cmd)
+    {
+        ShardCommand *next = cmd->next;
+        switch (cmd->type)
+        {
+        case CMD_MATCH_CREATE:
+            handleMatchCreate(cmd);
+            free(cmd);
+            break;
+        case CMD_MIGRATE:
+            handleMigrate(cmd); //* Forwarded as CMD_ADOPT, ownership moves with it
+            break;
+        case CMD_ADOPT:
+            handleAdopt(cmd);
+            free(cmd);
+            break;
+        }
+        cmd = next;
+    }
+
+    if (current_shard->db_waiter_count > 0)
+        resumeDbWaiters();
+}
+
+// todo: ================= REACTOR THREAD =====================
+/** Create the shard's own listener (SO_REUSEPORT), mailbox, database connection and reactor backend
+ * @return 1 == success, 0 == failed
+ */
+int initShard(Shard *shard, int id)
+{
+    struct sockaddr_in server_addr;
+    int opt = 1;
+
+    shard->id = id;
+    shard->epoll_fd = -1;
+    pthread_mutex_init(&shard->mailbox_lock, NULL);
+
+    if (!connTableInit(&shard->connections) || !intMapInit(&shard->awaiting) || !intMapInit(&shard->bots))
+        return 0;
+    for (int v = 0; v < GAME_VARIANT_COUNT; v++)
+    {
+        if (!matchPoolInit(&shard->matches[v], v, sizeof(MatchSession) + 2 * game_rules[v].packed_size))
+            return 0;
+    }
+
+    if (db_init(&shard->db, DB_FILE) != 0 || db_configure(&shard->db, durability.synchronous) != 0)
+        return 0;
+    db_set_busy_timeout(&shard->db, REACTOR_DB_BUSY_MS); //* Reads never wait in WAL mode, only a registration can
 
-    // todo: Init listening socket for server
     //  Create socket
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    if ((shard->listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
     {
         perror("socket");
-        exit(EXIT_FAILURE);
+        return 0;
     }
 
-    int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+    //* Every shard binds the same port, the kernel spreads incoming connections across them
+    if (setsockopt(shard->listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        setsockopt(shard->listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
     {
         perror("setsockopt");
-        exit(EXIT_FAILURE);
+        return 0;
     }
 
     memset(&server_addr, 0, sizeof(server_addr));
@@ -310,528 +1364,223 @@ int main(int argc, char const *argv[])
     server_addr.sin_addr.s_addr = INADDR_ANY;
     server_addr.sin_port = htons(PORT);
 
-    if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    if (bind(shard->listen_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
     {
         perror("bind");
-        exit(EXIT_FAILURE);
+        return 0;
     }
 
-    if (listen(server_fd, 3) < 0)
+    if (listen(shard->listen_fd, SOMAXCONN) < 0)
     {
         perror("listen");
-        exit(EXIT_FAILURE);
+        return 0;
     }
 
-    printf("Server started on port %d\n", PORT);
+    if ((shard->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    {
+        perror("eventfd");
+        return 0;
+    }
 
-    memset(fds, 0, sizeof(fds));
-    fds[0].fd = server_fd; //* listening socket
-    fds[0].events = POLLIN;
+    return transportInit(shard);
+}
 
-    // todo: init thread
-    pthread_t tid;
-    pthread_create(&tid, NULL, matchmaking_thread, NULL);
+void *reactor_thread(void *arg)
+{
+    current_shard = arg;
+
+    // todo: Pin the shard to one core
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(current_shard->id % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+    transportRun(current_shard);
+
+    transportShutdown(current_shard);
+    connTableFree(&current_shard->connections);
+    for (int v = 0; v < GAME_VARIANT_COUNT; v++)
+        matchPoolFree(&current_shard->matches[v]);
+    intMapFree(&current_shard->awaiting);
+    intMapFree(&current_shard->bots);
+    free(current_shard->db_waiters);
+    db_close(&current_shard->db);
+    close(current_shard->wake_fd);
+    close(current_shard->listen_fd);
+    return NULL;
+}
 
-    // todo: Main loop
-    while (1)
+// todo: ================= BOT ACCOUNTS =======================
+/** Find or create bot_easy, bot_medium and bot_hard with their fixed ratings. Their password hash
+ * is "!", which no SHA-256 hex digest matches, so nobody can log in as a bot
+ * @return 1 == success, 0 == failed (or a player already owns one of the names)
+ */
+int setupBotAccounts(Database *db, BotFallback *fallback)
+{
+    for (int level = 0; level < AI_LEVEL_COUNT; level++)
     {
-        int activity = poll(fds, MAX_CLIENTS + 1, -1);
-        if (activity < 0)
+        char username[64];
+        snprintf(username, sizeof(username), DB_BOT_PREFIX "%s", ai_level_name(level));
+
+        User user = db_get_user(db, username);
+        if (user.id <= 0 && db_create_user(db, username, DB_BOT_PASSWORD_HASH) > 0)
+            user = db_get_user(db, username);
+        if (user.id <= 0 || strcmp(user.password_hash, DB_BOT_PASSWORD_HASH) != 0)
         {
-            perror("poll");
-            break;
+            printf("[WARNING] %s is not a bot account\n", username); //* Registered before the prefix was reserved
+            return 0;
         }
+        if (user.elo != bot_elo[level] && db_update_user_elo(db, username, bot_elo[level]) != 0)
+            return 0;
+
+        fallback->user_id[level] = user.id;
+        fallback->elo[level] = bot_elo[level];
+        snprintf(fallback->username[level], sizeof(fallback->username[level]), "%s", username);
+    }
+    return 1;
+}
+
+// todo: ================= MAIN THREAD ==========================
+int main(int argc, char *argv[])
+{
+    /* code */
+    int opt;
+    shard_count = sysconf(_SC_NPROCESSORS_ONLN);
+    MatchWindow window = {200, 25, 800, WINDOW_LINEAR}; //* Starts at the historical +-200, +25 Elo per second, up to +-800
 
-        //* New connection
-        if (fds[0].revents & POLLIN)
+    // todo: Options: -t <reactor threads> -c <max clients> -w <match window> -d <durability> -m <move storage> -r <retention> -b <bots>
+    while ((opt = getopt(argc, argv, "t:c:w:d:m:r:b:")) != -1)
+    {
+        switch (opt)
         {
-            socklen_t addr_len = sizeof(client_addr);
-            int new_socket = accept(server_fd, (struct sockaddr *)&client_addr, &addr_len);
-            if (new_socket < 0)
+        case 't':
+            shard_count = atoi(optarg);
+            break;
+        case 'c':
+            max_clients = atoi(optarg);
+            break;
+        case 'w':
+            if (!parse_match_window(optarg, &window))
             {
-                perror("accept");
-                continue;
+                fprintf(stderr, "Invalid match window '%s', expected base,rate,cap[,linear|quadratic|sqrt]\n", optarg);
+                return 1;
             }
-
-            printf("New connection from %s:%d\n",
-                   inet_ntoa(client_addr.sin_addr),
-                   ntohs(client_addr.sin_port));
-
-            // todo: Add client
-            int added = 0;
-            pthread_mutex_lock(&connections_lock);
-            for (int i = 0; i < MAX_CLIENTS; i++)
+            break;
+        case 'd':
+            if (!parseDurability(optarg, &durability))
             {
-                if (connectedPlayers[i].socket_fd == 0)
-                {
-                    connectedPlayers[i].socket_fd = new_socket;
-                    connectedPlayers[i].addr = client_addr;
-                    fds[i + 1].fd = new_socket;
-                    fds[i + 1].events = POLLIN;
-                    added = 1;
-                    break;
-                }
+                fprintf(stderr, "Invalid durability '%s', expected off|normal|full[,window_ms[,max_batch]]\n", optarg);
+                return 1;
             }
-            pthread_mutex_unlock(&connections_lock);
-            if (!added)
+            break;
+        case 'm':
+            if (strcmp(optarg, "rows") == 0)
+                db_set_move_storage(DB_MOVES_ROWS);
+            else if (strcmp(optarg, "packed") == 0)
+                db_set_move_storage(DB_MOVES_PACKED);
+            else
             {
-                sendError(new_socket, "Server full. Try again later.");
-                close(new_socket);
+                fprintf(stderr, "Invalid move storage '%s', expected rows|packed\n", optarg);
+                return 1;
             }
-        }
-
-        // todo: Check each client poll
-        for (int i = 0; i < MAX_CLIENTS; i++)
-        {
-            int client_fd = connectedPlayers[i].socket_fd;
-            if (client_fd <= 0)
-                continue;
-            if (fds[i + 1].revents & POLLIN)
+            break;
+        case 'r':
+            if (!parseRetention(optarg, &retention))
             {
-                int valread = recv(client_fd, buffer, BUFFER_SIZE - 1, 0);
-                if (valread <= 0) // todo: Handling disconnection clients
-                {
-                    Player *player = getPlayerBySockFd(client_fd);
-                    if (player->in_queue)
-                    {
-                        dequeuePlayer(player->user_id);
-                    }
-
-                    if (player->in_game)
-                    {
-                        MatchSession *match = getMatchByPlayerClientFd(client_fd);
-                        if (match)
-                        {
-                            Player *opponent = (match->player_1.user_id == player->user_id) ? &match->player_2 : &match->player_1;
-
-                            // Update DB match result
-                            const char *result_str = (player->user_id == match->player_1.user_id) ? "P2_WIN" : "P1_WIN";
-                            db_update_match_result(&db, match->match_id, result_str);
-
-                            // Update ELO
-                            int new_elo_opponent = calculate_elo(opponent->elo, player->elo, 1.0);
-                            int new_elo_disconnected = calculate_elo(player->elo, opponent->elo, 0.0);
-
-                            db_update_user_elo(&db, opponent->username, new_elo_opponent);
-                            db_update_user_elo(&db, player->username, new_elo_disconnected);
-
-                            // Update local state
-                            pthread_mutex_lock(&connections_lock);
-                            opponent->elo = new_elo_opponent;
-                            opponent->in_game = 0;
-                            pthread_mutex_unlock(&connections_lock);
-
-                            // Notify opponent
-                            sendMatchResult(opponent->socket_fd, match->match_id, "WIN", new_elo_opponent);
-
-                            printf("[DISCONNECT IN GAME] Player %s disconnected, %s wins by default!\n", player->username, opponent->username);
-
-                            // Remove match
-                            removeMatchSession(match->match_id);
-                        }
-                    }
-
-                    if (player)
-                        printf("Disconnection from %s:%d\n", inet_ntoa(player->addr.sin_addr), ntohs(player->addr.sin_port));
-                    pthread_mutex_lock(&connections_lock);
-                    memset(player, 0, sizeof(player));
-                    pthread_mutex_unlock(&connections_lock);
-                    close(client_fd);
-                    fds[i + 1].fd = 0;
-                }
-                else
-                {
-                    buffer[valread] = '\0';
-                    // printf("%s \n", buffer);
-                    cJSON *payload = cJSON_Parse(buffer);
-                    if (!payload)
-                    {
-                        sendError(client_fd, "Payload is not valid");
-                        continue;
-                    }
-                    // printf("Received payload: %s\n", cJSON_Print(payload));
-                    //  todo: Get client information
-                    Player *player = getPlayerBySockFd(client_fd);
-
-                    if (!player)
-                    {
-                        sendError(client_fd, "Player not found.");
-                        continue;
-                        ;
-                    }
-
-                    // todo: Get the endpoint type
-                    cJSON *endpoint_type = cJSON_GetObjectItem(payload, "type");
-
-                    if (cJSON_IsString(endpoint_type) && endpoint_type->valuestring != NULL) // todo: Checking null endpoint
-                    {
-                        const char *endpoint = endpoint_type->valuestring;
-                        printf("[%s] %s:%d\n", endpoint, inet_ntoa(player->addr.sin_addr), ntohs(player->addr.sin_port));
-
-                        // todo: REGISTER
-                        if (strcmp(endpoint, "REGISTER_REQ") == 0)
-                        {
-                            cJSON *username_json = cJSON_GetObjectItem(payload, "username");
-                            cJSON *password_json = cJSON_GetObjectItem(payload, "password");
-                            if (!username_json || !password_json)
-                            {
-                                sendError(client_fd, "No username or password");
-                                continue;
-                            }
-
-                            char password_hash[65];
-                            hash_password(password_json->valuestring, password_hash);
-
-                            int success = db_create_user(&db, username_json->valuestring, password_hash);
-
-                            sendResult(client_fd, "REGISTER_RES", success ? 1 : 0, success ? "Success register" : "Failed to insert to database");
-                        }
-                        // todo: LOGIN
-                        else if (strcmp(endpoint, "LOGIN_REQ") == 0)
-                        {
-                            cJSON *username_json = cJSON_GetObjectItem(payload, "username");
-                            cJSON *password_json = cJSON_GetObjectItem(payload, "password");
-
-                            if (!username_json || !password_json ||
-                                !cJSON_IsString(username_json) || !cJSON_IsString(password_json))
-                            {
-                                sendResult(client_fd, "LOGIN_RES", 0, "Missing ");
-                                continue;
-                            }
-
-                            const char *username = username_json->valuestring;
-                            const char *password = password_json->valuestring;
-
-                            // Hash the password
-                            char password_hash[65];
-                            hash_password(password, password_hash);
-
-                            // Get user from database
-                            User db_user = db_get_user(&db, username);
-
-                            // Check if user exists and password matches
-                            if (db_user.id > 0 && strcmp(db_user.password_hash, password_hash) == 0)
-                            {
-                                // Successful login, update player struct
-                                pthread_mutex_lock(&connections_lock);
-                                player->user_id = db_user.id;
-                                strncpy(player->username, db_user.username, sizeof(player->username) - 1);
-                                player->elo = db_user.elo;
-                                player->is_login = 1;
-                                pthread_mutex_unlock(&connections_lock);
-
-                                // Send login response
-                                sendLoginResult(client_fd, db_user.id, db_user.username, db_user.elo);
-                                printf("Player logged in: %s (ELO %d)\n", db_user.username, db_user.elo);
-                            }
-                            else
-                            {
-                                // Failed login
-                                sendResult(client_fd, "LOGIN_RES", 0, "Wrong password or username");
-                                printf("Failed login attempt: %s\n", username);
-                            }
-                        }
-                        // todo: LOGOUT
-                        else if (strcmp(endpoint, "LOGOUT") == 0)
-                        {
-
-                            pthread_mutex_lock(&connections_lock);
-                            player->user_id = 0;
-                            player->is_login = 0;
-                            player->in_game = 0;
-                            player->in_queue = 0;
-                            player->elo = 0;
-                            memset(player->username, 0, sizeof(player->username));
-                            sendResult(client_fd, "LOGOUT_RES", 1, "Success logout");
-                            pthread_mutex_unlock(&connections_lock);
-                        }
-                        // todo: ENTER WAITING QUEUE
-                        else if (strcmp(endpoint, "QUEUE_ENTER_REQ") == 0)
-                        {
-                            if (!player->is_login)
-                            {
-                                sendResult(client_fd, "QUEUE_ENTER_RES", 0, "Use is not login");
-                                continue;
-                            }
-
-                            cJSON *ships_json = cJSON_GetObjectItem(payload, "ships");
-                            if (!ships_json || !cJSON_IsObject(ships_json))
-                            {
-                                sendResult(client_fd, "QUEUE_ENTER_RES", 0, "No ships was found");
-                                continue;
-                            }
-
-                            // todo: Init board for player
-                            BoardState board;
-                            init_board_state(&board);
-
-                            // todo: Place ship
-                            if (!place_ship_from_json(&board, ships_json, "carrier", CARRIER) ||
-                                !place_ship_from_json(&board, ships_json, "battleship", BATTLESHIP) ||
-                                !place_ship_from_json(&board, ships_json, "cruiser", CRUISER) ||
-                                !place_ship_from_json(&board, ships_json, "submarine", SUBMARINE) ||
-                                !place_ship_from_json(&board, ships_json, "destroyer", DESTROYER))
-                            {
-                                sendResult(client_fd, "QUEUE_ENTER_RES", 0, "Failed to place ship");
-                                continue;
-                            }
-
-                            // todo:  Add player to queue
-                            if (enqueuePlayer(*player, board))
-                            {
-                                pthread_mutex_lock(&connections_lock);
-                                player->in_queue = 1;
-                                pthread_mutex_unlock(&connections_lock);
-
-                                sendResult(client_fd, "QUEUE_ENTER_RES", 1, "Enter queue success");
-                                printf("Player %s entered matchmaking queue\n", player->username);
-                            }
-                            else
-                            {
-
-                                sendResult(client_fd, "QUEUE_ENTER_RES", 0, "Failed to enter the queue");
-                            }
-                        }
-                        // todo: EXIT WAITING QUEUE
-                        else if (strcmp(endpoint, "QUEUE_EXIT_REQ") == 0)
-                        {
-
-                            if (dequeuePlayer(player->user_id))
-                            {
-                                pthread_mutex_lock(&connections_lock);
-                                player->in_queue = 0;
-                                pthread_mutex_unlock(&connections_lock);
-                                sendResult(client_fd, "QUEUE_EXIT_RES", 1, "Exit queue success");
-                            }
-                            else
-                            {
-                                sendResult(client_fd, "QUEUE_EXIT_RES", 0, "Exit queue failed");
-                            }
-                        }
-                        // todo: MOVE
-                        else if (strcmp(endpoint, "MOVE_REQ") == 0)
-                        {
-                            cJSON *match_id_json = cJSON_GetObjectItem(payload, "match_id");
-                            cJSON *row_json = cJSON_GetObjectItem(payload, "row");
-                            cJSON *col_json = cJSON_GetObjectItem(payload, "col");
-
-                            if (!match_id_json || !row_json || !col_json)
-                            {
-                                sendError(client_fd, "Invalid MOVE_REQ payload.");
-                                continue;
-                            }
-
-                            int match_id = match_id_json->valueint;
-                            int row = row_json->valueint;
-                            int col = col_json->valueint;
-
-                            MatchSession *match = getMatchById(match_id);
-                            if (!match)
-                            {
-                                sendError(client_fd, "Match not found.");
-                                continue;
-                            }
-
-                            // Identify player and opponent
-                            Player *attacker = NULL;
-                            Player *opponent = NULL;
-                            BoardState *opponent_board = NULL;
-                            int next_turn_user_id;
-
-                            // todo: Check who is attacker and opponent
-                            if (match->player_1.user_id == player->user_id)
-                            {
-                                if (match->current_turn != player->user_id)
-                                {
-                                    sendError(client_fd, "Not your turn.");
-                                    continue;
-                                }
-                                attacker = &match->player_1;
-                                opponent = &match->player_2;
-                                opponent_board = &match->board_p2; // Only attack opponent's board
-                                next_turn_user_id = match->player_2.user_id;
-                            }
-                            else if (match->player_2.user_id == player->user_id)
-                            {
-                                if (match->current_turn != player->user_id)
-                                {
-                                    sendError(client_fd, "Not your turn.");
-                                    continue;
-                                }
-                                attacker = &match->player_2;
-                                opponent = &match->player_1;
-                                opponent_board = &match->board_p1; // Only attack opponent's board
-                                next_turn_user_id = match->player_1.user_id;
-                            }
-                            else
-                            {
-                                sendError(client_fd, "You are not part of this match.");
-                                continue;
-                            }
-
-                            // Perform the attack
-                            AttackResult result = attack_cell(opponent_board, row, col);
-                            const char *result_str = NULL;
-
-                            switch (result)
-                            {
-                            case ATTACK_INVALID:
-                                sendError(client_fd, "Invalid move.");
-                                continue;
-                            case ATTACK_MISS:
-                                result_str = "MISS";
-                                break;
-                            case ATTACK_HIT:
-                                result_str = "HIT";
-                                break;
-                            case ATTACK_SUNK:
-                                result_str = "SUNK";
-                                break;
-                            }
-                            // todo: Insert move to database
-                            if (db_create_move(&db, match_id, attacker->username, col, row, result_str) <= 0)
-                            {
-                                printf("[ERROR] Failed insert move into database... \n");
-                            }
-
-                            // todo: Check for match end
-                            if (all_ships_sunk(opponent_board))
-                            {
-                                // Notify both players of move result --> End game next turn 0 means no move next move
-                                sendMoveResult(attacker->socket_fd, match_id, attacker->username, row, col, result_str, 0);
-                                sendMoveResult(opponent->socket_fd, match_id, attacker->username, row, col, result_str, 0);
-
-                                // Update next turn
-                                match->current_turn = 0;
-
-                                const char *winner_str = (attacker->user_id == match->player_1.user_id) ? "P1_WIN" : "P2_WIN";
-
-                                // todo: Update ELOs
-                                int new_elo_attacker = calculate_elo(attacker->elo, opponent->elo, 1.0);
-                                int new_elo_opponent = calculate_elo(opponent->elo, attacker->elo, 0.0);
-
-                                db_update_user_elo(&db, attacker->username, new_elo_attacker);
-                                db_update_user_elo(&db, opponent->username, new_elo_opponent);
-                                db_update_match_result(&db, match_id, winner_str);
-
-                                pthread_mutex_lock(&connections_lock);
-                                attacker->elo = new_elo_attacker;
-                                opponent->elo = new_elo_opponent;
-                                attacker->in_game = 0;
-                                opponent->in_game = 0;
-                                pthread_mutex_unlock(&connections_lock);
-
-                                // Notify players
-                                sendMatchResult(attacker->socket_fd, match_id, "WIN", new_elo_attacker);
-                                sendMatchResult(opponent->socket_fd, match_id, "LOSE", new_elo_opponent);
-                                printf("[GAME OVER] Match %d: %s won!\n", match_id, attacker->username);
-                                removeMatchSession(match_id);
-                            }
-                            else
-                            {
-                                // Notify both players of move result
-                                sendMoveResult(attacker->socket_fd, match_id, attacker->username, row, col, result_str, next_turn_user_id);
-                                sendMoveResult(opponent->socket_fd, match_id, attacker->username, row, col, result_str, next_turn_user_id);
-
-                                // Update next turn
-                                match->current_turn = next_turn_user_id;
-                            }
-                        }
-                        // todo: RESIGN
-                        else if (strcmp(endpoint, "RESIGN_REQ") == 0)
-                        {
-                            cJSON *match_id_json = cJSON_GetObjectItem(payload, "match_id");
-                            cJSON *user_id_json = cJSON_GetObjectItem(payload, "user_id");
-
-                            if (!match_id_json || !user_id_json)
-                            {
-                                sendError(client_fd, "Invalid RESIGN_REQ payload.");
-                                continue;
-                            }
-
-                            int match_id = match_id_json->valueint;
-                            int user_id = user_id_json->valueint;
-
-                            MatchSession *match = getMatchById(match_id);
-                            if (!match)
-                            {
-                                sendError(client_fd, "Match not found.");
-                                continue;
-                            }
-
-                            int winner_id;
-                            const char *result_str;
-                            int elo_change;
-
-                            Player *resigner = NULL;
-                            Player *opponent = NULL;
-
-                            if (match->player_1.user_id == user_id)
-                            {
-                                resigner = &match->player_1;
-                                opponent = &match->player_2;
-                                result_str = "P2_WIN";
-                            }
-                            else if (match->player_2.user_id == user_id)
-                            {
-                                resigner = &match->player_2;
-                                opponent = &match->player_1;
-                                result_str = "P1_WIN";
-                            }
-                            else
-                            {
-                                sendError(client_fd, "You are not part of this match.");
-                                continue;
-                            }
-
-                            // Update DB match result
-                            db_update_match_result(&db, match_id, result_str);
-
-                            // Calculate ELO change
-                            int new_elo_opponent = calculate_elo(opponent->elo, resigner->elo, 1.0);
-                            int new_elo_resigner = calculate_elo(resigner->elo, opponent->elo, 0.0);
-
-                            db_update_user_elo(&db, opponent->username, new_elo_opponent);
-                            db_update_user_elo(&db, resigner->username, new_elo_resigner);
-
-                            // Update local state
-                            pthread_mutex_lock(&connections_lock);
-                            opponent->elo = new_elo_opponent;
-                            resigner->elo = new_elo_resigner;
-                            opponent->in_game = 0;
-                            resigner->in_game = 0;
-                            pthread_mutex_unlock(&connections_lock);
-
-                            // Notify both players
-                            sendMatchResult(resigner->socket_fd, match_id, "LOSE", resigner->elo);
-                            sendMatchResult(opponent->socket_fd, match_id, "WIN", opponent->elo);
-
-                            printf("[GAME OVER] Match %d: %s resigned, %s wins!\n", match_id, resigner->username, opponent->username);
-
-                            // Remove match from session
-                            removeMatchSession(match_id);
-                        }
-                        else // todo: UNKNOWN
-                        {
-                            printf("[UNKNOWN] %s:%d\n", inet_ntoa(player->addr.sin_addr), ntohs(player->addr.sin_port));
-                            sendError(client_fd, "Unknown endpoint type.");
-                        }
-                    }
-                    else // todo: Handling null endpoint
-                    {
-                        printf("[NULL] %s:%d\n", inet_ntoa(player->addr.sin_addr), ntohs(player->addr.sin_port));
-                        sendError(client_fd, "Null endpoint type.");
-                    }
-
-                    // todo: Free cJSON payload (memory leak)
-                    cJSON_Delete(payload);
-                }
+                fprintf(stderr, "Invalid retention '%s', expected max_age_s[,batch]\n", optarg);
+                return 1;
             }
+            break;
+        case 'b':
+            if (!parseBotFallback(optarg, &bots))
+            {
+                fprintf(stderr, "Invalid bots '%s', expected after_s[,easy|medium|hard|auto]\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-t reactor_threads] [-c max_clients] [-w base,rate,cap[,curve]] [-d synchronous[,window_ms[,max_batch]]] [-m rows|packed] [-r max_age_s[,batch]] [-b after_s[,level]]\n", argv[0]);
+            return 1;
         }
     }
+    if (shard_count < 1)
+        shard_count = 1;
+    if (shard_count > MAX_SHARDS)
+        shard_count = MAX_SHARDS;
+    if (max_clients < 1)
+        max_clients = DEFAULT_MAX_CLIENTS;
+
+    // todo: One fd per client plus listeners, eventfds and database files
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        rlim_t wanted = (rlim_t)max_clients + 64 + 4 * shard_count;
+        if (limit.rlim_cur < wanted)
+        {
+            limit.rlim_cur = (limit.rlim_max == RLIM_INFINITY || limit.rlim_max > wanted) ? wanted : limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+        if (limit.rlim_cur < wanted)
+            printf("[WARNING] Open file limit is %lu, fewer than %d clients can connect\n", (unsigned long)limit.rlim_cur, max_clients);
+    }
 
-    // todo: Exit server
+    srand(time(NULL));
+
+    // todo: Init database, logins read users through the cache
+    if (!user_cache_init(DEFAULT_USER_CACHE_SIZE))
+        printf("[WARNING] Not enough memory for the user cache, logins read the database\n");
+
+    Database db;
+    if (db_init(&db, DB_FILE) != 0 || db_configure(&db, durability.synchronous) != 0)
+        return 1;
+    db_create_tables(&db);
+    if (bots.after_ms > 0 && !setupBotAccounts(&db, &bots))
+    {
+        printf("[WARNING] Cannot set up the bot accounts, players are never paired with a bot\n");
+        bots.after_ms = 0;
+    }
+    int ranked = leaderboard_load(&db);
+    if (ranked < 0)
+        printf("[WARNING] Cannot load the leaderboard\n");
+    else
+        printf("Leaderboard: %d users ranked\n", ranked);
     db_close(&db);
-    close(server_fd);
+
+    if (!matchmakerInit(&window, &bots))
+        return 1;
+
+    //* Game writes (moves, Elo, results) go through one write-behind thread
+    if (!dbWriterInit(DB_FILE, &durability, &retention))
+    {
+        fprintf(stderr, "Cannot start the database writer\n");
+        return 1;
+    }
+
+    // todo: Init one listening socket, reactor backend and connection table per shard
+    shards = calloc(shard_count, sizeof(Shard));
+    if (!shards)
+    {
+        perror("calloc");
+        return 1;
+    }
+    for (int i = 0; i < shard_count; i++)
+    {
+        if (!initShard(&shards[i], i))
+            exit(EXIT_FAILURE);
+    }
+
+    printf("Server started on port %d with %d reactor threads, up to %d clients\n", PORT, shard_count, max_clients);
+
+    // todo: init thread
+    pthread_t tid;
+    pthread_create(&tid, NULL, matchmaking_thread, NULL);
+
+    for (int i = 0; i < shard_count; i++)
+        pthread_create(&shards[i].thread, NULL, reactor_thread, &shards[i]);
+
+    // todo: Exit server
+    for (int i = 0; i < shard_count; i++)
+        pthread_join(shards[i].thread, NULL);
+    dbWriterShutdown();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,197 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "database.h"
+#include "game.h"
+#include "connection.h"
+#include "match_pool.h"
+#include "intmap.h"
+
+#define PORT 8080
+#define DB_FILE "games.db"
+#define BUFFER_SIZE 4096        //* Bytes per recv
+#define MAX_REQUEST_SIZE 65536 //* Longest request, longer ones are answered with an error and skipped
+#define DEFAULT_MAX_CLIENTS 100000 //* Connections across all shards, -c overrides
+#define MAX_EVENTS 64
+#define MAX_SHARDS 64
+#define HISTORY_PAGE_DEFAULT 20 //* Matches per HISTORY_RES page
+#define HISTORY_PAGE_MAX 100
+#define REACTOR_DB_BUSY_MS 100  //* Longest a reactor's own write (REGISTER_REQ) waits for the writer thread's lock
+
+struct ShardCommand;
+
+//* ================== TYPES ==================
+//* How requests are cut out of a connection's byte stream
+typedef enum
+{
+    FRAMING_AUTO = 0, //* Legacy: back-to-back JSON objects, optional whitespace/newlines between them
+    FRAMING_NDJSON    //* Negotiated with HELLO_REQ: one JSON object per line, responses end with '\n'
+} Framing;
+
+//* An oversized request is dropped as it arrives, up to its end
+typedef struct
+{
+    int active;
+    int depth; //* String-aware brace matching like scanJsonObject(), FRAMING_AUTO only
+    int in_string;
+    int escaped;
+} InputDiscard;
+
+typedef struct Player
+{
+    //* CLIENT SOCKET information
+    int socket_fd;
+    struct sockaddr_in addr;
+    int shard_id; //* Reactor thread that owns this socket
+    //* Status
+    int in_game;
+    int is_login;
+    int in_queue;
+    //* User information
+    int user_id;
+    char username[64];
+    int elo;
+    //* Input stream, owned by the live connection (copies of a Player must not use it)
+    char *in_buf;
+    size_t in_len;
+    size_t in_cap;
+    Framing framing;
+    InputDiscard discard;
+    //* Transport state, only meaningful on the owning shard
+    unsigned int conn_id;           //* Tells a live connection apart from an earlier one in the same slot
+    struct ShardCommand *migrating; //* Hand-over waiting for in-flight I/O to finish
+    void *io;                       //* Backend private per-connection state
+    MatchHandle match;              //* Match this connection plays in (hosted by the same shard)
+    int db_wait;                    //* First buffered request waits for the database writer
+} Player;
+
+typedef struct
+{
+    Player player;
+    FleetLayout fleet;
+} WaitingPlayer;
+
+//* A player of a match. The name, address and the rest of the Player stay in the shard's
+//* connection table, reached through socket_fd once the connection is attached
+typedef struct
+{
+    int user_id;
+    int socket_fd;
+    int elo; //* Rating the match is scored with
+} MatchSeat;
+
+//* Hot state of a live match, a fixed 120 bytes for classic so a shard can hold millions (bench/match_bench.c)
+typedef struct MatchSession
+{
+    int match_id;
+    unsigned int slot;       //* Position in the shard's MatchPool
+    unsigned int generation; //* Bumped when the slot is released
+    MatchSeat seats[2];      //* seats[0] == player 1
+    unsigned char variant;   //* GameVariant, also which of the shard's pools holds the session
+    unsigned char turn;      //* Seat to move
+    //* Start handshake: bit 0 = player 1, bit 1 = player 2. MATCH_FOUND is sent once attached_mask == 3
+    unsigned char attached_mask; //* Player's connection lives on this shard
+    unsigned char gone_mask;     //* Player disconnected before the match started
+    //* Packed boards of seats 0 and 1, game_rules[variant].packed_size bytes each (matchBoard()):
+    //* the fleet of a seat, attacked by the other seat. The shots fired give the next turn_order
+    uint64_t boards[];
+} MatchSession;
+
+//* Connection whose request was parked until the database writer commits
+typedef struct
+{
+    Player *player;
+    unsigned int conn_id; //* The slot may have been reused by then
+} DbWaiter;
+
+//* Usernames of a stored Match, resolved from its player ids for a response
+typedef struct
+{
+    char player1[64];
+    char player2[64];
+} MatchPlayers;
+
+//* Cross-shard messages, processed by the receiving reactor thread only
+typedef enum
+{
+    CMD_MATCH_CREATE, //* matchmaker -> match shard: host a new match
+    CMD_MIGRATE,      //* matchmaker -> player's shard: hand the connection over to target_shard
+    CMD_ADOPT         //* player's old shard -> match shard: take ownership of the connection
+} ShardCommandType;
+
+typedef struct ShardCommand
+{
+    ShardCommandType type;
+    struct ShardCommand *next;
+    int target_shard; //* CMD_MIGRATE
+    Player player_1;  //* CMD_MATCH_CREATE, CMD_MIGRATE and CMD_ADOPT (socket_fd == 0 -> connection is gone)
+    Player player_2;  //* CMD_MATCH_CREATE (a bot: socket_fd == -1)
+    FleetLayout fleet_1;
+    FleetLayout fleet_2;
+    int vs_bot;    //* CMD_MATCH_CREATE: player 2 is a bot
+    int bot_level; //* AiLevel of the bot
+} ShardCommand;
+
+typedef struct
+{
+    int id;
+    pthread_t thread;
+    int listen_fd;
+    int wake_fd; //* eventfd, signalled when the mailbox is not empty
+    pthread_mutex_t mailbox_lock;
+    ShardCommand *mailbox_head;
+    ShardCommand *mailbox_tail;
+    //* Only touched by the owning thread
+    int epoll_fd; //* epoll backend
+    void *io;     //* Backend private per-shard state
+    unsigned int next_conn_id;
+    Database db;
+    ConnTable connections;
+    MatchPool matches[GAME_VARIANT_COUNT]; //* One pool per variant, its sessions have room for its boards
+    IntMap awaiting; //* user_id -> pending match whose player's connection is migrating in
+    IntMap bots;     //* match_id -> AiPlayer of a match against a bot (it plays seat 1)
+    DbWaiter *db_waiters;
+    int db_waiter_count;
+    int db_waiter_capacity;
+    int db_notify; //* Set while db_waiters is not empty, the writer then signals wake_fd (atomic)
+} Shard;
+
+//* ================== SHARDS ==================
+extern Shard *shards;
+extern int shard_count;
+extern int max_clients;
+extern __thread Shard *current_shard; //* Shard owned by the calling reactor thread
+
+/** Queue a command for a shard and wake its reactor (any thread), ownership of cmd moves to the shard */
+void shardPost(Shard *shard, ShardCommand *cmd);
+
+//* ================== TRANSPORT CALLBACKS ==================
+//* Called by the reactor backend on the shard's own thread
+
+/** Take a connection slot for a newly accepted socket and start watching it
+ * @return the player, NULL if the server is full (the socket is closed)
+ */
+Player *acceptPlayer(int socket_fd, const struct sockaddr_in *addr);
+
+/** Append bytes received on a connection to its input stream and handle every complete request in it */
+void handleInput(Player *player, const char *data, size_t len);
+
+/** Connection closed or failed: leave queue/match and free the slot */
+void handleDisconnect(Player *player);
+
+/** Finish a migration once the backend has no more I/O in flight for the connection */
+void completeMigration(Player *player);
+
+/** Apply the commands posted to the shard's mailbox */
+void processMailbox(void);
+
+Player *getPlayerBySockFd(int socket_fd);
+
+/** Framing negotiated by the connection on socket_fd (FRAMING_AUTO if unknown) */
+Framing getConnectionFraming(int socket_fd);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+#include "server.h"
+
+//* Reactor backend of a shard. One of transport_epoll.c (default) or
+//* transport_uring.c (-DUSE_IO_URING, link with -luring) is compiled in;
+//* both drive the same handlers declared in server.h.
+
+//* Per-connection output limits. Above the high-water mark the connection's input is paused
+//* until its output drains below the low-water mark; above the hard limit it is disconnected.
+#define OUTPUT_LOW_WATER (64 * 1024)
+#define OUTPUT_HIGH_WATER (256 * 1024)
+#define OUTPUT_HARD_LIMIT (1024 * 1024)
+
+/** Set up the backend for a shard (listener and mailbox fds are already open)
+ * @return 1 == success, 0 == failed
+ */
+int transportInit(Shard *shard);
+
+/** Run the shard's event loop on the calling thread, only returns on a fatal error */
+void transportRun(Shard *shard);
+
+/** Release the backend resources of a shard */
+void transportShutdown(Shard *shard);
+
+/** Start receiving on a connection of the current shard
+ * @return 1 == success, 0 == failed
+ */
+int transportAttach(Player *player);
+
+/** Stop receiving on a connection that moves to another shard. Pending output is still sent.
+ * @return 1 == detached, 0 == in progress, completeMigration() is called when done
+ */
+int transportDetach(Player *player);
+
+/** Drop all I/O of a connection that is about to be closed */
+void transportRelease(Player *player);
+
+/** Receive again on a connection whose input was paused while a request waited for the database writer
+ * @return 1 == success, 0 == failed (the connection must be disconnected)
+ */
+int transportResume(Player *player);
+
+/** Queue bytes for a connection (sendResponse() goes through here). Output produced for the
+ * same connection during one loop iteration leaves in a single write at the end of the iteration.
+ * @return number of bytes queued, -1 on error or when the connection is over its hard limit
+ */
+int transportSend(int sock_fd, const char *data, size_t len);
+
+#endif
@@ -0,0 +1,478 @@
+#ifndef USE_IO_URING
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "transport.h"
+
+#define MAX_IOV 64 //* Queued chunks written per writev
+
+// todo: =============== TYPES DEFINITIONS =================
+typedef struct OutChunk
+{
+    struct OutChunk *next;
+    size_t len;
+    size_t off; //* Bytes of this chunk already written
+    char data[];
+} OutChunk;
+
+typedef struct
+{
+    OutChunk *out_head; //* Pending output, oldest first
+    OutChunk *out_tail;
+    size_t out_bytes;
+    int dirty;      //* Listed in the shard's flush list
+    int want_write; //* EPOLLOUT registered, the socket buffer was full
+    int throttled;  //* Input paused until the output drains below OUTPUT_LOW_WATER
+    int overflow;   //* Over OUTPUT_HARD_LIMIT, disconnected at the next flush
+    int closing;    //* The client shut down its side, disconnected once the output is written
+    int unread;     //* Input was paused with bytes possibly left in the socket, read again at the next flush
+} EpollConn;
+
+typedef struct
+{
+    Player *player;
+    unsigned int conn_id;
+} DirtyEntry;
+
+typedef struct
+{
+    DirtyEntry *dirty; //* Connections with new output, flushed at the end of each loop iteration
+    int dirty_count;
+    int dirty_capacity;
+} EpollShard;
+
+// todo: ================= HELPER FUNCTIONS ===================
+static int setWriteInterest(Player *player, int want_write)
+{
+    EpollConn *conn = player->io;
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (want_write ? EPOLLOUT : 0);
+    ev.data.ptr = player;
+    if (epoll_ctl(current_shard->epoll_fd, EPOLL_CTL_MOD, player->socket_fd, &ev) < 0)
+        return 0;
+    conn->want_write = want_write;
+    return 1;
+}
+
+static void markDirty(Player *player)
+{
+    EpollShard *es = current_shard->io;
+    EpollConn *conn = player->io;
+    if (conn->dirty)
+        return;
+
+    if (es->dirty_count == es->dirty_capacity)
+    {
+        int capacity = es->dirty_capacity ? es->dirty_capacity * 2 : 64;
+        DirtyEntry *dirty = realloc(es->dirty, sizeof(DirtyEntry) * capacity);
+        if (!dirty)
+            return; //* Stays queued, picked up by the next flush of this connection
+        es->dirty = dirty;
+        es->dirty_capacity = capacity;
+    }
+
+    es->dirty[es->dirty_count].player = player;
+    es->dirty[es->dirty_count].conn_id = player->conn_id;
+    es->dirty_count++;
+    conn->dirty = 1;
+}
+
+static void freeOutput(EpollConn *conn)
+{
+    OutChunk *chunk = conn->out_head;
+    while (chunk)
+    {
+        OutChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    conn->out_head = conn->out_tail = NULL;
+    conn->out_bytes = 0;
+}
+
+// Drop written bytes from the front of the queue
+static void consumeOutput(EpollConn *conn, size_t written)
+{
+    conn->out_bytes -= written;
+    while (written > 0)
+    {
+        OutChunk *chunk = conn->out_head;
+        size_t left = chunk->len - chunk->off;
+        if (written < left)
+        {
+            chunk->off += written;
+            return;
+        }
+        written -= left;
+        conn->out_head = chunk->next;
+        free(chunk);
+    }
+    if (!conn->out_head)
+        conn->out_tail = NULL;
+}
+
+// todo: ================= SETUP ==============================
+int transportInit(Shard *shard)
+{
+    struct epoll_event ev;
+
+    shard->io = calloc(1, sizeof(EpollShard));
+    if (!shard->io)
+        return 0;
+
+    //* Edge-triggered accept loops until EAGAIN
+    int flags = fcntl(shard->listen_fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(shard->listen_fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        perror("fcntl");
+        return 0;
+    }
+
+    if ((shard->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        perror("epoll_create1");
+        return 0;
+    }
+
+    //* The listener and the mailbox are told apart from players by their data.ptr address
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &shard->listen_fd;
+    if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->listen_fd, &ev) < 0)
+    {
+        perror("epoll_ctl");
+        return 0;
+    }
+
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &shard->wake_fd;
+    if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->wake_fd, &ev) < 0)
+    {
+        perror("epoll_ctl");
+        return 0;
+    }
+
+    return 1;
+}
+
+void transportShutdown(Shard *shard)
+{
+    EpollShard *es = shard->io;
+    close(shard->epoll_fd);
+    shard->epoll_fd = -1;
+    if (!es)
+        return;
+    free(es->dirty);
+    free(es);
+    shard->io = NULL;
+}
+
+// todo: ================= CONNECTIONS ========================
+int transportAttach(Player *player)
+{
+    EpollConn *conn = calloc(1, sizeof(EpollConn));
+    if (!conn)
+        return 0;
+
+    //* The connection pointer rides along in data.ptr, so a wakeup never has to look it up
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = player;
+    if (epoll_ctl(current_shard->epoll_fd, EPOLL_CTL_ADD, player->socket_fd, &ev) < 0)
+    {
+        perror("epoll_ctl");
+        free(conn);
+        return 0;
+    }
+    player->io = conn;
+    return 1;
+}
+
+static void finishDetach(Player *player)
+{
+    epoll_ctl(current_shard->epoll_fd, EPOLL_CTL_DEL, player->socket_fd, NULL);
+    free(player->io);
+    player->io = NULL;
+}
+
+int transportDetach(Player *player)
+{
+    EpollConn *conn = player->io;
+    if (conn->out_head)
+    {
+        markDirty(player); //* Reading stops now, the flush that empties the queue calls completeMigration()
+        return 0;
+    }
+
+    finishDetach(player);
+    return 1;
+}
+
+void transportRelease(Player *player)
+{
+    EpollConn *conn = player->io;
+    if (!conn)
+        return;
+
+    epoll_ctl(current_shard->epoll_fd, EPOLL_CTL_DEL, player->socket_fd, NULL);
+    freeOutput(conn);
+    free(conn);
+    player->io = NULL;
+}
+
+int transportResume(Player *player)
+{
+    EpollConn *conn = player->io;
+    conn->unread = 1;
+    markDirty(player); //* Read at the end of the iteration, after the parked request's reply is queued
+    return 1;
+}
+
+int transportSend(int sock_fd, const char *data, size_t len)
+{
+    Player *player = getPlayerBySockFd(sock_fd);
+    if (!player || !player->io)
+        return send(sock_fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT); //* Not a registered connection (e.g. "Server full")
+
+    EpollConn *conn = player->io;
+    if (conn->overflow)
+        return -1;
+
+    if (conn->out_bytes + len > OUTPUT_HARD_LIMIT)
+    {
+        //* The client stopped reading: drop its output, it is disconnected at the end of the iteration
+        printf("[SLOW CLIENT] Socket %d is over the output limit, disconnecting.\n", sock_fd);
+        freeOutput(conn);
+        conn->overflow = 1;
+        markDirty(player);
+        return -1;
+    }
+
+    OutChunk *chunk = malloc(sizeof(OutChunk) + len);
+    if (!chunk)
+        return -1;
+    chunk->next = NULL;
+    chunk->len = len;
+    chunk->off = 0;
+    memcpy(chunk->data, data, len);
+
+    //* Queued only, everything the iteration produced for this connection leaves in one writev
+    if (conn->out_tail)
+        conn->out_tail->next = chunk;
+    else
+        conn->out_head = chunk;
+    conn->out_tail = chunk;
+    conn->out_bytes += len;
+
+    if (conn->out_bytes > OUTPUT_HIGH_WATER)
+        conn->throttled = 1;
+    markDirty(player);
+    return (int)len;
+}
+
+// Accept every pending connection (edge-triggered: loop until EAGAIN)
+static void acceptConnections(Shard *shard)
+{
+    struct sockaddr_in client_addr;
+
+    while (1)
+    {
+        socklen_t addr_len = sizeof(client_addr);
+        int new_socket = accept4(shard->listen_fd, (struct sockaddr *)&client_addr, &addr_len, SOCK_NONBLOCK);
+        if (new_socket < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept");
+            return;
+        }
+
+        acceptPlayer(new_socket, &client_addr);
+    }
+}
+
+// The client will send nothing more: the replies to what it sent are still written before it is dropped
+static void markClosing(Player *player)
+{
+    EpollConn *conn = player->io;
+    conn->closing = 1;
+    markDirty(player); //* The flush disconnects it once the queue is empty
+}
+
+/** Drain a readable client socket (edge-triggered: read until EAGAIN)
+ * @return 1 == still connected, 0 == disconnected
+ */
+static int readConnection(Player *player)
+{
+    char buffer[BUFFER_SIZE];
+    EpollConn *conn = player->io;
+
+    //* While throttled, migrating or parked the bytes stay in the kernel and TCP flow control pushes back on the client
+    while (!conn->throttled && !player->migrating && !player->db_wait)
+    {
+        int valread = recv(player->socket_fd, buffer, sizeof(buffer), 0);
+        if (valread == 0)
+        {
+            markClosing(player);
+            return 1;
+        }
+        if (valread < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : 0;
+        }
+
+        handleInput(player, buffer, valread);
+    }
+    return 1;
+}
+
+/** Write the connection's queue out, as many chunks per writev as the socket takes
+ * @return 1 == still connected, 0 == disconnected
+ */
+static int flushConnection(Player *player)
+{
+    EpollConn *conn = player->io;
+    struct iovec iov[MAX_IOV];
+
+    if (conn->overflow)
+        return 0;
+
+    while (conn->out_head)
+    {
+        int count = 0;
+        for (OutChunk *chunk = conn->out_head; chunk && count < MAX_IOV; chunk = chunk->next, count++)
+        {
+            iov[count].iov_base = chunk->data + chunk->off;
+            iov[count].iov_len = chunk->len - chunk->off;
+        }
+
+        ssize_t written = writev(player->socket_fd, iov, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) //* Socket buffer full, resume on EPOLLOUT
+                return conn->want_write || setWriteInterest(player, 1);
+            return 0;
+        }
+        consumeOutput(conn, written);
+    }
+
+    if (conn->want_write && !setWriteInterest(player, 0))
+        return 0;
+
+    if (player->migrating)
+    {
+        finishDetach(player);
+        completeMigration(player);
+        return 1;
+    }
+
+    if (conn->throttled && conn->out_bytes <= OUTPUT_LOW_WATER)
+    {
+        conn->throttled = 0;
+        conn->unread = 1;
+    }
+    if (conn->unread && !conn->throttled && !player->db_wait)
+    {
+        //* Edge-triggered: input that arrived while paused raises no new event
+        conn->unread = 0;
+        if (!readConnection(player))
+            return 0;
+    }
+    //* New output from the read above keeps it dirty, a parked request still gets its reply
+    return !conn->closing || conn->out_head || player->db_wait;
+}
+
+// Flush every connection that got output during this iteration
+static void flushDirty(EpollShard *es)
+{
+    //* Disconnecting a player may queue output for its opponent, so the list can grow while it is walked
+    for (int i = 0; i < es->dirty_count; i++)
+    {
+        Player *player = es->dirty[i].player;
+        if (player->conn_id != es->dirty[i].conn_id || !player->io)
+            continue; //* Closed since it was marked
+
+        EpollConn *conn = player->io;
+        conn->dirty = 0;
+        if (!flushConnection(player))
+            handleDisconnect(player);
+    }
+    es->dirty_count = 0;
+}
+
+// todo: ================= EVENT LOOP =========================
+void transportRun(Shard *shard)
+{
+    struct epoll_event events[MAX_EVENTS];
+    EpollShard *es = shard->io;
+
+    // todo: Main loop, only ready file descriptors are visited
+    while (1)
+    {
+        int ready = epoll_wait(shard->epoll_fd, events, MAX_EVENTS, -1);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            return;
+        }
+
+        int mailbox = 0;
+        for (int i = 0; i < ready; i++)
+        {
+            void *ptr = events[i].data.ptr;
+
+            //* New connection
+            if (ptr == &shard->listen_fd)
+            {
+                acceptConnections(shard);
+                continue;
+            }
+
+            //* Commands are applied after the batch so no Player pointer in it goes stale
+            if (ptr == &shard->wake_fd)
+            {
+                mailbox = 1;
+                continue;
+            }
+
+            Player *player = ptr;
+            int connected = 1;
+            if (events[i].events & EPOLLOUT)
+            {
+                connected = flushConnection(player);
+                if (connected && !player->io)
+                    continue; //* Drained the last output of a migration, the slot was handed over
+            }
+            if (connected && (events[i].events & EPOLLIN))
+                connected = readConnection(player);
+            if (events[i].events & (EPOLLHUP | EPOLLERR))
+                connected = 0;
+            else if (connected && player->io && (events[i].events & EPOLLRDHUP))
+                markClosing(player); //* Half-closed: input still unread (throttled, migrating) waits in the socket
+
+            if (!connected) // todo: Handling disconnection clients
+                handleDisconnect(player);
+        }
+
+        if (mailbox)
+            processMailbox();
+
+        //* One writev per connection for everything this iteration produced
+        flushDirty(es);
+    }
+}
+#endif
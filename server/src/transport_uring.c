@@ -0,0 +1,553 @@
+#ifdef USE_IO_URING
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <liburing.h>
+
+#include "transport.h"
+
+#define URING_ENTRIES 4096
+#define BUF_RING_ENTRIES 512 //! Must be a power of two
+#define BUF_GROUP_ID 0
+
+//* user_data of the operations that have no UringOp (malloc'd pointers never take these values)
+#define UD_ACCEPT 1
+#define UD_WAKE 2
+#define UD_CANCEL 3
+
+// todo: =============== TYPES DEFINITIONS =================
+typedef enum
+{
+    OP_RECV,
+    OP_SEND
+} UringOpKind;
+
+//* One in-flight request. Completions for a connection that has since been closed
+//* (or whose slot was reused) are recognised by conn_id and dropped.
+typedef struct UringOp
+{
+    UringOpKind kind;
+    Player *player;
+    unsigned int conn_id;
+    struct UringOp *next; //* Staged sends
+    size_t len;
+    char data[]; //* OP_SEND payload
+} UringOp;
+
+typedef struct
+{
+    UringOp *recv;     //* Armed multishot recv, NULL when not receiving
+    UringOp *out_head; //* Sends staged during this loop iteration
+    UringOp *out_tail;
+    int sends_inflight; //* Sends of the last submitted chain not completed yet
+    size_t out_bytes;   //* Staged plus in flight
+    int dirty;          //* Listed in the shard's flush list
+    int throttled;      //* recv cancelled until the output drains below OUTPUT_LOW_WATER
+    int overflow;       //* Over OUTPUT_HARD_LIMIT, the socket was shut down
+    int closing;        //* The client shut down its side, disconnected once the output is written
+    int paused;         //* recv cancelled while the buffered request waits for the database writer
+} UringConn;
+
+typedef struct
+{
+    Player *player;
+    unsigned int conn_id;
+} DirtyEntry;
+
+typedef struct
+{
+    struct io_uring ring;
+    struct io_uring_buf_ring *buf_ring;
+    char *buffers;
+    DirtyEntry *dirty; //* Connections with staged sends, flushed right before each submit
+    int dirty_count;
+    int dirty_capacity;
+    int mailbox;
+} UringShard;
+
+// todo: ================= HELPER FUNCTIONS ===================
+static struct io_uring_sqe *getSqe(UringShard *us)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&us->ring);
+    while (!sqe)
+    {
+        io_uring_submit(&us->ring); //* SQ full, push what we have
+        sqe = io_uring_get_sqe(&us->ring);
+    }
+    return sqe;
+}
+
+static int isLive(UringOp *op)
+{
+    return op->player->conn_id == op->conn_id && op->player->io != NULL;
+}
+
+static void armAccept(Shard *shard)
+{
+    UringShard *us = shard->io;
+    struct io_uring_sqe *sqe = getSqe(us);
+    io_uring_prep_multishot_accept(sqe, shard->listen_fd, NULL, NULL, 0);
+    io_uring_sqe_set_data64(sqe, UD_ACCEPT);
+}
+
+static void armWake(Shard *shard)
+{
+    UringShard *us = shard->io;
+    struct io_uring_sqe *sqe = getSqe(us);
+    io_uring_prep_poll_multishot(sqe, shard->wake_fd, POLLIN);
+    io_uring_sqe_set_data64(sqe, UD_WAKE);
+}
+
+static int armRecv(Player *player)
+{
+    UringShard *us = current_shard->io;
+    UringConn *conn = player->io;
+
+    UringOp *op = calloc(1, sizeof(UringOp));
+    if (!op)
+        return 0;
+    op->kind = OP_RECV;
+    op->player = player;
+    op->conn_id = player->conn_id;
+
+    //* Multishot: one request keeps producing completions, the kernel picks a buffer from the ring for each
+    struct io_uring_sqe *sqe = getSqe(us);
+    io_uring_prep_recv_multishot(sqe, player->socket_fd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP_ID;
+    io_uring_sqe_set_data(sqe, op);
+
+    conn->recv = op;
+    return 1;
+}
+
+static void cancelOp(UringOp *op)
+{
+    UringShard *us = current_shard->io;
+    struct io_uring_sqe *sqe = getSqe(us);
+    io_uring_prep_cancel(sqe, op, 0);
+    io_uring_sqe_set_data64(sqe, UD_CANCEL);
+}
+
+static void recycleBuffer(UringShard *us, unsigned short bid)
+{
+    io_uring_buf_ring_add(us->buf_ring, us->buffers + (size_t)bid * BUFFER_SIZE, BUFFER_SIZE, bid,
+                          io_uring_buf_ring_mask(BUF_RING_ENTRIES), 0);
+    io_uring_buf_ring_advance(us->buf_ring, 1);
+}
+
+static void markDirty(Player *player)
+{
+    UringShard *us = current_shard->io;
+    UringConn *conn = player->io;
+    if (conn->dirty)
+        return;
+
+    if (us->dirty_count == us->dirty_capacity)
+    {
+        int capacity = us->dirty_capacity ? us->dirty_capacity * 2 : 64;
+        DirtyEntry *dirty = realloc(us->dirty, sizeof(DirtyEntry) * capacity);
+        if (!dirty)
+            return; //* Stays staged, picked up by the next completion on this connection
+        us->dirty = dirty;
+        us->dirty_capacity = capacity;
+    }
+
+    us->dirty[us->dirty_count].player = player;
+    us->dirty[us->dirty_count].conn_id = player->conn_id;
+    us->dirty_count++;
+    conn->dirty = 1;
+}
+
+static void freeStaged(UringConn *conn)
+{
+    UringOp *op = conn->out_head;
+    while (op)
+    {
+        UringOp *next = op->next;
+        conn->out_bytes -= op->len;
+        free(op);
+        op = next;
+    }
+    conn->out_head = conn->out_tail = NULL;
+}
+
+// A migrating connection is handed over once receiving stopped and all its output is out
+static void checkMigration(Player *player)
+{
+    UringConn *conn = player->io;
+    if (conn->recv || conn->sends_inflight || conn->out_head)
+        return;
+
+    free(conn);
+    player->io = NULL;
+    completeMigration(player);
+}
+
+/** Submit the staged sends of every dirty connection. Each connection's sends go out
+ * as one IOSQE_IO_LINK chain so they hit the socket in order, and only one chain per
+ * connection is in flight at a time.
+ */
+static void flushSends(UringShard *us)
+{
+    for (int i = 0; i < us->dirty_count; i++)
+    {
+        Player *player = us->dirty[i].player;
+        if (player->conn_id != us->dirty[i].conn_id || !player->io)
+            continue; //* Closed since it was marked
+
+        UringConn *conn = player->io;
+        conn->dirty = 0;
+        if (conn->sends_inflight || !conn->out_head)
+            continue; //* Re-marked when the chain in flight completes
+
+        unsigned int count = 0;
+        for (UringOp *op = conn->out_head; op; op = op->next)
+            count++;
+        if (io_uring_sq_space_left(&us->ring) < count)
+            io_uring_submit(&us->ring); //! A chain must not be split across submissions
+
+        for (UringOp *op = conn->out_head; op; op = op->next)
+        {
+            struct io_uring_sqe *sqe = getSqe(us);
+            io_uring_prep_send(sqe, player->socket_fd, op->data, op->len, MSG_NOSIGNAL | MSG_WAITALL);
+            io_uring_sqe_set_data(sqe, op);
+            if (op->next)
+                sqe->flags |= IOSQE_IO_LINK;
+            conn->sends_inflight++;
+        }
+        conn->out_head = conn->out_tail = NULL;
+    }
+    us->dirty_count = 0;
+}
+
+// todo: ================= SETUP ==============================
+int transportInit(Shard *shard)
+{
+    int ret;
+    UringShard *us = calloc(1, sizeof(UringShard));
+    if (!us)
+        return 0;
+    shard->io = us;
+
+    if ((ret = io_uring_queue_init(URING_ENTRIES, &us->ring, 0)) < 0)
+    {
+        fprintf(stderr, "io_uring_queue_init: %s\n", strerror(-ret));
+        return 0;
+    }
+
+    //* Provided buffer ring shared by every multishot recv of the shard
+    us->buffers = malloc((size_t)BUF_RING_ENTRIES * BUFFER_SIZE);
+    us->buf_ring = io_uring_setup_buf_ring(&us->ring, BUF_RING_ENTRIES, BUF_GROUP_ID, 0, &ret);
+    if (!us->buffers || !us->buf_ring)
+    {
+        fprintf(stderr, "io_uring_setup_buf_ring: %s\n", strerror(-ret));
+        return 0;
+    }
+    for (int i = 0; i < BUF_RING_ENTRIES; i++)
+        io_uring_buf_ring_add(us->buf_ring, us->buffers + (size_t)i * BUFFER_SIZE, BUFFER_SIZE, i,
+                              io_uring_buf_ring_mask(BUF_RING_ENTRIES), i);
+    io_uring_buf_ring_advance(us->buf_ring, BUF_RING_ENTRIES);
+
+    armAccept(shard);
+    armWake(shard);
+    return 1;
+}
+
+void transportShutdown(Shard *shard)
+{
+    UringShard *us = shard->io;
+    if (!us)
+        return;
+    if (us->buf_ring)
+        io_uring_free_buf_ring(&us->ring, us->buf_ring, BUF_RING_ENTRIES, BUF_GROUP_ID);
+    io_uring_queue_exit(&us->ring);
+    free(us->buffers);
+    free(us->dirty);
+    free(us);
+    shard->io = NULL;
+}
+
+// todo: ================= CONNECTIONS ========================
+int transportAttach(Player *player)
+{
+    UringConn *conn = calloc(1, sizeof(UringConn));
+    if (!conn)
+        return 0;
+    player->io = conn;
+    if (!armRecv(player))
+    {
+        free(conn);
+        player->io = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+int transportDetach(Player *player)
+{
+    UringConn *conn = player->io;
+    if (conn->recv)
+    {
+        cancelOp(conn->recv); //* The terminating recv completion calls checkMigration()
+        return 0;
+    }
+    if (conn->sends_inflight || conn->out_head)
+        return 0; //* The last send completion calls checkMigration()
+
+    free(conn);
+    player->io = NULL;
+    return 1;
+}
+
+void transportRelease(Player *player)
+{
+    UringConn *conn = player->io;
+    if (!conn)
+        return;
+
+    //* In-flight ops no longer match the slot's conn_id and are freed on completion
+    if (conn->recv)
+        cancelOp(conn->recv);
+    freeStaged(conn);
+    free(conn);
+    player->io = NULL;
+}
+
+int transportResume(Player *player)
+{
+    UringConn *conn = player->io;
+    conn->paused = 0;
+
+    if (conn->closing)
+        return conn->out_head || conn->sends_inflight; //* The last send completion drops it
+    if (conn->recv || conn->throttled || conn->overflow)
+        return 1; //* Re-armed when the cancelled recv ends or the output drains
+    return armRecv(player);
+}
+
+int transportSend(int sock_fd, const char *data, size_t len)
+{
+    Player *player = getPlayerBySockFd(sock_fd);
+    if (!player || !player->io)
+        return send(sock_fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT); //* Not a registered connection (e.g. "Server full")
+
+    UringConn *conn = player->io;
+    if (conn->overflow)
+        return -1;
+
+    if (conn->out_bytes + len > OUTPUT_HARD_LIMIT)
+    {
+        //* The client stopped reading: drop the staged output and end the connection through its recv
+        printf("[SLOW CLIENT] Socket %d is over the output limit, disconnecting.\n", sock_fd);
+        freeStaged(conn);
+        conn->overflow = 1;
+        shutdown(sock_fd, SHUT_RDWR);
+        return -1;
+    }
+
+    UringOp *op = malloc(sizeof(UringOp) + len);
+    if (!op)
+        return -1;
+    op->kind = OP_SEND;
+    op->player = player;
+    op->conn_id = player->conn_id;
+    op->next = NULL;
+    op->len = len;
+    memcpy(op->data, data, len);
+
+    //* Staged only, the whole loop iteration's output is submitted with one syscall
+    if (conn->out_tail)
+        conn->out_tail->next = op;
+    else
+        conn->out_head = op;
+    conn->out_tail = op;
+    conn->out_bytes += len;
+
+    if (conn->out_bytes > OUTPUT_HIGH_WATER && !conn->throttled)
+    {
+        //* Stop reading, TCP flow control pushes back on the client until its output drains
+        conn->throttled = 1;
+        if (conn->recv)
+            cancelOp(conn->recv);
+    }
+    markDirty(player);
+    return (int)len;
+}
+
+// todo: ================= COMPLETIONS ========================
+static void handleRecvCompletion(UringShard *us, UringOp *op, struct io_uring_cqe *cqe)
+{
+    int live = isLive(op);
+
+    if (cqe->flags & IORING_CQE_F_BUFFER)
+    {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (live && cqe->res > 0)
+        {
+            handleInput(op->player, us->buffers + (size_t)bid * BUFFER_SIZE, cqe->res);
+            UringConn *conn = op->player->io;
+            if (op->player->db_wait && !conn->paused && conn->recv)
+            {
+                //* Parked: the rest stays in the socket until transportResume(), like a throttle
+                conn->paused = 1;
+                cancelOp(conn->recv);
+            }
+        }
+        recycleBuffer(us, bid);
+    }
+
+    if (cqe->flags & IORING_CQE_F_MORE)
+        return; //* Still armed
+
+    Player *player = op->player;
+    free(op);
+    if (!live)
+        return;
+
+    UringConn *conn = player->io;
+    conn->recv = NULL;
+
+    //* Ended without an error: cancelled for a migration, a throttle or a parked request, or ran out of buffers
+    int stopped = cqe->res > 0 || cqe->res == -ENOBUFS || cqe->res == -ECANCELED;
+
+    if (player->migrating && stopped)
+        checkMigration(player);
+    else if ((conn->throttled || player->db_wait) && stopped)
+        return; //* Re-armed by the send completion that drains the output, or by transportResume()
+    else if (stopped)
+    {
+        if (!armRecv(player))
+            handleDisconnect(player);
+    }
+    else if (cqe->res == 0 && !conn->overflow && (conn->out_head || conn->sends_inflight || player->db_wait))
+        conn->closing = 1; //* Half-closed: the replies to what it sent go out first, the last send completion drops it
+    else // todo: Handling disconnection clients
+        handleDisconnect(player);
+}
+
+static void handleSendCompletion(UringOp *op, struct io_uring_cqe *cqe)
+{
+    Player *player = op->player;
+    int live = isLive(op);
+    size_t len = op->len;
+    int failed = cqe->res != (int)len;
+    free(op);
+    if (!live)
+        return;
+
+    UringConn *conn = player->io;
+    conn->sends_inflight--;
+    conn->out_bytes -= len;
+
+    if (failed)
+    {
+        //* Short or failed write: the rest of the chain is cancelled, end the connection through its recv
+        shutdown(player->socket_fd, SHUT_RDWR);
+        freeStaged(conn);
+        if (conn->closing && conn->sends_inflight == 0)
+            handleDisconnect(player); //* No recv left to end it
+        return;
+    }
+
+    if (conn->throttled && conn->out_bytes <= OUTPUT_LOW_WATER && !conn->overflow)
+    {
+        conn->throttled = 0;
+        if (!conn->recv && !player->migrating && !player->db_wait && !conn->closing && !armRecv(player))
+        {
+            handleDisconnect(player);
+            return;
+        }
+    }
+
+    if (conn->sends_inflight == 0)
+    {
+        if (player->migrating)
+            checkMigration(player);
+        if (player->io && conn->out_head)
+            markDirty(player);
+        else if (player->io && conn->closing)
+            handleDisconnect(player);
+    }
+}
+
+static void handleCompletion(Shard *shard, struct io_uring_cqe *cqe)
+{
+    UringShard *us = shard->io;
+    __u64 user_data = io_uring_cqe_get_data64(cqe);
+
+    if (user_data == UD_CANCEL)
+        return;
+
+    //* New connection
+    if (user_data == UD_ACCEPT)
+    {
+        if (cqe->res >= 0)
+        {
+            struct sockaddr_in client_addr;
+            socklen_t addr_len = sizeof(client_addr);
+            memset(&client_addr, 0, sizeof(client_addr));
+            getpeername(cqe->res, (struct sockaddr *)&client_addr, &addr_len);
+            acceptPlayer(cqe->res, &client_addr);
+        }
+        else
+        {
+            fprintf(stderr, "accept: %s\n", strerror(-cqe->res));
+        }
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            armAccept(shard);
+        return;
+    }
+
+    //* Commands are applied after the batch, like the epoll backend
+    if (user_data == UD_WAKE)
+    {
+        us->mailbox = 1;
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            armWake(shard);
+        return;
+    }
+
+    UringOp *op = io_uring_cqe_get_data(cqe);
+    if (op->kind == OP_RECV)
+        handleRecvCompletion(us, op, cqe);
+    else
+        handleSendCompletion(op, cqe);
+}
+
+// todo: ================= EVENT LOOP =========================
+void transportRun(Shard *shard)
+{
+    UringShard *us = shard->io;
+
+    while (1)
+    {
+        //* Every send produced by the previous batch goes out with this one syscall
+        flushSends(us);
+        int ret = io_uring_submit_and_wait(&us->ring, 1);
+        if (ret < 0 && ret != -EINTR)
+        {
+            fprintf(stderr, "io_uring_submit_and_wait: %s\n", strerror(-ret));
+            return;
+        }
+
+        struct io_uring_cqe *cqe;
+        unsigned int head;
+        unsigned int seen = 0;
+        us->mailbox = 0;
+        io_uring_for_each_cqe(&us->ring, head, cqe)
+        {
+            handleCompletion(shard, cqe);
+            seen++;
+        }
+        io_uring_cq_advance(&us->ring, seen);
+
+        if (us->mailbox)
+            processMailbox();
+    }
+}
+#endif
@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "user_cache.h"
+
+// === Types ===
+typedef struct CacheEntry
+{
+    User user;
+    unsigned int hash;
+    struct CacheEntry *chain; //* Next entry in the same bucket
+    struct CacheEntry *prev;  //* LRU list, most recent first
+    struct CacheEntry *next;
+} CacheEntry;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    CacheEntry **buckets;
+    unsigned int *versions; //* Per bucket, bumped by every write so a racing fill can tell it is stale
+    unsigned int bucket_mask;
+    CacheEntry *entries; //* capacity entries, unused ones on free_list
+    CacheEntry *free_list;
+    CacheEntry lru; //* Sentinel: lru.next is the most recent, lru.prev the eviction candidate
+    int capacity;
+    int size;
+    long hits;
+    long misses;
+    long evictions;
+    long invalidations;
+    long name_hits;
+    long name_misses;
+} Segment;
+
+typedef struct
+{
+    int user_id; //* 0 == empty
+    char username[64];
+} NameSlot;
+
+static Segment segments[USER_CACHE_SEGMENTS];
+static int cache_capacity; //* 0 == disabled
+static NameSlot *names;    //* Direct mapped by user id, slot i is guarded by the lock of segment i % USER_CACHE_SEGMENTS
+static unsigned int name_mask;
+
+// === Internal helpers ===
+static unsigned int hash_username(const char *username)
+{
+    unsigned int h = 2166136261u; // FNV-1a
+    for (const unsigned char *c = (const unsigned char *)username; *c; c++)
+        h = (h ^ *c) * 16777619u;
+    return h;
+}
+
+static Segment *segment_of(unsigned int hash)
+{
+    return &segments[hash % USER_CACHE_SEGMENTS];
+}
+
+static unsigned int bucket_of(Segment *segment, unsigned int hash)
+{
+    return (hash / USER_CACHE_SEGMENTS) & segment->bucket_mask;
+}
+
+static CacheEntry *find(Segment *segment, unsigned int hash, const char *username)
+{
+    for (CacheEntry *e = segment->buckets[bucket_of(segment, hash)]; e; e = e->chain)
+    {
+        if (e->hash == hash && strcmp(e->user.username, username) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+static void lru_unlink(CacheEntry *e)
+{
+    e->prev->next = e->next;
+    e->next->prev = e->prev;
+}
+
+static void lru_push_front(Segment *segment, CacheEntry *e)
+{
+    e->prev = &segment->lru;
+    e->next = segment->lru.next;
+    segment->lru.next->prev = e;
+    segment->lru.next = e;
+}
+
+static void remove_entry(Segment *segment, CacheEntry *e)
+{
+    CacheEntry **link = &segment->buckets[bucket_of(segment, e->hash)];
+    while (*link != e)
+        link = &(*link)->chain;
+    *link = e->chain;
+
+    lru_unlink(e);
+    e->chain = segment->free_list;
+    segment->free_list = e;
+    segment->size--;
+}
+
+// === Setup ===
+int user_cache_init(int capacity)
+{
+    int per_segment = (capacity + USER_CACHE_SEGMENTS - 1) / USER_CACHE_SEGMENTS;
+    unsigned int buckets = 16;
+    while (buckets < (unsigned int)per_segment * 2)
+        buckets *= 2;
+
+    for (int i = 0; i < USER_CACHE_SEGMENTS; i++)
+    {
+        Segment *segment = &segments[i];
+        memset(segment, 0, sizeof(Segment));
+        pthread_mutex_init(&segment->lock, NULL);
+        segment->buckets = calloc(buckets, sizeof(CacheEntry *));
+        segment->versions = calloc(buckets, sizeof(unsigned int));
+        segment->entries = calloc(per_segment, sizeof(CacheEntry));
+        if (!segment->buckets || !segment->versions || !segment->entries)
+        {
+            user_cache_free();
+            return 0;
+        }
+        segment->bucket_mask = buckets - 1;
+        segment->capacity = per_segment;
+        segment->lru.prev = segment->lru.next = &segment->lru;
+        for (int j = per_segment - 1; j >= 0; j--)
+        {
+            segment->entries[j].chain = segment->free_list;
+            segment->free_list = &segment->entries[j];
+        }
+    }
+
+    names = calloc(buckets * USER_CACHE_SEGMENTS, sizeof(NameSlot));
+    if (!names)
+    {
+        user_cache_free();
+        return 0;
+    }
+    name_mask = buckets * USER_CACHE_SEGMENTS - 1;
+
+    cache_capacity = per_segment * USER_CACHE_SEGMENTS;
+    return 1;
+}
+
+void user_cache_free(void)
+{
+    cache_capacity = 0;
+    for (int i = 0; i < USER_CACHE_SEGMENTS; i++)
+    {
+        free(segments[i].buckets);
+        free(segments[i].versions);
+        free(segments[i].entries);
+        segments[i].buckets = NULL;
+        segments[i].versions = NULL;
+        segments[i].entries = NULL;
+    }
+    free(names);
+    names = NULL;
+}
+
+// === Lookup ===
+int user_cache_get(const char *username, User *user)
+{
+    if (!cache_capacity)
+        return 0;
+
+    unsigned int hash = hash_username(username);
+    Segment *segment = segment_of(hash);
+
+    pthread_mutex_lock(&segment->lock);
+    CacheEntry *e = find(segment, hash, username);
+    if (e)
+    {
+        *user = e->user;
+        lru_unlink(e);
+        lru_push_front(segment, e);
+        segment->hits++;
+    }
+    else
+        segment->misses++;
+    pthread_mutex_unlock(&segment->lock);
+    return e != NULL;
+}
+
+unsigned int user_cache_version(const char *username)
+{
+    if (!cache_capacity)
+        return 0;
+
+    unsigned int hash = hash_username(username);
+    Segment *segment = segment_of(hash);
+
+    pthread_mutex_lock(&segment->lock);
+    unsigned int version = segment->versions[bucket_of(segment, hash)];
+    pthread_mutex_unlock(&segment->lock);
+    return version;
+}
+
+void user_cache_fill(const User *user, unsigned int version)
+{
+    if (!cache_capacity)
+        return;
+
+    unsigned int hash = hash_username(user->username);
+    Segment *segment = segment_of(hash);
+    unsigned int bucket = bucket_of(segment, hash);
+
+    pthread_mutex_lock(&segment->lock);
+    //* A write landed between the database read and now: the row may predate it
+    if (segment->versions[bucket] != version || find(segment, hash, user->username))
+    {
+        pthread_mutex_unlock(&segment->lock);
+        return;
+    }
+
+    CacheEntry *e = segment->free_list;
+    if (e)
+        segment->free_list = e->chain;
+    else
+    {
+        e = segment->lru.prev; //* Least recently used
+        remove_entry(segment, e);
+        segment->free_list = e->chain;
+        segment->evictions++;
+    }
+
+    e->user = *user;
+    e->hash = hash;
+    e->chain = segment->buckets[bucket];
+    segment->buckets[bucket] = e;
+    lru_push_front(segment, e);
+    segment->size++;
+    pthread_mutex_unlock(&segment->lock);
+}
+
+// === Writes ===
+void user_cache_update(const char *username, int elo, int wins_delta, int losses_delta)
+{
+    if (!cache_capacity)
+        return;
+
+    unsigned int hash = hash_username(username);
+    Segment *segment = segment_of(hash);
+
+    pthread_mutex_lock(&segment->lock);
+    segment->versions[bucket_of(segment, hash)]++;
+    CacheEntry *e = find(segment, hash, username);
+    if (e)
+    {
+        e->user.elo = elo;
+        e->user.wins += wins_delta;
+        e->user.losses += losses_delta;
+    }
+    pthread_mutex_unlock(&segment->lock);
+}
+
+void user_cache_invalidate(const char *username)
+{
+    if (!cache_capacity)
+        return;
+
+    unsigned int hash = hash_username(username);
+    Segment *segment = segment_of(hash);
+
+    pthread_mutex_lock(&segment->lock);
+    segment->versions[bucket_of(segment, hash)]++;
+    CacheEntry *e = find(segment, hash, username);
+    if (e)
+    {
+        remove_entry(segment, e);
+        segment->invalidations++;
+    }
+    pthread_mutex_unlock(&segment->lock);
+}
+
+// === Names by id ===
+static NameSlot *name_slot(int user_id, Segment **segment)
+{
+    unsigned int slot = (unsigned int)user_id & name_mask;
+    *segment = &segments[slot % USER_CACHE_SEGMENTS];
+    return &names[slot];
+}
+
+int user_cache_get_name(int user_id, char *username, int size)
+{
+    if (!cache_capacity || user_id <= 0)
+        return 0;
+
+    Segment *segment;
+    NameSlot *slot = name_slot(user_id, &segment);
+    int hit;
+
+    pthread_mutex_lock(&segment->lock);
+    hit = slot->user_id == user_id;
+    if (hit)
+    {
+        snprintf(username, size, "%s", slot->username);
+        segment->name_hits++;
+    }
+    else
+        segment->name_misses++;
+    pthread_mutex_unlock(&segment->lock);
+    return hit;
+}
+
+void user_cache_fill_name(int user_id, const char *username)
+{
+    if (!cache_capacity || user_id <= 0)
+        return;
+
+    Segment *segment;
+    NameSlot *slot = name_slot(user_id, &segment);
+
+    pthread_mutex_lock(&segment->lock);
+    slot->user_id = user_id; //* Replaces whichever id shared the slot
+    snprintf(slot->username, sizeof(slot->username), "%s", username);
+    pthread_mutex_unlock(&segment->lock);
+}
+
+void user_cache_forget_name(int user_id)
+{
+    if (!cache_capacity || user_id <= 0)
+        return;
+
+    Segment *segment;
+    NameSlot *slot = name_slot(user_id, &segment);
+
+    pthread_mutex_lock(&segment->lock);
+    if (slot->user_id == user_id)
+        slot->user_id = 0;
+    pthread_mutex_unlock(&segment->lock);
+}
+
+void user_cache_get_stats(UserCacheStats *stats)
+{
+    memset(stats, 0, sizeof(UserCacheStats));
+    stats->capacity = cache_capacity;
+    if (!cache_capacity)
+        return;
+
+    for (int i = 0; i < USER_CACHE_SEGMENTS; i++)
+    {
+        Segment *segment = &segments[i];
+        pthread_mutex_lock(&segment->lock);
+        stats->size += segment->size;
+        stats->hits += segment->hits;
+        stats->misses += segment->misses;
+        stats->evictions += segment->evictions;
+        stats->invalidations += segment->invalidations;
+        stats->name_hits += segment->name_hits;
+        stats->name_misses += segment->name_misses;
+        pthread_mutex_unlock(&segment->lock);
+    }
+}
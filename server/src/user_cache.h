@@ -0,0 +1,48 @@
+#ifndef USER_CACHE_H
+#define USER_CACHE_H
+
+#include "database.h"
+
+//* Process-wide LRU cache of users by username, shared by every Database connection.
+//* db_get_user() reads through it, rating updates write through it and db_delete_user()
+//* invalidates it. Split into segments with their own lock and LRU list so logins on
+//* different reactors rarely contend.
+//* Next to it, a direct-mapped users.id -> username map for responses that show players of stored
+//* matches. Usernames never change, so it is only cleared for deleted users.
+
+#define USER_CACHE_SEGMENTS 64
+#define DEFAULT_USER_CACHE_SIZE 65536 //* Users kept in memory
+
+typedef struct
+{
+    int capacity; //* 0 == cache disabled
+    int size;
+    long hits;
+    long misses;
+    long evictions;
+    long invalidations;
+    long name_hits; //* users.id -> username lookups
+    long name_misses;
+} UserCacheStats;
+
+//* ================== SETUP ==================
+int user_cache_init(int capacity); // 1 == success, 0 == out of memory (cache stays disabled)
+void user_cache_free(void);
+
+//* ================== LOOKUP ==================
+int user_cache_get(const char *username, User *user); // 1 == hit (user filled in), 0 == miss
+unsigned int user_cache_version(const char *username); // Take before reading the database for user_cache_fill()
+void user_cache_fill(const User *user, unsigned int version); // Insert a row read from the database, skipped if the user was written since version
+
+//* ================== WRITES ==================
+void user_cache_update(const char *username, int elo, int wins_delta, int losses_delta); // Write through a committed rating change
+void user_cache_invalidate(const char *username);
+
+//* ================== NAMES BY ID ==================
+int user_cache_get_name(int user_id, char *username, int size); // 1 == hit (username filled in), 0 == miss
+void user_cache_fill_name(int user_id, const char *username);
+void user_cache_forget_name(int user_id);
+
+void user_cache_get_stats(UserCacheStats *stats);
+
+#endif
@@ -24,9 +24,83 @@ int calculate_elo(int elo_a, int elo_b, float score_a)
     return new_elo_a;
 }
 
+// --- Matchmaking window, widening with the wait ---
+int match_window(const MatchWindow *window, long wait_ms)
+{
+    double t = wait_ms / 1000.0;
+    double growth;
+    switch (window->curve)
+    {
+    case WINDOW_QUADRATIC:
+        growth = t * t;
+        break;
+    case WINDOW_SQRT:
+        growth = sqrt(t);
+        break;
+    default:
+        growth = t;
+        break;
+    }
+
+    double width = window->base + window->rate * growth;
+    return width >= window->cap ? window->cap : (int)width;
+}
+
+long match_window_wait(const MatchWindow *window, int diff)
+{
+    if (diff <= window->base)
+        return 0;
+    if (diff > window->cap || window->rate <= 0)
+        return -1;
+
+    double growth = (double)(diff - window->base) / window->rate;
+    double t;
+    switch (window->curve)
+    {
+    case WINDOW_QUADRATIC:
+        t = sqrt(growth);
+        break;
+    case WINDOW_SQRT:
+        t = growth * growth;
+        break;
+    default:
+        t = growth;
+        break;
+    }
+    return (long)ceil(t * 1000.0);
+}
+
+int parse_match_window(const char *spec, MatchWindow *window)
+{
+    MatchWindow parsed = *window;
+    char curve[16] = "";
+    int n = 0, m = 0;
+
+    int fields = sscanf(spec, "%d,%d,%d%n,%15s%n", &parsed.base, &parsed.rate, &parsed.cap, &n, curve, &m);
+    if (!((fields == 3 && spec[n] == '\0') || (fields == 4 && spec[m] == '\0')))
+        return 0;
+    if (parsed.base < 0 || parsed.rate < 0 || parsed.cap < parsed.base)
+        return 0;
+
+    if (fields == 4)
+    {
+        if (strcmp(curve, "linear") == 0)
+            parsed.curve = WINDOW_LINEAR;
+        else if (strcmp(curve, "quadratic") == 0)
+            parsed.curve = WINDOW_QUADRATIC;
+        else if (strcmp(curve, "sqrt") == 0)
+            parsed.curve = WINDOW_SQRT;
+        else
+            return 0;
+    }
+
+    *window = parsed;
+    return 1;
+}
+
 // --- Matchmaking ELO range check ---
-int can_match(int elo_1, int elo_2)
+int can_match(int elo_1, int elo_2, int window)
 {
     int diff = abs(elo_1 - elo_2);
-    return diff <= 200;
+    return diff <= window;
 }
\ No newline at end of file
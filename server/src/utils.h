@@ -18,12 +18,51 @@ void hash_password(const char *password, char *outputBuffer);
  */
 int calculate_elo(int elo_a, int elo_b, float score_a);
 
+//* Matchmaking window: how far apart two ratings may be, widening with the time spent in the queue
+typedef enum
+{
+    WINDOW_LINEAR,    //* base + rate * t
+    WINDOW_QUADRATIC, //* base + rate * t^2, stays tight for a while then opens quickly
+    WINDOW_SQRT       //* base + rate * sqrt(t), opens quickly then levels off
+} WindowCurve;
+
+typedef struct
+{
+    int base;          //* Elo difference accepted right away
+    int rate;          //* Elo per second (per t unit of the curve)
+    int cap;           //* Widest the window ever gets
+    WindowCurve curve;
+} MatchWindow;
+
+/**
+ * Width of the match window after waiting.
+ * @param window    Window settings
+ * @param wait_ms   Time spent in the queue
+ * @return          Largest accepted ELO difference
+ */
+int match_window(const MatchWindow *window, long wait_ms);
+
+/**
+ * Inverse of match_window().
+ * @param window    Window settings
+ * @param diff      ELO difference to accept
+ * @return          Wait in ms until the window covers diff, 0 if it already does, -1 if never (over the cap)
+ */
+long match_window_wait(const MatchWindow *window, int diff);
+
+/**
+ * Parse "base,rate,cap[,linear|quadratic|sqrt]".
+ * @return          1 on success, 0 if malformed (window is left untouched)
+ */
+int parse_match_window(const char *spec, MatchWindow *window);
+
 /**
  * Check if two players can be matched (based on ELO difference).
  * @param elo_1     Player 1's ELO
  * @param elo_2     Player 2's ELO
+ * @param window    Largest accepted difference (see match_window())
  * @return          1 if they can be matched, 0 if too far apart
  */
-int can_match(int elo_1, int elo_2);
+int can_match(int elo_1, int elo_2, int window);
 
 #endif
\ No newline at end of file